@@ -0,0 +1,358 @@
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <set>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <chrono>
+
+#include <assimp/Importer.hpp>
+
+#include "MeshImport.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "CookedMesh.h"
+#include "CookedTexture.h"
+#include "CookerVersion.h"
+#include "TextureCache.h"
+#include "TextureLoader.h"
+#include "ThreadPool.h"
+
+struct CookOptions
+{
+	bool force = false;				// Cook even if the output is up to date
+	bool compress = false;			// LZ4 mode cooked meshes
+	MeshOptimizeOptions meshOptimize;
+	uint32_t threadCount = 0;
+};
+
+enum CookResult
+{
+	COOK_RESULT_FAILED,
+	COOK_RESULT_COOKED,
+	COOK_RESULT_UP_TO_DATE
+};
+
+// One output file, written by whichever worker picks it up and reported by the main thread afterwards
+struct CookJob
+{
+	std::string source;
+	std::string output;
+	CookResult result = COOK_RESULT_FAILED;
+	std::string error;
+	std::vector<std::string> textureNames;		// Models only: texture of each material
+	MeshOptimizeReport optimizeReport;			// Models only
+};
+
+static std::vector<char> readSourceFile(const std::string &fileName)
+{
+	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a source file!");
+	}
+
+	size_t fileSize = static_cast<size_t>(file.tellg());
+	std::vector<char> fileBuffer(fileSize);
+	file.seekg(0);
+	file.read(fileBuffer.data(), fileSize);
+
+	return fileBuffer;
+}
+
+// Drop triangles with repeated indices (zero area, nothing to rasterize) and the vertices no triangle uses any more
+static void removeUnusedGeometry(CookedModel::Mesh *mesh)
+{
+	std::vector<uint32_t> indices;
+	indices.reserve(mesh->indices.size());
+	for (size_t i = 0; i + 2 < mesh->indices.size(); i += 3)
+	{
+		uint32_t a = mesh->indices[i];
+		uint32_t b = mesh->indices[i + 1];
+		uint32_t c = mesh->indices[i + 2];
+		if (a != b && b != c && a != c)
+		{
+			indices.insert(indices.end(), { a, b, c });
+		}
+	}
+
+	// Keep the order of the vertices that remain
+	std::vector<uint32_t> remap(mesh->vertices.size(), UINT32_MAX);
+	for (uint32_t index : indices)
+	{
+		remap[index] = 0;
+	}
+
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh->vertices.size());
+	for (size_t i = 0; i < mesh->vertices.size(); i++)
+	{
+		if (remap[i] == 0)
+		{
+			remap[i] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(mesh->vertices[i]);
+		}
+	}
+	for (uint32_t &index : indices)
+	{
+		index = remap[index];
+	}
+
+	mesh->vertices = std::move(vertices);
+	mesh->indices = std::move(indices);
+}
+
+static void cookModel(CookJob *job, const CookOptions &options)
+{
+	try
+	{
+		std::vector<char> source = readSourceFile(job->source);
+		uint64_t sourceHash = CookedMeshFile::hashSource(TextureCache::hashContent(source), options.meshOptimize);
+
+		// Up to date: same source, same cooker, same mode
+		CookedMeshFile existing;
+		if (!options.force && existing.open(job->output) && existing.getSourceHash() == sourceHash
+			&& existing.getCookerVersion() == COOKER_VERSION && existing.isCompressed() == options.compress)
+		{
+			job->textureNames = existing.getTextureNames();
+			job->result = COOK_RESULT_UP_TO_DATE;
+			return;
+		}
+		existing.close();
+
+		// One importer per job, Assimp importers aren't shared between threads
+		Assimp::Importer importer;
+		const aiScene *scene = importer.ReadFile(job->source, MESH_IMPORT_FLAGS);
+		if (!scene)
+		{
+			throw std::runtime_error(std::string("Failed to import model! (") + importer.GetErrorString() + ")");
+		}
+
+		CookedModel model = MeshImport::loadModel(scene);
+		for (auto &mesh : model.meshes)
+		{
+			removeUnusedGeometry(&mesh);
+			mesh.lods = MeshSimplifier::buildLods(mesh.vertices, &mesh.indices);
+			MeshOptimizer::optimize(&mesh.vertices, &mesh.indices, mesh.lods, options.meshOptimize, &job->optimizeReport);
+			mesh.bounds = MeshSimplifier::computeBoundingSphere(mesh.vertices);
+			mesh.box = MeshSimplifier::computeBoundingBox(mesh.vertices);
+		}
+
+		if (!CookedMeshFile::write(job->output, model, options.compress, sourceHash, COOKER_VERSION))
+		{
+			throw std::runtime_error("Failed to write a cooked mesh file!");
+		}
+
+		job->textureNames = model.textureNames;
+		job->result = COOK_RESULT_COOKED;
+	}
+	catch (const std::exception &e)
+	{
+		job->error = e.what();
+	}
+}
+
+static void cookTexture(CookJob *job, const CookOptions &options)
+{
+	try
+	{
+		std::vector<char> source = readSourceFile(job->source);
+		uint64_t sourceHash = TextureCache::hashContent(source);
+
+		CookedTextureFile existing;
+		if (!options.force && existing.open(job->output) && existing.getSourceHash() == sourceHash
+			&& existing.getCookerVersion() == COOKER_VERSION)
+		{
+			job->result = COOK_RESULT_UP_TO_DATE;
+			return;
+		}
+		existing.close();
+
+		int width, height;
+		TextureLoader::readInfo(job->source, source, &width, &height);
+		if (static_cast<uint32_t>(width) > COOKED_TEXTURE_MAX_SIZE || static_cast<uint32_t>(height) > COOKED_TEXTURE_MAX_SIZE)
+		{
+			throw std::runtime_error("Texture is too large to cook!");
+		}
+
+		// Whole mip chain built here, the runtime only copies it
+		uint32_t mipLevels = getMipLevelCount(width, height);
+		std::vector<uint8_t> mipChain(TextureLoader::getDecodeSize(width, height, mipLevels, true));
+		TextureLoader::decode(job->source, source, mipChain.data(), width, height, mipLevels, true);
+
+		if (!CookedTextureFile::write(job->output, width, height, mipChain.data(), sourceHash, COOKER_VERSION))
+		{
+			throw std::runtime_error("Failed to write a cooked texture file!");
+		}
+
+		job->result = COOK_RESULT_COOKED;
+	}
+	catch (const std::exception &e)
+	{
+		job->error = e.what();
+	}
+}
+
+// Run every job on the pool and wait for all of them
+static void runJobs(std::vector<CookJob> &jobs, void (*cook)(CookJob *, const CookOptions &), const CookOptions &options)
+{
+	ThreadPool threadPool;
+	threadPool.init(options.threadCount);
+	for (auto &job : jobs)
+	{
+		CookJob *cookJob = &job;
+		threadPool.enqueue([cook, cookJob, &options]() { cook(cookJob, options); });
+	}
+	threadPool.destroy();
+}
+
+// Prints one line per job, returns the number of failures
+static size_t reportJobs(const std::vector<CookJob> &jobs, size_t *cookedCount, size_t *upToDateCount)
+{
+	size_t failedCount = 0;
+	for (const auto &job : jobs)
+	{
+		switch (job.result)
+		{
+		case COOK_RESULT_COOKED:
+			printf("  cooked      %s -> %s\n", job.source.c_str(), job.output.c_str());
+			if (job.optimizeReport.before.triangleCount > 0)
+			{
+				printf("              ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%llu triangles)\n",
+					job.optimizeReport.before.getAcmr(), job.optimizeReport.after.getAcmr(),
+					job.optimizeReport.before.getAtvr(), job.optimizeReport.after.getAtvr(),
+					static_cast<unsigned long long>(job.optimizeReport.before.triangleCount));
+			}
+			(*cookedCount)++;
+			break;
+		case COOK_RESULT_UP_TO_DATE:
+			printf("  up to date  %s\n", job.source.c_str());
+			(*upToDateCount)++;
+			break;
+		default:
+			printf("  FAILED      %s: %s\n", job.source.c_str(), job.error.c_str());
+			failedCount++;
+			break;
+		}
+	}
+	return failedCount;
+}
+
+static void printUsage()
+{
+	printf("Usage: AssetCooker [options] <model files...>\n");
+	printf("Writes a .cmesh next to each model, and a .ctex next to each texture it uses (Textures/<name>.ctex).\n");
+	printf("Run from the directory the engine runs in, so texture paths resolve the same way.\n");
+	printf("  --force            cook even if the output is up to date\n");
+	printf("  --lz4              LZ4 compress cooked meshes\n");
+	printf("  --no-vertex-cache  keep the imported triangle order (overdraw sorting needs it too)\n");
+	printf("  --no-overdraw      don't sort triangle clusters for overdraw\n");
+	printf("  --no-vertex-fetch  don't renumber vertices in order of first use\n");
+	printf("  --threads <count>  worker threads (default: one per hardware thread)\n");
+}
+
+int main(int argc, char **argv)
+{
+	CookOptions options;
+	std::vector<std::string> modelFiles;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--force")
+		{
+			options.force = true;
+		}
+		else if (arg == "--lz4")
+		{
+			options.compress = true;
+		}
+		else if (arg == "--no-vertex-cache")
+		{
+			options.meshOptimize.vertexCache = false;
+		}
+		else if (arg == "--no-overdraw")
+		{
+			options.meshOptimize.overdraw = false;
+		}
+		else if (arg == "--no-vertex-fetch")
+		{
+			options.meshOptimize.vertexFetch = false;
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			options.threadCount = static_cast<uint32_t>(std::max(1, atoi(argv[++i])));
+		}
+		else if (arg == "--help" || arg.compare(0, 2, "--") == 0)
+		{
+			printUsage();
+			return EXIT_FAILURE;
+		}
+		else
+		{
+			modelFiles.push_back(arg);
+		}
+	}
+
+	if (modelFiles.empty())
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (options.threadCount == 0)
+	{
+		// Main thread only waits, so every hardware thread gets a worker
+		options.threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	// Models first, they name the textures to cook
+	std::vector<CookJob> modelJobs(modelFiles.size());
+	for (size_t i = 0; i < modelFiles.size(); i++)
+	{
+		modelJobs[i].source = modelFiles[i];
+		modelJobs[i].output = CookedMeshFile::getCookedPath(modelFiles[i]);
+	}
+	runJobs(modelJobs, cookModel, options);
+
+	// Each texture once, however many models use it (same path resolution as the runtime texture cache)
+	std::set<std::string> texturePaths;
+	for (const auto &job : modelJobs)
+	{
+		for (const auto &textureName : job.textureNames)
+		{
+			if (!textureName.empty())
+			{
+				texturePaths.insert(TextureCache::resolvePath(textureName));
+			}
+		}
+	}
+
+	std::vector<CookJob> textureJobs;
+	for (const auto &texturePath : texturePaths)
+	{
+		CookJob job;
+		job.source = texturePath;
+		job.output = CookedTextureFile::getCookedPath(texturePath);
+		textureJobs.push_back(job);
+	}
+	runJobs(textureJobs, cookTexture, options);
+
+	size_t cookedCount = 0;
+	size_t upToDateCount = 0;
+	printf("Models:\n");
+	size_t failedCount = reportJobs(modelJobs, &cookedCount, &upToDateCount);
+	printf("Textures:\n");
+	failedCount += reportJobs(textureJobs, &cookedCount, &upToDateCount);
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double totalMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	printf("%zu cooked, %zu up to date, %zu failed in %.2f ms (%u threads)\n", cookedCount, upToDateCount, failedCount,
+		totalMs, options.threadCount);
+
+	return failedCount > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "FrustumCuller.h"
+
+// Checks every SIMD kernel of FrustumCuller the CPU supports against the scalar one, over random bounds and the edge
+// cases where they could disagree (bounds exactly touching a plane, zero sized bounds, padding lanes, partial batches).
+// Returns 0 if all of them agree exactly.
+
+const char *KERNEL_NAMES[FRUSTUM_CULL_KERNEL_COUNT] = { "scalar", "SSE", "AVX2", "NEON" };
+
+const uint32_t RANDOM_OBJECT_COUNT = 1003;		// Not a multiple of FRUSTUM_CULL_BATCH, so the last batch has padding lanes
+const uint32_t RANDOM_FRUSTUM_COUNT = 64;
+const float INSIDE_RADIUS = 1000.0f;			// Spheres this big never decide the result, the box does
+
+struct TestObject
+{
+	glm::mat4 transform;
+	BoundingBox box;
+	BoundingSphere sphere;
+};
+
+static int failureCount = 0;
+
+static void expect(bool condition, const std::string &name)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", name.c_str());
+		failureCount++;
+	}
+}
+
+static glm::mat4 makeTransform(const glm::vec3 &translation, float angle, const glm::vec3 &scale)
+{
+	// Rotation about Y, then scale (columns are the transformed axes)
+	float c = std::cos(angle);
+	float s = std::sin(angle);
+	glm::mat4 transform(1.0f);
+	transform[0] = glm::vec4(c * scale.x, 0.0f, -s * scale.x, 0.0f);
+	transform[1] = glm::vec4(0.0f, scale.y, 0.0f, 0.0f);
+	transform[2] = glm::vec4(s * scale.z, 0.0f, c * scale.z, 0.0f);
+	transform[3] = glm::vec4(translation, 1.0f);
+	return transform;
+}
+
+static TestObject makeBox(const glm::vec3 &minimum, const glm::vec3 &maximum, float radius)
+{
+	TestObject object;
+	object.transform = glm::mat4(1.0f);
+	object.box.minimum = minimum;
+	object.box.maximum = maximum;
+	object.sphere.center = (minimum + maximum) * 0.5f;
+	object.sphere.radius = radius;
+	return object;
+}
+
+// Axis aligned frustum (a box) from -size to size on every axis
+static Frustum makeBoxFrustum(float size)
+{
+	Frustum frustum;
+	frustum.planes[FRUSTUM_LEFT] = glm::vec4(1.0f, 0.0f, 0.0f, size);
+	frustum.planes[FRUSTUM_RIGHT] = glm::vec4(-1.0f, 0.0f, 0.0f, size);
+	frustum.planes[FRUSTUM_BOTTOM] = glm::vec4(0.0f, 1.0f, 0.0f, size);
+	frustum.planes[FRUSTUM_TOP] = glm::vec4(0.0f, -1.0f, 0.0f, size);
+	frustum.planes[FRUSTUM_NEAR] = glm::vec4(0.0f, 0.0f, 1.0f, size);
+	frustum.planes[FRUSTUM_FAR] = glm::vec4(0.0f, 0.0f, -1.0f, size);
+	return frustum;
+}
+
+static Frustum makeRandomFrustum(std::mt19937 &random)
+{
+	std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> offset(0.0f, 60.0f);
+
+	Frustum frustum;
+	for (auto &plane : frustum.planes)
+	{
+		glm::vec3 normal(direction(random), direction(random), direction(random));
+		if (glm::dot(normal, normal) < 1e-4f) normal = glm::vec3(0.0f, 0.0f, 1.0f);
+		normal = glm::normalize(normal);
+		plane = glm::vec4(normal, offset(random));
+	}
+	return frustum;
+}
+
+// Cull objects with the scalar kernel and with every other supported one, and compare the whole visibility
+// arrays (padding lanes included). Returns the scalar results.
+static std::vector<uint8_t> compareKernels(const std::vector<TestObject> &objects, const Frustum &frustum, const std::string &name)
+{
+	FrustumCuller culler;
+	for (const auto &object : objects)
+	{
+		culler.add(object.transform, object.box, object.sphere);
+	}
+
+	culler.setKernel(FRUSTUM_CULL_SCALAR);
+	culler.cull(frustum);
+	std::vector<uint8_t> expected = culler.getVisibility();
+	expect(expected.size() % FRUSTUM_CULL_BATCH == 0 && expected.size() >= objects.size(), name + ": padded visibility size");
+
+	for (int i = FRUSTUM_CULL_SCALAR + 1; i < FRUSTUM_CULL_KERNEL_COUNT; i++)
+	{
+		FrustumCullKernel kernel = static_cast<FrustumCullKernel>(i);
+		if (!FrustumCuller::isKernelSupported(kernel)) continue;
+
+		culler.setKernel(kernel);
+		expect(culler.getKernel() == kernel, name + ": " + KERNEL_NAMES[kernel] + " kernel set");
+		culler.cull(frustum);
+
+		const std::vector<uint8_t> &visibility = culler.getVisibility();
+		bool same = visibility.size() == expected.size();
+		for (size_t j = 0; same && j < visibility.size(); j++)
+		{
+			if (visibility[j] != expected[j])
+			{
+				printf("  %s: %s kernel says %u for object %zu, scalar says %u\n", name.c_str(), KERNEL_NAMES[kernel],
+					visibility[j], j, expected[j]);
+				same = false;
+			}
+		}
+		expect(same, name + ": " + KERNEL_NAMES[kernel] + " kernel matches scalar");
+	}
+
+	return expected;
+}
+
+static void testRandom()
+{
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<float> position(-80.0f, 80.0f);
+	std::uniform_real_distribution<float> size(0.0f, 8.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	std::uniform_real_distribution<float> scale(0.1f, 4.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<TestObject> objects(RANDOM_OBJECT_COUNT);
+	for (auto &object : objects)
+	{
+		glm::vec3 minimum(position(random) * 0.1f, position(random) * 0.1f, position(random) * 0.1f);
+		glm::vec3 maximum = minimum + glm::vec3(size(random), size(random), size(random));
+		object.transform = makeTransform(glm::vec3(position(random), position(random), position(random)), angle(random),
+			glm::vec3(scale(random), scale(random), scale(random)));
+		object.box.minimum = minimum;
+		object.box.maximum = maximum;
+
+		// Anywhere from well inside the box to well around it, so either bound can be the tighter one
+		object.sphere.center = minimum + (maximum - minimum) * unit(random);
+		object.sphere.radius = glm::length(maximum - minimum) * (0.25f + unit(random));
+	}
+
+	compareKernels(objects, makeBoxFrustum(40.0f), "random objects, box frustum");
+	for (uint32_t i = 0; i < RANDOM_FRUSTUM_COUNT; i++)
+	{
+		compareKernels(objects, makeRandomFrustum(random), "random objects, random frustum " + std::to_string(i));
+	}
+}
+
+static void testTouchingPlanes()
+{
+	const float size = 10.0f;
+	Frustum frustum = makeBoxFrustum(size);
+	float beyond = std::nextafter(size, std::numeric_limits<float>::max());
+
+	std::vector<TestObject> objects;
+	std::vector<uint8_t> expected;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (float side : { -1.0f, 1.0f })
+		{
+			glm::vec3 direction(0.0f);
+			direction[axis] = side;
+
+			// Box outside the frustum with a face exactly on a plane: touching counts as visible
+			objects.push_back(makeBox(direction * size, direction * (size + 2.0f), INSIDE_RADIUS));
+			expected.push_back(1);
+			if (side < 0.0f) std::swap(objects.back().box.minimum, objects.back().box.maximum);
+
+			// The same box moved just past the plane
+			objects.push_back(makeBox(direction * beyond, direction * (beyond + 2.0f), INSIDE_RADIUS));
+			expected.push_back(0);
+			if (side < 0.0f) std::swap(objects.back().box.minimum, objects.back().box.maximum);
+
+			// Sphere tighter than the box, exactly touching the plane from outside
+			TestObject sphereObject = makeBox(direction * (size - 5.0f), direction * (size + 7.0f), 1.0f);
+			sphereObject.sphere.center = direction * (size + 1.0f);
+			if (side < 0.0f) std::swap(sphereObject.box.minimum, sphereObject.box.maximum);
+			objects.push_back(sphereObject);
+			expected.push_back(1);
+
+			// Zero sized box (a point) on the plane, and one just outside it
+			objects.push_back(makeBox(direction * size, direction * size, 0.0f));
+			expected.push_back(1);
+			objects.push_back(makeBox(direction * beyond, direction * beyond, 0.0f));
+			expected.push_back(0);
+		}
+	}
+
+	// Zero sized boxes inside, at a corner, and outside
+	objects.push_back(makeBox(glm::vec3(0.0f), glm::vec3(0.0f), 0.0f));
+	expected.push_back(1);
+	objects.push_back(makeBox(glm::vec3(size), glm::vec3(size), 0.0f));
+	expected.push_back(1);
+	objects.push_back(makeBox(glm::vec3(-beyond, 0.0f, 0.0f), glm::vec3(-beyond, 0.0f, 0.0f), 0.0f));
+	expected.push_back(0);
+
+	std::vector<uint8_t> visibility = compareKernels(objects, frustum, "touching planes");
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		expect(visibility[i] == expected[i], "touching planes: object " + std::to_string(i) + " culled as expected");
+	}
+}
+
+static void testBatchSizes()
+{
+	// Every count around the batch boundaries, with the padding lanes (zero sized boxes at the origin) both inside the
+	// frustum and outside it
+	std::mt19937 random(777);
+	std::uniform_real_distribution<float> position(-30.0f, 30.0f);
+	for (uint32_t count = 0; count <= 3 * FRUSTUM_CULL_BATCH + 1; count++)
+	{
+		std::vector<TestObject> objects;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec3 center(position(random), position(random), position(random));
+			objects.push_back(makeBox(center - glm::vec3(1.0f), center + glm::vec3(1.0f), 2.0f));
+		}
+
+		Frustum outside = makeBoxFrustum(20.0f);
+		outside.planes[FRUSTUM_LEFT].w = -5.0f;		// x >= 5, the origin is culled
+
+		compareKernels(objects, makeBoxFrustum(20.0f), std::to_string(count) + " objects, origin inside");
+		compareKernels(objects, outside, std::to_string(count) + " objects, origin outside");
+	}
+}
+
+int main()
+{
+	for (int i = 0; i < FRUSTUM_CULL_KERNEL_COUNT; i++)
+	{
+		FrustumCullKernel kernel = static_cast<FrustumCullKernel>(i);
+		printf("%-8s %s\n", KERNEL_NAMES[kernel], FrustumCuller::isKernelSupported(kernel) ? "tested" : "not supported, skipped");
+	}
+
+	testRandom();
+	testTouchingPlanes();
+	testBatchSizes();
+
+	if (failureCount > 0)
+	{
+		printf("%d checks failed\n", failureCount);
+		return EXIT_FAILURE;
+	}
+
+	printf("All kernels agree with the scalar kernel\n");
+	return EXIT_SUCCESS;
+}
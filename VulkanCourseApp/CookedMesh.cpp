@@ -0,0 +1,450 @@
+#include "CookedMesh.h"
+#include "CpuTracer.h"
+#include "Lz4.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + COOKED_MESH_ALIGNMENT - 1) / COOKED_MESH_ALIGNMENT * COOKED_MESH_ALIGNMENT;
+}
+
+CookedMeshFile::CookedMeshFile()
+{
+}
+
+bool CookedMeshFile::open(const std::string & fileName)
+{
+	CPU_TRACE_SCOPE("CookedMeshFile::open");
+
+	close();
+	if (!file.open(fileName))
+	{
+		return false;
+	}
+
+	if (!validate() || ((header.flags & COOKED_MESH_FLAG_LZ4) && !decompress()) || !validateIndices())
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CookedMeshFile::close()
+{
+	file.close();
+	meshes = nullptr;
+	materials = nullptr;
+	lods = nullptr;
+	data = nullptr;
+	decompressedData.clear();
+	decompressedData.shrink_to_fit();
+}
+
+uint64_t CookedMeshFile::getSourceHash()
+{
+	return header.sourceHash;
+}
+
+uint32_t CookedMeshFile::getCookerVersion()
+{
+	return header.cookerVersion;
+}
+
+bool CookedMeshFile::isCompressed()
+{
+	return (header.flags & COOKED_MESH_FLAG_LZ4) != 0;
+}
+
+uint32_t CookedMeshFile::getMeshCount()
+{
+	return header.meshCount;
+}
+
+const CookedMeshEntry & CookedMeshFile::getMesh(uint32_t index)
+{
+	return meshes[index];
+}
+
+std::vector<MeshLod> CookedMeshFile::getLods(uint32_t index)
+{
+	std::vector<MeshLod> meshLods;
+	for (uint32_t i = 0; i < meshes[index].lodCount; i++)
+	{
+		const CookedLodEntry &lod = lods[meshes[index].firstLod + i];
+		meshLods.push_back({ lod.firstIndex, lod.indexCount, lod.error });
+	}
+	return meshLods;
+}
+
+BoundingSphere CookedMeshFile::getBounds(uint32_t index)
+{
+	const CookedMeshEntry &mesh = meshes[index];
+	return { glm::vec3(mesh.boundsCenter[0], mesh.boundsCenter[1], mesh.boundsCenter[2]), mesh.boundsRadius };
+}
+
+BoundingBox CookedMeshFile::getBoundingBox(uint32_t index)
+{
+	const CookedMeshEntry &mesh = meshes[index];
+	return { glm::vec3(mesh.boxMinimum[0], mesh.boxMinimum[1], mesh.boxMinimum[2]),
+		glm::vec3(mesh.boxMaximum[0], mesh.boxMaximum[1], mesh.boxMaximum[2]) };
+}
+
+std::vector<std::string> CookedMeshFile::getTextureNames()
+{
+	const char *names = reinterpret_cast<const char *>(file.getData() + header.nameTableOffset);
+
+	std::vector<std::string> textureNames(header.materialCount);
+	for (uint32_t i = 0; i < header.materialCount; i++)
+	{
+		textureNames[i].assign(names + materials[i].textureNameOffset, materials[i].textureNameLength);
+	}
+	return textureNames;
+}
+
+const Vertex * CookedMeshFile::getVertices()
+{
+	return reinterpret_cast<const Vertex *>(data);
+}
+
+const uint32_t * CookedMeshFile::getIndices()
+{
+	return reinterpret_cast<const uint32_t *>(data + header.vertexDataSize);
+}
+
+std::string CookedMeshFile::getCookedPath(const std::string & modelFile)
+{
+	size_t extension = modelFile.rfind('.');
+	size_t directory = modelFile.find_last_of("/\\");
+	if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+	{
+		return modelFile + ".cmesh";
+	}
+	return modelFile.substr(0, extension) + ".cmesh";
+}
+
+uint64_t CookedMeshFile::hashSource(uint64_t contentHash, const MeshOptimizeOptions & optimizeOptions)
+{
+	uint8_t settings[] = {
+		static_cast<uint8_t>(optimizeOptions.vertexCache),
+		static_cast<uint8_t>(optimizeOptions.overdraw),
+		static_cast<uint8_t>(optimizeOptions.vertexFetch)
+	};
+
+	uint64_t hash = contentHash;
+	for (uint8_t setting : settings)
+	{
+		hash ^= setting;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool CookedMeshFile::write(const std::string & fileName, const CookedModel & model, bool compress, uint64_t sourceHash, uint32_t cookerVersion)
+{
+	CPU_TRACE_SCOPE("CookedMeshFile::write");
+
+	CookedMeshHeader fileHeader = {};
+	fileHeader.magic = COOKED_MESH_MAGIC;
+	fileHeader.version = COOKED_MESH_VERSION;
+	fileHeader.flags = compress ? COOKED_MESH_FLAG_LZ4 : 0;
+	fileHeader.vertexSize = sizeof(Vertex);
+	fileHeader.meshCount = static_cast<uint32_t>(model.meshes.size());
+	fileHeader.materialCount = static_cast<uint32_t>(model.textureNames.size());
+	fileHeader.cookerVersion = cookerVersion;
+	fileHeader.sourceHash = sourceHash;
+
+	// Tables
+	std::vector<CookedMeshEntry> meshEntries;
+	std::vector<CookedLodEntry> lodEntries;
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+	for (const auto &mesh : model.meshes)
+	{
+		CookedMeshEntry entry = {};
+		entry.firstVertex = vertexCount;
+		entry.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+		entry.firstIndex = indexCount;
+		entry.indexCount = static_cast<uint32_t>(mesh.indices.size());
+		entry.materialIndex = mesh.materialIndex;
+		entry.boundsCenter[0] = mesh.bounds.center.x;
+		entry.boundsCenter[1] = mesh.bounds.center.y;
+		entry.boundsCenter[2] = mesh.bounds.center.z;
+		entry.boundsRadius = mesh.bounds.radius;
+		for (int i = 0; i < 3; i++)
+		{
+			entry.boxMinimum[i] = mesh.box.minimum[i];
+			entry.boxMaximum[i] = mesh.box.maximum[i];
+		}
+
+		std::vector<MeshLod> meshLods = mesh.lods;
+		if (meshLods.empty())
+		{
+			meshLods.push_back({ 0, entry.indexCount, 0.0f });
+		}
+		entry.firstLod = static_cast<uint32_t>(lodEntries.size());
+		entry.lodCount = static_cast<uint32_t>(meshLods.size());
+		for (const auto &lod : meshLods)
+		{
+			CookedLodEntry lodEntry = {};
+			lodEntry.firstIndex = lod.firstIndex;
+			lodEntry.indexCount = lod.indexCount;
+			lodEntry.error = lod.error;
+			lodEntries.push_back(lodEntry);
+		}
+		meshEntries.push_back(entry);
+
+		vertexCount += entry.vertexCount;
+		indexCount += entry.indexCount;
+	}
+
+	std::vector<CookedMaterialEntry> materialEntries;
+	std::string names;
+	for (const auto &textureName : model.textureNames)
+	{
+		CookedMaterialEntry entry = {};
+		entry.textureNameOffset = static_cast<uint32_t>(names.size());
+		entry.textureNameLength = static_cast<uint32_t>(textureName.size());
+		materialEntries.push_back(entry);
+		names += textureName;
+	}
+
+	fileHeader.lodCount = static_cast<uint32_t>(lodEntries.size());
+
+	// Data: all vertices, then all indices
+	fileHeader.vertexDataSize = static_cast<uint64_t>(vertexCount) * sizeof(Vertex);
+	fileHeader.indexDataSize = static_cast<uint64_t>(indexCount) * sizeof(uint32_t);
+	std::vector<uint8_t> meshData(static_cast<size_t>(fileHeader.vertexDataSize + fileHeader.indexDataSize));
+	uint8_t *dataHead = meshData.data();
+	for (const auto &mesh : model.meshes)
+	{
+		memcpy(dataHead, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+		dataHead += mesh.vertices.size() * sizeof(Vertex);
+	}
+	for (const auto &mesh : model.meshes)
+	{
+		memcpy(dataHead, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+		dataHead += mesh.indices.size() * sizeof(uint32_t);
+	}
+
+	// LZ4 mode: independent chunks, kept uncompressed where compressing doesn't help
+	std::vector<CookedChunkEntry> chunkEntries;
+	std::vector<uint8_t> chunkData;
+	if (compress)
+	{
+		std::vector<uint8_t> compressed(Lz4::compressBound(COOKED_MESH_CHUNK_SIZE));
+		for (size_t chunkBegin = 0; chunkBegin < meshData.size(); chunkBegin += COOKED_MESH_CHUNK_SIZE)
+		{
+			size_t chunkSize = std::min(meshData.size() - chunkBegin, static_cast<size_t>(COOKED_MESH_CHUNK_SIZE));
+			size_t compressedSize = Lz4::compress(meshData.data() + chunkBegin, chunkSize, compressed.data(), compressed.size());
+
+			CookedChunkEntry entry = {};
+			entry.offset = chunkData.size();
+			entry.size = static_cast<uint32_t>(chunkSize);
+			if (compressedSize > 0 && compressedSize < chunkSize)
+			{
+				entry.compressedSize = static_cast<uint32_t>(compressedSize);
+				chunkData.insert(chunkData.end(), compressed.begin(), compressed.begin() + compressedSize);
+			}
+			else
+			{
+				entry.compressedSize = entry.size;
+				chunkData.insert(chunkData.end(), meshData.begin() + chunkBegin, meshData.begin() + chunkBegin + chunkSize);
+			}
+			chunkEntries.push_back(entry);
+		}
+		fileHeader.chunkCount = static_cast<uint32_t>(chunkEntries.size());
+	}
+
+	// Layout
+	fileHeader.meshTableOffset = alignOffset(sizeof(CookedMeshHeader));
+	fileHeader.materialTableOffset = alignOffset(fileHeader.meshTableOffset + meshEntries.size() * sizeof(CookedMeshEntry));
+	fileHeader.nameTableOffset = fileHeader.materialTableOffset + materialEntries.size() * sizeof(CookedMaterialEntry);
+	fileHeader.chunkTableOffset = alignOffset(fileHeader.nameTableOffset + names.size());
+	fileHeader.lodTableOffset = alignOffset(fileHeader.chunkTableOffset + chunkEntries.size() * sizeof(CookedChunkEntry));
+	fileHeader.dataOffset = alignOffset(fileHeader.lodTableOffset + lodEntries.size() * sizeof(CookedLodEntry));
+
+	std::ofstream output(fileName, std::ios::binary | std::ios::trunc);
+	if (!output.is_open())
+	{
+		return false;
+	}
+
+	auto writeAt = [&output](uint64_t offset, const void *bytes, size_t size)
+	{
+		// Zero padding up to the aligned offset
+		static const char padding[COOKED_MESH_ALIGNMENT] = {};
+		output.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(output.tellp())));
+		output.write(static_cast<const char *>(bytes), static_cast<std::streamsize>(size));
+	};
+
+	writeAt(0, &fileHeader, sizeof(fileHeader));
+	writeAt(fileHeader.meshTableOffset, meshEntries.data(), meshEntries.size() * sizeof(CookedMeshEntry));
+	writeAt(fileHeader.materialTableOffset, materialEntries.data(), materialEntries.size() * sizeof(CookedMaterialEntry));
+	writeAt(fileHeader.nameTableOffset, names.data(), names.size());
+	writeAt(fileHeader.chunkTableOffset, chunkEntries.data(), chunkEntries.size() * sizeof(CookedChunkEntry));
+	writeAt(fileHeader.lodTableOffset, lodEntries.data(), lodEntries.size() * sizeof(CookedLodEntry));
+	if (compress)
+	{
+		writeAt(fileHeader.dataOffset, chunkData.data(), chunkData.size());
+	}
+	else
+	{
+		writeAt(fileHeader.dataOffset, meshData.data(), meshData.size());
+	}
+
+	return output.good();
+}
+
+CookedMeshFile::~CookedMeshFile()
+{
+	close();
+}
+
+bool CookedMeshFile::validate()
+{
+	uint64_t fileSize = file.getSize();
+	if (fileSize < sizeof(CookedMeshHeader))
+	{
+		return false;
+	}
+	memcpy(&header, file.getData(), sizeof(CookedMeshHeader));
+
+	if (header.magic != COOKED_MESH_MAGIC || header.version != COOKED_MESH_VERSION || header.vertexSize != sizeof(Vertex))
+	{
+		return false;
+	}
+
+	// Every table inside the file (sizes are checked against the file before multiplying, so nothing overflows)
+	auto inFile = [fileSize](uint64_t offset, uint64_t count, uint64_t elementSize)
+	{
+		return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+	};
+	if (!inFile(header.meshTableOffset, header.meshCount, sizeof(CookedMeshEntry))
+		|| !inFile(header.materialTableOffset, header.materialCount, sizeof(CookedMaterialEntry))
+		|| !inFile(header.chunkTableOffset, header.chunkCount, sizeof(CookedChunkEntry))
+		|| !inFile(header.lodTableOffset, header.lodCount, sizeof(CookedLodEntry))
+		|| header.nameTableOffset > fileSize || header.dataOffset > fileSize
+		|| header.meshTableOffset % alignof(CookedMeshEntry) != 0
+		|| header.materialTableOffset % alignof(CookedMaterialEntry) != 0
+		|| header.chunkTableOffset % alignof(CookedChunkEntry) != 0
+		|| header.lodTableOffset % alignof(CookedLodEntry) != 0
+		|| header.dataOffset % COOKED_MESH_ALIGNMENT != 0
+		|| header.vertexDataSize % sizeof(Vertex) != 0 || header.indexDataSize % sizeof(uint32_t) != 0
+		|| header.vertexDataSize > UINT32_MAX * static_cast<uint64_t>(sizeof(Vertex))
+		|| header.indexDataSize > UINT32_MAX * static_cast<uint64_t>(sizeof(uint32_t)))
+	{
+		return false;
+	}
+
+	meshes = reinterpret_cast<const CookedMeshEntry *>(file.getData() + header.meshTableOffset);
+	materials = reinterpret_cast<const CookedMaterialEntry *>(file.getData() + header.materialTableOffset);
+	lods = reinterpret_cast<const CookedLodEntry *>(file.getData() + header.lodTableOffset);
+
+	uint64_t nameTableSize = fileSize - header.nameTableOffset;
+	for (uint32_t i = 0; i < header.materialCount; i++)
+	{
+		if (static_cast<uint64_t>(materials[i].textureNameOffset) + materials[i].textureNameLength > nameTableSize)
+		{
+			return false;
+		}
+	}
+
+	uint64_t vertexTotal = header.vertexDataSize / sizeof(Vertex);
+	uint64_t indexTotal = header.indexDataSize / sizeof(uint32_t);
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		const CookedMeshEntry &mesh = meshes[i];
+		if (static_cast<uint64_t>(mesh.firstVertex) + mesh.vertexCount > vertexTotal
+			|| static_cast<uint64_t>(mesh.firstIndex) + mesh.indexCount > indexTotal
+			|| mesh.materialIndex >= header.materialCount
+			|| mesh.lodCount == 0 || static_cast<uint64_t>(mesh.firstLod) + mesh.lodCount > header.lodCount)
+		{
+			return false;
+		}
+		for (uint32_t l = mesh.firstLod; l < mesh.firstLod + mesh.lodCount; l++)
+		{
+			if (static_cast<uint64_t>(lods[l].firstIndex) + lods[l].indexCount > mesh.indexCount)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Uncompressed data is used straight from the mapping
+	if (!(header.flags & COOKED_MESH_FLAG_LZ4))
+	{
+		if (header.vertexDataSize + header.indexDataSize > fileSize - header.dataOffset)
+		{
+			return false;
+		}
+		data = file.getData() + header.dataOffset;
+	}
+
+	return true;
+}
+
+bool CookedMeshFile::decompress()
+{
+	CPU_TRACE_SCOPE("CookedMeshFile::decompress");
+
+	const CookedChunkEntry *chunks = reinterpret_cast<const CookedChunkEntry *>(file.getData() + header.chunkTableOffset);
+	uint64_t dataSize = header.vertexDataSize + header.indexDataSize;
+	uint64_t chunkDataSize = file.getSize() - header.dataOffset;
+
+	decompressedData.resize(static_cast<size_t>(dataSize));
+
+	uint64_t decompressedSize = 0;
+	for (uint32_t i = 0; i < header.chunkCount; i++)
+	{
+		const CookedChunkEntry &chunk = chunks[i];
+		if (chunk.offset > chunkDataSize || chunk.compressedSize > chunkDataSize - chunk.offset || chunk.size > dataSize - decompressedSize)
+		{
+			return false;
+		}
+
+		const uint8_t *chunkBytes = file.getData() + header.dataOffset + chunk.offset;
+		uint8_t *output = decompressedData.data() + decompressedSize;
+		if (chunk.compressedSize == chunk.size)
+		{
+			memcpy(output, chunkBytes, chunk.size);
+		}
+		else if (!Lz4::decompress(chunkBytes, chunk.compressedSize, output, chunk.size))
+		{
+			return false;
+		}
+		decompressedSize += chunk.size;
+	}
+
+	if (decompressedSize != dataSize)
+	{
+		return false;
+	}
+
+	data = decompressedData.data();
+	return true;
+}
+
+bool CookedMeshFile::validateIndices()
+{
+	CPU_TRACE_SCOPE("CookedMeshFile::validateIndices");
+
+	// Indices go into a shared geometry page as they are, one past the mesh's vertices would read another mesh's (or nothing)
+	const uint32_t *indices = getIndices();
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		const CookedMeshEntry &mesh = meshes[i];
+		const uint32_t *meshIndices = indices + mesh.firstIndex;
+		for (uint32_t j = 0; j < mesh.indexCount; j++)
+		{
+			if (meshIndices[j] >= mesh.vertexCount)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
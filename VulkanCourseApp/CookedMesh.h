@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Vertex.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "MappedFile.h"
+
+// Cooked mesh files (.cmesh): a model as it ends up on the GPU, so loading it is a memory mapping and a copy into
+// staging instead of an Assimp import. All values little endian.
+//
+//   CookedMeshHeader
+//   CookedMeshEntry[meshCount]
+//   CookedMaterialEntry[materialCount]
+//   texture names (not null terminated)
+//   CookedChunkEntry[chunkCount]		(LZ4 mode only)
+//   CookedLodEntry[lodCount]
+//   data: all vertices, then all indices	(LZ4 mode: the compressed chunks of it)
+const uint32_t COOKED_MESH_MAGIC = 0x48534D43;				// "CMSH"
+const uint32_t COOKED_MESH_VERSION = 3;
+const uint32_t COOKED_MESH_FLAG_LZ4 = 0x1;
+const uint32_t COOKED_MESH_CHUNK_SIZE = 256 * 1024;			// Uncompressed bytes per LZ4 chunk
+const uint64_t COOKED_MESH_ALIGNMENT = 16;					// Alignment of the tables and the data
+
+struct CookedMeshHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t vertexSize;						// sizeof(Vertex) the file was cooked with
+	uint32_t meshCount;
+	uint32_t materialCount;
+	uint32_t chunkCount;
+	uint32_t cookerVersion;						// Version of the tool that wrote the file (0 if unknown)
+	uint32_t lodCount;
+	uint32_t reserved;
+	uint64_t sourceHash;						// Hash of the source the file was cooked from (0 if unknown)
+	uint64_t meshTableOffset;
+	uint64_t materialTableOffset;
+	uint64_t nameTableOffset;
+	uint64_t chunkTableOffset;
+	uint64_t lodTableOffset;
+	uint64_t dataOffset;
+	uint64_t vertexDataSize;					// Uncompressed sizes
+	uint64_t indexDataSize;
+};
+
+struct CookedMeshEntry
+{
+	uint32_t firstVertex;						// Into the file's vertices
+	uint32_t vertexCount;
+	uint32_t firstIndex;						// Into the file's indices (indices are relative to the mesh's first vertex)
+	uint32_t indexCount;						// Of all LODs together
+	uint32_t materialIndex;
+	uint32_t firstLod;							// Into the LOD table
+	uint32_t lodCount;
+	uint32_t reserved;
+	float boundsCenter[3];						// Bounding sphere, in object space
+	float boundsRadius;
+	float boxMinimum[3];						// Bounding box, in object space
+	float boxMaximum[3];
+};
+
+struct CookedMaterialEntry
+{
+	uint32_t textureNameOffset;					// Relative to nameTableOffset
+	uint32_t textureNameLength;					// 0: no texture
+};
+
+struct CookedLodEntry
+{
+	uint32_t firstIndex;						// Relative to the mesh's first index
+	uint32_t indexCount;
+	float error;
+	uint32_t reserved;
+};
+
+struct CookedChunkEntry
+{
+	uint64_t offset;							// Relative to dataOffset
+	uint32_t compressedSize;					// Equal to size: stored uncompressed
+	uint32_t size;
+};
+
+// Model in memory, what gets written to a cooked file
+struct CookedModel
+{
+	struct Mesh
+	{
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;				// Of all LODs together
+		uint32_t materialIndex = 0;
+		std::vector<MeshLod> lods;					// Empty: a single LOD of all indices
+		BoundingSphere bounds = { glm::vec3(0.0f), 0.0f };
+		BoundingBox box = { glm::vec3(0.0f), glm::vec3(0.0f) };
+	};
+
+	std::vector<std::string> textureNames;		// One per material, empty if it has no texture
+	std::vector<Mesh> meshes;
+};
+
+class CookedMeshFile
+{
+public:
+	CookedMeshFile();
+
+	// False if the file is missing, or isn't a valid cooked mesh of this version (including any index past its mesh's vertices)
+	bool open(const std::string &fileName);
+	void close();
+
+	uint64_t getSourceHash();
+	uint32_t getCookerVersion();
+	bool isCompressed();
+	uint32_t getMeshCount();
+	const CookedMeshEntry &getMesh(uint32_t index);
+	std::vector<MeshLod> getLods(uint32_t index);
+	BoundingSphere getBounds(uint32_t index);
+	BoundingBox getBoundingBox(uint32_t index);
+	std::vector<std::string> getTextureNames();
+
+	// Point into the mapping (or, in LZ4 mode, the decompressed copy of the data), valid until close
+	const Vertex *getVertices();
+	const uint32_t *getIndices();
+
+	// Where the cooked version of a model is looked for: its path with the extension replaced by .cmesh
+	static std::string getCookedPath(const std::string &modelFile);
+	// Source hash a model is cooked with: the FNV-1a hash of its file (TextureCache::hashContent) continued over the
+	// settings that change the output, so a file is only current for the same source cooked the same way
+	static uint64_t hashSource(uint64_t contentHash, const MeshOptimizeOptions &optimizeOptions);
+	static bool write(const std::string &fileName, const CookedModel &model, bool compress, uint64_t sourceHash, uint32_t cookerVersion);
+
+	~CookedMeshFile();
+
+private:
+	MappedFile file;
+	CookedMeshHeader header;
+	const CookedMeshEntry *meshes = nullptr;
+	const CookedMaterialEntry *materials = nullptr;
+	const CookedLodEntry *lods = nullptr;
+	const uint8_t *data = nullptr;
+	std::vector<uint8_t> decompressedData;
+
+	bool validate();
+	bool decompress();
+	bool validateIndices();
+};
@@ -0,0 +1,136 @@
+#include "CookedTexture.h"
+#include "CpuTracer.h"
+#include "MipChain.h"
+
+#include <cstring>
+#include <fstream>
+
+CookedTextureFile::CookedTextureFile()
+{
+}
+
+bool CookedTextureFile::open(const std::string & fileName)
+{
+	CPU_TRACE_SCOPE("CookedTextureFile::open");
+
+	close();
+	if (!file.open(fileName))
+	{
+		return false;
+	}
+
+	if (!validate())
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CookedTextureFile::close()
+{
+	file.close();
+}
+
+uint32_t CookedTextureFile::getWidth()
+{
+	return header.width;
+}
+
+uint32_t CookedTextureFile::getHeight()
+{
+	return header.height;
+}
+
+uint32_t CookedTextureFile::getMipLevels()
+{
+	return header.mipLevels;
+}
+
+uint64_t CookedTextureFile::getSourceHash()
+{
+	return header.sourceHash;
+}
+
+uint32_t CookedTextureFile::getCookerVersion()
+{
+	return header.cookerVersion;
+}
+
+const uint8_t * CookedTextureFile::getData()
+{
+	return file.getData() + header.dataOffset;
+}
+
+size_t CookedTextureFile::getDataSize()
+{
+	return static_cast<size_t>(header.dataSize);
+}
+
+std::string CookedTextureFile::getCookedPath(const std::string & texturePath)
+{
+	return texturePath + ".ctex";
+}
+
+bool CookedTextureFile::write(const std::string & fileName, uint32_t width, uint32_t height, const uint8_t * mipChain,
+	uint64_t sourceHash, uint32_t cookerVersion)
+{
+	CPU_TRACE_SCOPE("CookedTextureFile::write");
+
+	CookedTextureHeader fileHeader = {};
+	fileHeader.magic = COOKED_TEXTURE_MAGIC;
+	fileHeader.version = COOKED_TEXTURE_VERSION;
+	fileHeader.width = width;
+	fileHeader.height = height;
+	fileHeader.mipLevels = getMipLevelCount(width, height);
+	fileHeader.cookerVersion = cookerVersion;
+	fileHeader.sourceHash = sourceHash;
+	fileHeader.dataOffset = (sizeof(CookedTextureHeader) + COOKED_TEXTURE_ALIGNMENT - 1) / COOKED_TEXTURE_ALIGNMENT * COOKED_TEXTURE_ALIGNMENT;
+	fileHeader.dataSize = getMipChainSize(width, height, fileHeader.mipLevels);
+
+	std::ofstream output(fileName, std::ios::binary | std::ios::trunc);
+	if (!output.is_open())
+	{
+		return false;
+	}
+
+	static const char padding[COOKED_TEXTURE_ALIGNMENT] = {};
+	output.write(reinterpret_cast<const char *>(&fileHeader), sizeof(fileHeader));
+	output.write(padding, static_cast<std::streamsize>(fileHeader.dataOffset - sizeof(fileHeader)));
+	output.write(reinterpret_cast<const char *>(mipChain), static_cast<std::streamsize>(fileHeader.dataSize));
+
+	return output.good();
+}
+
+CookedTextureFile::~CookedTextureFile()
+{
+	close();
+}
+
+bool CookedTextureFile::validate()
+{
+	uint64_t fileSize = file.getSize();
+	if (fileSize < sizeof(CookedTextureHeader))
+	{
+		return false;
+	}
+	memcpy(&header, file.getData(), sizeof(CookedTextureHeader));
+
+	if (header.magic != COOKED_TEXTURE_MAGIC || header.version != COOKED_TEXTURE_VERSION)
+	{
+		return false;
+	}
+
+	// Always a full chain of RGBA8 levels, so the size follows from the dimensions (checked first so it can't overflow)
+	if (header.width == 0 || header.height == 0
+		|| header.width > COOKED_TEXTURE_MAX_SIZE || header.height > COOKED_TEXTURE_MAX_SIZE
+		|| header.mipLevels != getMipLevelCount(header.width, header.height)
+		|| header.dataSize != getMipChainSize(header.width, header.height, header.mipLevels)
+		|| header.dataOffset % COOKED_TEXTURE_ALIGNMENT != 0
+		|| header.dataOffset > fileSize || header.dataSize > fileSize - header.dataOffset)
+	{
+		return false;
+	}
+
+	return true;
+}
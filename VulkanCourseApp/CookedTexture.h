@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "MappedFile.h"
+
+// Cooked texture files (.ctex): an RGBA8 texture with its full mip chain, levels packed one after the other
+// (the layout UploadBatch::uploadImage takes), so loading it is a copy into staging instead of a decode
+//
+//   CookedTextureHeader
+//   data: every mip level, largest first
+const uint32_t COOKED_TEXTURE_MAGIC = 0x58455443;			// "CTEX"
+const uint32_t COOKED_TEXTURE_VERSION = 1;
+const uint64_t COOKED_TEXTURE_ALIGNMENT = 16;				// Alignment of the data
+const uint32_t COOKED_TEXTURE_MAX_SIZE = 16384;				// Largest width/height accepted
+
+struct CookedTextureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t cookerVersion;						// Version of the tool that wrote the file (0 if unknown)
+	uint64_t sourceHash;						// TextureCache::hashContent of the source image file
+	uint64_t dataOffset;
+	uint64_t dataSize;
+};
+
+class CookedTextureFile
+{
+public:
+	CookedTextureFile();
+
+	// False if the file is missing, or isn't a valid cooked texture of this version
+	bool open(const std::string &fileName);
+	void close();
+
+	uint32_t getWidth();
+	uint32_t getHeight();
+	uint32_t getMipLevels();
+	uint64_t getSourceHash();
+	uint32_t getCookerVersion();
+
+	// Points into the mapping, valid until close
+	const uint8_t *getData();
+	size_t getDataSize();
+
+	// Where the cooked version of a texture is looked for: its path with .ctex appended (keeps a.png and a.jpg apart)
+	static std::string getCookedPath(const std::string &texturePath);
+	// mipChain holds every level of a full mip chain of the size
+	static bool write(const std::string &fileName, uint32_t width, uint32_t height, const uint8_t *mipChain,
+		uint64_t sourceHash, uint32_t cookerVersion);
+
+	~CookedTextureFile();
+
+private:
+	MappedFile file;
+	CookedTextureHeader header;
+
+	bool validate();
+};
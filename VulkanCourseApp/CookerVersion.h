@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Version of AssetCooker, written into every cooked file. Bump whenever the output for an unchanged source changes
+// (import settings, mesh processing, file layouts), so everything cooked by an older cooker gets cooked again and
+// isn't used by the renderer until it has been.
+const uint32_t COOKER_VERSION = 5;
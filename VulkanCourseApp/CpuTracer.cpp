@@ -0,0 +1,165 @@
+#include "CpuTracer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	// Rings outlive their threads so a dump still sees events of threads that already exited
+	std::mutex ringRegistryMutex;
+	std::vector<std::shared_ptr<CpuTraceRing>> ringRegistry;
+
+	std::atomic<bool> tracingEnabled{true};
+
+	const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+	// Event name as the contents of a JSON string
+	std::string escapeJson(const char *text)
+	{
+		std::string escaped;
+		for (const char *c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				escaped += '\\';
+				escaped += *c;
+			}
+			else if (static_cast<unsigned char>(*c) < 0x20)
+			{
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(*c));
+				escaped += code;
+			}
+			else
+			{
+				escaped += *c;
+			}
+		}
+		return escaped;
+	}
+}
+
+int64_t CpuTracer::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+CpuTraceRing * CpuTracer::getThreadRing()
+{
+	thread_local CpuTraceRing *threadRing = nullptr;
+	if (!threadRing)
+	{
+		// Only lock taken by a thread, once, on its first event
+		std::shared_ptr<CpuTraceRing> ring = std::make_shared<CpuTraceRing>();
+
+		std::lock_guard<std::mutex> lock(ringRegistryMutex);
+		ring->threadId = static_cast<uint32_t>(ringRegistry.size());
+		ringRegistry.push_back(ring);
+		threadRing = ring.get();
+	}
+	return threadRing;
+}
+
+void CpuTracer::record(const char * name, int64_t beginNs, int64_t endNs)
+{
+	if (!tracingEnabled.load(std::memory_order_relaxed)) return;
+
+	CpuTraceRing *ring = getThreadRing();
+
+	// Mark the slot as being written, write it, then publish it (and advance head)
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	CpuTraceSlot &slot = ring->slots[head % CPU_TRACE_RING_SIZE];
+	slot.sequence.store(head * 2 + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.beginNs.store(beginNs, std::memory_order_relaxed);
+	slot.endNs.store(endNs, std::memory_order_relaxed);
+	slot.sequence.store(head * 2 + 2, std::memory_order_release);
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void CpuTracer::setEnabled(bool newEnabled)
+{
+	tracingEnabled.store(newEnabled, std::memory_order_relaxed);
+}
+
+bool CpuTracer::isEnabled()
+{
+	return tracingEnabled.load(std::memory_order_relaxed);
+}
+
+bool CpuTracer::dumpChromeTrace(const std::string & fileName)
+{
+	std::vector<std::shared_ptr<CpuTraceRing>> rings;
+	{
+		std::lock_guard<std::mutex> lock(ringRegistryMutex);
+		rings = ringRegistry;
+	}
+
+	std::ofstream file(fileName, std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool firstEvent = true;
+	std::vector<CpuTraceEvent> events;
+	char line[512];
+
+	for (const auto &ring : rings)
+	{
+		// Copy the live part of the ring
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t first = head > CPU_TRACE_RING_SIZE ? head - CPU_TRACE_RING_SIZE : 0;
+
+		events.clear();
+		for (uint64_t i = first; i < head; i++)
+		{
+			// Writer may lap us while copying. Keep the copy only if the slot held event i, unchanged, the whole time.
+			const CpuTraceSlot &slot = ring->slots[i % CPU_TRACE_RING_SIZE];
+			uint64_t sequenceBefore = slot.sequence.load(std::memory_order_acquire);
+			CpuTraceEvent event;
+			event.name = slot.name.load(std::memory_order_relaxed);
+			event.beginNs = slot.beginNs.load(std::memory_order_relaxed);
+			event.endNs = slot.endNs.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t sequenceAfter = slot.sequence.load(std::memory_order_relaxed);
+
+			if (sequenceBefore == i * 2 + 2 && sequenceAfter == sequenceBefore)
+			{
+				events.push_back(event);
+			}
+		}
+
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			// Complete ("X") events, timestamps in microseconds
+			snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				firstEvent ? "" : ",\n", escapeJson(events[i].name).c_str(), ring->threadId,
+				events[i].beginNs / 1000.0, (events[i].endNs - events[i].beginNs) / 1000.0);
+			file << line;
+			firstEvent = false;
+		}
+	}
+
+	file << "\n]}\n";
+	file.close();
+
+	return true;
+}
+
+CpuTraceScope::CpuTraceScope(const char * newName)
+{
+	name = newName;
+	beginNs = CpuTracer::now();
+}
+
+CpuTraceScope::~CpuTraceScope()
+{
+	CpuTracer::record(name, beginNs, CpuTracer::now());
+}
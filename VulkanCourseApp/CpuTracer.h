@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Events kept per thread before the oldest ones get overwritten
+const size_t CPU_TRACE_RING_SIZE = 16384;
+
+struct CpuTraceEvent
+{
+	const char *name;		// Not copied, so must have static storage (string literal)
+	int64_t beginNs;
+	int64_t endNs;
+};
+
+// One event in a ring. Guarded by a sequence lock: sequence is odd while the owning thread writes the slot, and
+// 2 * (index + 1) once it holds event index, so a reader knows whether its copy is whole and which event it is.
+struct CpuTraceSlot
+{
+	std::atomic<uint64_t> sequence{0};
+	std::atomic<const char *> name{nullptr};
+	std::atomic<int64_t> beginNs{0};
+	std::atomic<int64_t> endNs{0};
+};
+
+// Single writer ring owned by one thread. The owning thread records without locking, readers copy it out.
+struct CpuTraceRing
+{
+	uint32_t threadId;
+	std::atomic<uint64_t> head{0};					// Total events ever written
+	CpuTraceSlot slots[CPU_TRACE_RING_SIZE];
+};
+
+class CpuTracer
+{
+public:
+	static int64_t now();
+	static void record(const char *name, int64_t beginNs, int64_t endNs);
+
+	static void setEnabled(bool newEnabled);
+	static bool isEnabled();
+
+	// Write everything currently held in the rings of all threads as Chrome trace-event JSON (chrome://tracing, Perfetto)
+	static bool dumpChromeTrace(const std::string &fileName);
+
+private:
+	static CpuTraceRing *getThreadRing();
+};
+
+// Records the lifetime of the scope it is declared in
+class CpuTraceScope
+{
+public:
+	CpuTraceScope(const char *newName);
+	~CpuTraceScope();
+
+private:
+	const char *name;
+	int64_t beginNs;
+};
+
+#define CPU_TRACE_CONCAT_INNER(a, b) a##b
+#define CPU_TRACE_CONCAT(a, b) CPU_TRACE_CONCAT_INNER(a, b)
+#define CPU_TRACE_SCOPE(name) CpuTraceScope CPU_TRACE_CONCAT(cpuTraceScope, __LINE__)(name)
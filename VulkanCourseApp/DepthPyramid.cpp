@@ -0,0 +1,336 @@
+#include "DepthPyramid.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+DepthPyramid::DepthPyramid()
+{
+}
+
+void DepthPyramid::init(DeviceMemoryAllocator * newAllocator, VkDevice newDevice, const std::vector<VkImageView> &depthImageViews,
+	VkExtent2D extent, bool depthSampleable)
+{
+	allocator = newAllocator;
+	device = newDevice;
+
+	if (!depthSampleable)
+	{
+		return;
+	}
+
+	// Level 0 matches the depth buffer, each level halves it (rounding down) until 1x1
+	width = extent.width;
+	height = extent.height;
+	levelCount = 1;
+	while ((std::max(width, height) >> levelCount) > 0) levelCount++;
+
+	createPipeline(readFile(DEPTH_PYRAMID_SHADER_FILE));
+	createSampler();
+
+	pyramids.resize(depthImageViews.size());
+	for (auto &pyramid : pyramids)
+	{
+		createPyramid(pyramid);
+	}
+	createDescriptorSets(depthImageViews);
+}
+
+bool DepthPyramid::isSupported()
+{
+	return pipeline != VK_NULL_HANDLE;
+}
+
+void DepthPyramid::recordBuild(VkCommandBuffer commandBuffer, uint32_t image)
+{
+	ImagePyramid &pyramid = pyramids[image];
+
+	// Every level is rebuilt, so the previous contents are discarded (after the culling that read them last time)
+	VkImageMemoryBarrier discardBarrier = {};
+	discardBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	discardBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	discardBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	discardBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	discardBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	discardBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	discardBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	discardBarrier.image = pyramid.image;
+	discardBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &discardBarrier);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		uint32_t levelWidth = std::max(width >> level, 1u);
+		uint32_t levelHeight = std::max(height >> level, 1u);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &pyramid.levelDescriptorSets[level], 0, nullptr);
+		vkCmdDispatch(commandBuffer, (levelWidth + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE,
+			(levelHeight + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE, 1);
+
+		// Level is the source of the next pass (and of the culling after the last one)
+		VkImageMemoryBarrier levelBarrier = {};
+		levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		levelBarrier.image = pyramid.image;
+		levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &levelBarrier);
+	}
+}
+
+VkDescriptorImageInfo DepthPyramid::getPyramidInfo(uint32_t image)
+{
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = pyramids[image].view;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	return imageInfo;
+}
+
+void DepthPyramid::destroy()
+{
+	for (auto &pyramid : pyramids)
+	{
+		for (auto levelView : pyramid.levelViews)
+		{
+			vkDestroyImageView(device, levelView, nullptr);
+		}
+		vkDestroyImageView(device, pyramid.view, nullptr);
+		vkDestroyImage(device, pyramid.image, nullptr);
+		allocator->free(pyramid.memory);
+	}
+	pyramids.clear();
+
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+		vkDestroySampler(device, sampler, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+}
+
+DepthPyramid::~DepthPyramid()
+{
+}
+
+void DepthPyramid::createPipeline(const std::vector<char> &shaderCode)
+{
+	// Source level (sampled) and destination level (storage image)
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Descriptor Set Layout!");
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Pipeline Layout!");
+	}
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = shaderCode.size();
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(shaderCode.data());
+
+	VkShaderModule shaderModule;
+	result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Pipeline!");
+	}
+}
+
+void DepthPyramid::createSampler()
+{
+	// Only read with texelFetch, which ignores filtering
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.minLod = 0.0f;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	VkResult result = vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Sampler!");
+	}
+}
+
+void DepthPyramid::createPyramid(ImagePyramid &pyramid)
+{
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = width;
+	imageCreateInfo.extent.height = height;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = levelCount;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult result = vkCreateImage(device, &imageCreateInfo, nullptr, &pyramid.image);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Image!");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, pyramid.image, &memoryRequirements);
+	pyramid.memory = allocator->allocate(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	vkBindImageMemory(device, pyramid.image, pyramid.memory.memory, pyramid.memory.offset);
+
+	pyramid.view = createView(pyramid.image, 0, levelCount);
+	pyramid.levelViews.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		pyramid.levelViews[level] = createView(pyramid.image, level, 1);
+	}
+}
+
+void DepthPyramid::createDescriptorSets(const std::vector<VkImageView> &depthImageViews)
+{
+	uint32_t setCount = static_cast<uint32_t>(pyramids.size()) * levelCount;
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = setCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = setCount;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = setCount;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkResult result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Descriptor Pool!");
+	}
+
+	for (size_t i = 0; i < pyramids.size(); i++)
+	{
+		ImagePyramid &pyramid = pyramids[i];
+
+		std::vector<VkDescriptorSetLayout> setLayouts(levelCount, descriptorSetLayout);
+		pyramid.levelDescriptorSets.resize(levelCount);
+
+		VkDescriptorSetAllocateInfo setAllocateInfo = {};
+		setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocateInfo.descriptorPool = descriptorPool;
+		setAllocateInfo.descriptorSetCount = levelCount;
+		setAllocateInfo.pSetLayouts = setLayouts.data();
+
+		result = vkAllocateDescriptorSets(device, &setAllocateInfo, pyramid.levelDescriptorSets.data());
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate Depth Pyramid Descriptor Sets!");
+		}
+
+		for (uint32_t level = 0; level < levelCount; level++)
+		{
+			// Level 0 reduces the depth buffer itself, every other level the one before it
+			VkDescriptorImageInfo sourceInfo = {};
+			sourceInfo.sampler = sampler;
+			sourceInfo.imageView = level == 0 ? depthImageViews[i] : pyramid.levelViews[level - 1];
+			sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorImageInfo destinationInfo = {};
+			destinationInfo.imageView = pyramid.levelViews[level];
+			destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			std::array<VkWriteDescriptorSet, 2> setWrites = {};
+			setWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[0].dstSet = pyramid.levelDescriptorSets[level];
+			setWrites[0].dstBinding = 0;
+			setWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			setWrites[0].descriptorCount = 1;
+			setWrites[0].pImageInfo = &sourceInfo;
+			setWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[1].dstSet = pyramid.levelDescriptorSets[level];
+			setWrites[1].dstBinding = 1;
+			setWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			setWrites[1].descriptorCount = 1;
+			setWrites[1].pImageInfo = &destinationInfo;
+
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+		}
+	}
+}
+
+VkImageView DepthPyramid::createView(VkImage image, uint32_t baseLevel, uint32_t levels)
+{
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = image;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levels, 0, 1 };
+
+	VkImageView imageView;
+	VkResult result = vkCreateImageView(device, &viewCreateInfo, nullptr, &imageView);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Depth Pyramid Image View!");
+	}
+	return imageView;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <vector>
+
+#include "Utilities.h"
+
+// Compute shader reducing depth into the pyramid (built from Shaders/depth_pyramid.comp by Shaders/compile_shaders.bat)
+const char *const DEPTH_PYRAMID_SHADER_FILE = "Shaders/depth_pyramid_comp.spv";
+const uint32_t DEPTH_PYRAMID_WORKGROUP_SIZE = 8;		// local_size_x/y of depth_pyramid.comp
+
+// Hierarchical depth (Hi-Z) of each swapchain image's depth buffer. Level 0 is a copy of the depth, every further level
+// keeps the farthest depth of the texels it covers, so a texel of a coarse level bounds the depth of a whole screen region
+class DepthPyramid
+{
+public:
+	DepthPyramid();
+
+	// depthSampleable: depth format can be sampled and the depth images were created with SAMPLED usage
+	// (pyramid stays unsupported without it)
+	void init(DeviceMemoryAllocator *newAllocator, VkDevice newDevice, const std::vector<VkImageView> &depthImageViews,
+		VkExtent2D extent, bool depthSampleable);
+	bool isSupported();
+
+	// Outside of a render pass, with the image's depth in DEPTH_STENCIL_READ_ONLY_OPTIMAL and its writes visible to compute shaders.
+	// Leaves the whole pyramid readable by compute shaders
+	void recordBuild(VkCommandBuffer commandBuffer, uint32_t image);
+
+	// All levels (GENERAL layout), read with texelFetch
+	VkDescriptorImageInfo getPyramidInfo(uint32_t image);
+
+	void destroy();
+
+	~DepthPyramid();
+
+private:
+	struct ImagePyramid
+	{
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkImageView view = VK_NULL_HANDLE;					// All levels
+		std::vector<VkImageView> levelViews;				// One level each, written by the pass building it and read by the next
+		std::vector<VkDescriptorSet> levelDescriptorSets;	// Source (depth or previous level) and destination of each pass
+	};
+
+	DeviceMemoryAllocator *allocator;
+	VkDevice device;
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t levelCount = 0;
+
+	VkSampler sampler = VK_NULL_HANDLE;
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	std::vector<ImagePyramid> pyramids;
+
+	void createPipeline(const std::vector<char> &shaderCode);
+	void createSampler();
+	void createPyramid(ImagePyramid &pyramid);
+	void createDescriptorSets(const std::vector<VkImageView> &depthImageViews);
+	VkImageView createView(VkImage image, uint32_t baseLevel, uint32_t levels);
+};
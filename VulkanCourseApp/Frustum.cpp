@@ -0,0 +1,45 @@
+#include "Frustum.h"
+
+#include <cmath>
+
+Frustum Frustum::fromMatrix(const glm::mat4 &viewProjection)
+{
+	// Rows of the matrix (glm is column major)
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	Frustum frustum;
+	frustum.planes[FRUSTUM_LEFT] = rows[3] + rows[0];
+	frustum.planes[FRUSTUM_RIGHT] = rows[3] - rows[0];
+	frustum.planes[FRUSTUM_BOTTOM] = rows[3] + rows[1];
+	frustum.planes[FRUSTUM_TOP] = rows[3] - rows[1];
+	frustum.planes[FRUSTUM_NEAR] = rows[3] + rows[2];
+	frustum.planes[FRUSTUM_FAR] = rows[3] - rows[2];
+
+	// Normalize, so plane distances are in world units and can be compared with sphere radii
+	for (auto &plane : frustum.planes)
+	{
+		float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0.0f)
+		{
+			plane /= length;
+		}
+	}
+
+	return frustum;
+}
+
+bool Frustum::intersectsSphere(const glm::vec3 &center, float radius) const
+{
+	for (const auto &plane : planes)
+	{
+		if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
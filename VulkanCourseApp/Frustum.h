@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+
+#include <glm/glm.hpp>
+
+enum FrustumPlane
+{
+	FRUSTUM_LEFT,
+	FRUSTUM_RIGHT,
+	FRUSTUM_BOTTOM,
+	FRUSTUM_TOP,
+	FRUSTUM_NEAR,
+	FRUSTUM_FAR,
+	FRUSTUM_PLANE_COUNT
+};
+
+// Planes of a view frustum with normals pointing inwards: a point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+	std::array<glm::vec4, FRUSTUM_PLANE_COUNT> planes;
+
+	// Planes of projection * view, in world space. Near uses the -w..w depth range, which also
+	// holds (loosely) for 0..w projections, so culling stays conservative either way
+	static Frustum fromMatrix(const glm::mat4 &viewProjection);
+
+	bool intersectsSphere(const glm::vec3 &center, float radius) const;
+};
@@ -0,0 +1,348 @@
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FRUSTUM_CULL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC compiles AVX intrinsics anywhere, the kernel is only called if the CPU has them
+#define FRUSTUM_CULL_AVX2_TARGET
+#else
+#define FRUSTUM_CULL_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define FRUSTUM_CULL_ARM
+#include <arm_neon.h>
+#endif
+
+FrustumCuller::FrustumCuller()
+{
+	// Widest kernel available
+	for (int i = FRUSTUM_CULL_KERNEL_COUNT - 1; i >= 0; i--)
+	{
+		if (isKernelSupported(static_cast<FrustumCullKernel>(i)))
+		{
+			kernel = static_cast<FrustumCullKernel>(i);
+			break;
+		}
+	}
+}
+
+void FrustumCuller::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	radius.clear();
+	count = 0;
+}
+
+uint32_t FrustumCuller::add(const glm::mat4 &transform, const BoundingBox &box, const BoundingSphere &sphere)
+{
+	// Grow a whole batch at a time, so the kernels never read past the end (padding is zero sized boxes at the origin)
+	if (count == centerX.size())
+	{
+		size_t size = centerX.size() + FRUSTUM_CULL_BATCH;
+		centerX.resize(size);
+		centerY.resize(size);
+		centerZ.resize(size);
+		extentX.resize(size);
+		extentY.resize(size);
+		extentZ.resize(size);
+		radius.resize(size);
+	}
+
+	glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+	glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+
+	// Box around the transformed box: each world axis gets the extents projected onto it (Arvo 1990)
+	glm::vec4 worldCenter = transform * glm::vec4(center, 1.0f);
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; row++)
+	{
+		worldExtent[row] = std::abs(transform[0][row]) * extent.x + std::abs(transform[1][row]) * extent.y + std::abs(transform[2][row]) * extent.z;
+	}
+
+	// Sphere moved onto the box centre (grown by the distance, so it still contains the original), scaled by the largest axis scale
+	float scale = std::sqrt(std::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+		std::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])))));
+	float worldRadius = (sphere.radius + glm::length(sphere.center - center)) * scale;
+
+	centerX[count] = worldCenter.x;
+	centerY[count] = worldCenter.y;
+	centerZ[count] = worldCenter.z;
+	extentX[count] = worldExtent.x;
+	extentY[count] = worldExtent.y;
+	extentZ[count] = worldExtent.z;
+	radius[count] = worldRadius;
+
+	return count++;
+}
+
+uint32_t FrustumCuller::getCount()
+{
+	return count;
+}
+
+void FrustumCuller::cull(const Frustum &frustum)
+{
+	// Kernels write whole batches, padding included
+	visibility.resize(centerX.size());
+
+	switch (kernel)
+	{
+	case FRUSTUM_CULL_SSE:
+		cullSse(frustum);
+		break;
+	case FRUSTUM_CULL_AVX2:
+		cullAvx2(frustum);
+		break;
+	case FRUSTUM_CULL_NEON:
+		cullNeon(frustum);
+		break;
+	default:
+		cullScalar(frustum);
+		break;
+	}
+}
+
+bool FrustumCuller::isVisible(uint32_t index)
+{
+	return visibility[index] != 0;
+}
+
+const std::vector<uint8_t> &FrustumCuller::getVisibility()
+{
+	return visibility;
+}
+
+bool FrustumCuller::isKernelSupported(FrustumCullKernel kernel)
+{
+	switch (kernel)
+	{
+	case FRUSTUM_CULL_SCALAR:
+		return true;
+#if defined(FRUSTUM_CULL_X86)
+	case FRUSTUM_CULL_SSE:
+		return true;
+	case FRUSTUM_CULL_AVX2:
+	{
+#if defined(_MSC_VER)
+		// AVX2 reported by the CPU, and the OS saves the YMM registers
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#endif
+#if defined(FRUSTUM_CULL_ARM)
+	case FRUSTUM_CULL_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+void FrustumCuller::setKernel(FrustumCullKernel newKernel)
+{
+	if (isKernelSupported(newKernel))
+	{
+		kernel = newKernel;
+	}
+}
+
+FrustumCullKernel FrustumCuller::getKernel()
+{
+	return kernel;
+}
+
+FrustumCuller::~FrustumCuller()
+{
+}
+
+void FrustumCuller::cullScalar(const Frustum &frustum)
+{
+	for (size_t i = 0; i < centerX.size(); i++)
+	{
+		bool inside = true;
+		for (const auto &plane : frustum.planes)
+		{
+			// Signed distance of the centre, and how far the bounds reach towards the plane (the tighter of box and sphere)
+			float distance = (centerX[i] * plane.x + centerY[i] * plane.y) + (centerZ[i] * plane.z + plane.w);
+			float boxReach = (extentX[i] * std::abs(plane.x) + extentY[i] * std::abs(plane.y)) + extentZ[i] * std::abs(plane.z);
+			float reach = boxReach < radius[i] ? boxReach : radius[i];
+			inside = inside && distance + reach >= 0.0f;
+		}
+		visibility[i] = inside ? 1 : 0;
+	}
+}
+
+void FrustumCuller::cullSse(const Frustum &frustum)
+{
+#if defined(FRUSTUM_CULL_X86)
+	// Plane components broadcast once
+	__m128 planes[FRUSTUM_PLANE_COUNT][7];
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; p++)
+	{
+		const glm::vec4 &plane = frustum.planes[p];
+		planes[p][0] = _mm_set1_ps(plane.x);
+		planes[p][1] = _mm_set1_ps(plane.y);
+		planes[p][2] = _mm_set1_ps(plane.z);
+		planes[p][3] = _mm_set1_ps(plane.w);
+		planes[p][4] = _mm_set1_ps(std::abs(plane.x));
+		planes[p][5] = _mm_set1_ps(std::abs(plane.y));
+		planes[p][6] = _mm_set1_ps(std::abs(plane.z));
+	}
+	__m128 zero = _mm_setzero_ps();
+
+	for (size_t i = 0; i < centerX.size(); i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&centerX[i]);
+		__m128 cy = _mm_loadu_ps(&centerY[i]);
+		__m128 cz = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+		__m128 r = _mm_loadu_ps(&radius[i]);
+
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, planes[p][0]), _mm_mul_ps(cy, planes[p][1])),
+				_mm_add_ps(_mm_mul_ps(cz, planes[p][2]), planes[p][3]));
+			__m128 boxReach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, planes[p][4]), _mm_mul_ps(ey, planes[p][5])), _mm_mul_ps(ez, planes[p][6]));
+			__m128 reach = _mm_min_ps(boxReach, r);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), zero));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			visibility[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#else
+	cullScalar(frustum);
+#endif
+}
+
+#if defined(FRUSTUM_CULL_X86)
+FRUSTUM_CULL_AVX2_TARGET
+#endif
+void FrustumCuller::cullAvx2(const Frustum &frustum)
+{
+#if defined(FRUSTUM_CULL_X86)
+	__m256 planes[FRUSTUM_PLANE_COUNT][7];
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; p++)
+	{
+		const glm::vec4 &plane = frustum.planes[p];
+		planes[p][0] = _mm256_set1_ps(plane.x);
+		planes[p][1] = _mm256_set1_ps(plane.y);
+		planes[p][2] = _mm256_set1_ps(plane.z);
+		planes[p][3] = _mm256_set1_ps(plane.w);
+		planes[p][4] = _mm256_set1_ps(std::abs(plane.x));
+		planes[p][5] = _mm256_set1_ps(std::abs(plane.y));
+		planes[p][6] = _mm256_set1_ps(std::abs(plane.z));
+	}
+	__m256 zero = _mm256_setzero_ps();
+
+	// No FMA: the products are rounded like the other kernels', so results stay identical
+	for (size_t i = 0; i < centerX.size(); i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&centerX[i]);
+		__m256 cy = _mm256_loadu_ps(&centerY[i]);
+		__m256 cz = _mm256_loadu_ps(&centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[i]);
+		__m256 r = _mm256_loadu_ps(&radius[i]);
+
+		__m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT; p++)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, planes[p][0]), _mm256_mul_ps(cy, planes[p][1])),
+				_mm256_add_ps(_mm256_mul_ps(cz, planes[p][2]), planes[p][3]));
+			__m256 boxReach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, planes[p][4]), _mm256_mul_ps(ey, planes[p][5])), _mm256_mul_ps(ez, planes[p][6]));
+			__m256 reach = _mm256_min_ps(boxReach, r);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int lane = 0; lane < 8; lane++)
+		{
+			visibility[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#else
+	cullScalar(frustum);
+#endif
+}
+
+void FrustumCuller::cullNeon(const Frustum &frustum)
+{
+#if defined(FRUSTUM_CULL_ARM)
+	float32x4_t planes[FRUSTUM_PLANE_COUNT][7];
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; p++)
+	{
+		const glm::vec4 &plane = frustum.planes[p];
+		planes[p][0] = vdupq_n_f32(plane.x);
+		planes[p][1] = vdupq_n_f32(plane.y);
+		planes[p][2] = vdupq_n_f32(plane.z);
+		planes[p][3] = vdupq_n_f32(plane.w);
+		planes[p][4] = vdupq_n_f32(std::abs(plane.x));
+		planes[p][5] = vdupq_n_f32(std::abs(plane.y));
+		planes[p][6] = vdupq_n_f32(std::abs(plane.z));
+	}
+	float32x4_t zero = vdupq_n_f32(0.0f);
+
+	// Separate multiplies and adds (vmlaq may fuse), so results match the scalar kernel
+	for (size_t i = 0; i < centerX.size(); i += 4)
+	{
+		float32x4_t cx = vld1q_f32(&centerX[i]);
+		float32x4_t cy = vld1q_f32(&centerY[i]);
+		float32x4_t cz = vld1q_f32(&centerZ[i]);
+		float32x4_t ex = vld1q_f32(&extentX[i]);
+		float32x4_t ey = vld1q_f32(&extentY[i]);
+		float32x4_t ez = vld1q_f32(&extentZ[i]);
+		float32x4_t r = vld1q_f32(&radius[i]);
+
+		uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT; p++)
+		{
+			float32x4_t distance = vaddq_f32(vaddq_f32(vmulq_f32(cx, planes[p][0]), vmulq_f32(cy, planes[p][1])),
+				vaddq_f32(vmulq_f32(cz, planes[p][2]), planes[p][3]));
+			float32x4_t boxReach = vaddq_f32(vaddq_f32(vmulq_f32(ex, planes[p][4]), vmulq_f32(ey, planes[p][5])), vmulq_f32(ez, planes[p][6]));
+			float32x4_t reach = vminq_f32(boxReach, r);
+			inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(distance, reach), zero));
+		}
+
+		uint32_t lanes[4];
+		vst1q_u32(lanes, inside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			visibility[i + lane] = lanes[lane] != 0 ? 1 : 0;
+		}
+	}
+#else
+	cullScalar(frustum);
+#endif
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "MeshSimplifier.h"
+
+// Objects tested per iteration by the widest kernel, the bounds arrays are padded to a multiple of it
+const uint32_t FRUSTUM_CULL_BATCH = 8;
+
+enum FrustumCullKernel
+{
+	FRUSTUM_CULL_SCALAR,
+	FRUSTUM_CULL_SSE,							// 4 objects per iteration
+	FRUSTUM_CULL_AVX2,							// 8 objects per iteration
+	FRUSTUM_CULL_NEON,							// 4 objects per iteration
+	FRUSTUM_CULL_KERNEL_COUNT
+};
+
+// World space bounds of many objects kept as separate arrays per component (SoA), so the SIMD kernels test
+// several objects against each frustum plane at once. Every kernel computes the same operations in the same order,
+// so they all agree with the scalar one.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	void clear();
+	// Move the object space bounds of an object into world space, returns the object's index
+	uint32_t add(const glm::mat4 &transform, const BoundingBox &box, const BoundingSphere &sphere);
+	uint32_t getCount();
+
+	// Test every object, visibility holds the results until the next cull
+	void cull(const Frustum &frustum);
+	bool isVisible(uint32_t index);
+	const std::vector<uint8_t> &getVisibility();
+
+	// Kernel cull uses, the widest the CPU supports unless set (e.g. to compare it with the scalar one)
+	static bool isKernelSupported(FrustumCullKernel kernel);
+	void setKernel(FrustumCullKernel newKernel);
+	FrustumCullKernel getKernel();
+
+	~FrustumCuller();
+
+private:
+	// Box centre and half size, and the radius of a sphere around the same centre containing the bounding sphere
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> extentX;
+	std::vector<float> extentY;
+	std::vector<float> extentZ;
+	std::vector<float> radius;
+	uint32_t count = 0;
+
+	std::vector<uint8_t> visibility;			// 1 if the object intersects the frustum
+	FrustumCullKernel kernel = FRUSTUM_CULL_SCALAR;
+
+	void cullScalar(const Frustum &frustum);
+	void cullSse(const Frustum &frustum);
+	void cullAvx2(const Frustum &frustum);
+	void cullNeon(const Frustum &frustum);
+};
@@ -0,0 +1,198 @@
+#include "GeometryPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+bool GeometryPool::FreeList::allocate(uint32_t count, uint32_t * offset)
+{
+	if (count == 0)
+	{
+		*offset = 0;
+		return true;
+	}
+
+	for (auto range = ranges.begin(); range != ranges.end(); ++range)
+	{
+		if (range->second >= count)
+		{
+			*offset = range->first;
+
+			// Keep the remainder of the range free
+			uint32_t remaining = range->second - count;
+			ranges.erase(range);
+			if (remaining > 0)
+			{
+				ranges[*offset + count] = remaining;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void GeometryPool::FreeList::free(uint32_t offset, uint32_t count)
+{
+	if (count == 0) return;
+
+	auto next = ranges.lower_bound(offset);
+
+	// Merge with the following range...
+	if (next != ranges.end() && offset + count == next->first)
+	{
+		count += next->second;
+		next = ranges.erase(next);
+	}
+
+	// ...and with the preceding one
+	if (next != ranges.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			previous->second += count;
+			return;
+		}
+	}
+
+	ranges[offset] = count;
+}
+
+GeometryPool::GeometryPool()
+{
+}
+
+void GeometryPool::init(DeviceMemoryAllocator * newAllocator, VkDevice newDevice, QueueFamilyIndices queueFamilies)
+{
+	allocator = newAllocator;
+	device = newDevice;
+
+	if (queueFamilies.transferFamily != queueFamilies.graphicsFamily)
+	{
+		concurrent = true;
+		queueFamilyIndices = { static_cast<uint32_t>(queueFamilies.graphicsFamily), static_cast<uint32_t>(queueFamilies.transferFamily) };
+	}
+}
+
+GeometryAllocation GeometryPool::allocate(UploadBatch * uploadBatch, const Vertex * vertices, uint32_t vertexCount, const uint32_t * indices, uint32_t indexCount)
+{
+	GeometryAllocation allocation;
+	allocation.vertexCount = vertexCount;
+	allocation.indexCount = indexCount;
+
+	// Find a page with room for both vertices and indices
+	for (size_t i = 0; i < pages.size() && allocation.page < 0; i++)
+	{
+		if (!pages[i].freeVertices.allocate(allocation.vertexCount, &allocation.vertexOffset))
+		{
+			continue;
+		}
+		if (!pages[i].freeIndices.allocate(allocation.indexCount, &allocation.firstIndex))
+		{
+			pages[i].freeVertices.free(allocation.vertexOffset, allocation.vertexCount);
+			continue;
+		}
+		allocation.page = static_cast<int>(i);
+	}
+
+	// Otherwise start a new page
+	if (allocation.page < 0)
+	{
+		createPage(std::max(allocation.vertexCount, GEOMETRY_PAGE_VERTICES), std::max(allocation.indexCount, GEOMETRY_PAGE_INDICES));
+		allocation.page = static_cast<int>(pages.size() - 1);
+		pages.back().freeVertices.allocate(allocation.vertexCount, &allocation.vertexOffset);
+		pages.back().freeIndices.allocate(allocation.indexCount, &allocation.firstIndex);
+	}
+
+	GeometryPage &page = pages[allocation.page];
+
+	// Stage vertex and index data, copied into the page ranges when the batch is submitted
+	uploadBatch->uploadBuffer(vertices, sizeof(Vertex) * allocation.vertexCount, page.vertexBuffer,
+		sizeof(Vertex) * allocation.vertexOffset, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, concurrent);
+	uploadBatch->uploadBuffer(indices, sizeof(uint32_t) * allocation.indexCount, page.indexBuffer,
+		sizeof(uint32_t) * allocation.firstIndex, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, concurrent);
+
+	return allocation;
+}
+
+void GeometryPool::free(const GeometryAllocation & allocation)
+{
+	if (allocation.page < 0) return;
+
+	pages[allocation.page].freeVertices.free(allocation.vertexOffset, allocation.vertexCount);
+	pages[allocation.page].freeIndices.free(allocation.firstIndex, allocation.indexCount);
+}
+
+size_t GeometryPool::getPageCount()
+{
+	return pages.size();
+}
+
+VkBuffer GeometryPool::getVertexBuffer(int page)
+{
+	return pages[page].vertexBuffer;
+}
+
+VkBuffer GeometryPool::getIndexBuffer(int page)
+{
+	return pages[page].indexBuffer;
+}
+
+void GeometryPool::destroy()
+{
+	for (auto &page : pages)
+	{
+		destroyBuffer(allocator, device, page.vertexBuffer, page.vertexBufferMemory);
+		destroyBuffer(allocator, device, page.indexBuffer, page.indexBufferMemory);
+	}
+	pages.clear();
+}
+
+GeometryPool::~GeometryPool()
+{
+}
+
+void GeometryPool::createPage(uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+	GeometryPage page;
+
+	createPageBuffer(sizeof(Vertex) * vertexCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		&page.vertexBuffer, &page.vertexBufferMemory);
+	page.freeVertices.ranges[0] = vertexCapacity;
+
+	createPageBuffer(sizeof(uint32_t) * indexCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		&page.indexBuffer, &page.indexBufferMemory);
+	page.freeIndices.ranges[0] = indexCapacity;
+
+	pages.push_back(page);
+}
+
+void GeometryPool::createPageBuffer(VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsageFlags, VkBuffer * buffer, MemoryAllocation * bufferMemory)
+{
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = bufferSize;
+	bufferCreateInfo.usage = bufferUsageFlags;
+	if (concurrent)
+	{
+		// No ownership transfers, which would have to cover the whole buffer rather than the range being uploaded
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size());
+		bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndices.data();
+	}
+	else
+	{
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+
+	VkResult result = vkCreateBuffer(device, &bufferCreateInfo, nullptr, buffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Geometry Pool Buffer!");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetBufferMemoryRequirements(device, *buffer, &memoryRequirements);
+
+	*bufferMemory = allocator->allocate(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+	vkBindBufferMemory(device, *buffer, bufferMemory->memory, bufferMemory->offset);
+}
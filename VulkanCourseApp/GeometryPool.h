@@ -0,0 +1,80 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <map>
+
+#include "Utilities.h"
+#include "TransferManager.h"
+
+// Capacity of each page of the pool (a mesh bigger than this gets a page of its own size)
+const uint32_t GEOMETRY_PAGE_VERTICES = 1024 * 1024;
+const uint32_t GEOMETRY_PAGE_INDICES = 4 * 1024 * 1024;
+
+// Range of a mesh in the pool, in elements (use as vertexOffset/firstIndex of vkCmdDrawIndexed)
+struct GeometryAllocation
+{
+	int page = -1;
+	uint32_t vertexOffset = 0;
+	uint32_t vertexCount = 0;
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+};
+
+// Vertex and index data of all meshes, suballocated from a few large device local buffers ("pages"),
+// so draws only need to rebind buffers when the page changes
+class GeometryPool
+{
+public:
+	GeometryPool();
+
+	void init(DeviceMemoryAllocator *newAllocator, VkDevice newDevice, QueueFamilyIndices queueFamilies);
+
+	// Reserve room for a mesh and stage its data into the batch
+	GeometryAllocation allocate(UploadBatch *uploadBatch, const Vertex *vertices, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount);
+	// Only call once no submitted work uses the range any more
+	void free(const GeometryAllocation &allocation);
+
+	size_t getPageCount();
+	VkBuffer getVertexBuffer(int page);
+	VkBuffer getIndexBuffer(int page);
+
+	void destroy();
+
+	~GeometryPool();
+
+private:
+	// First fit free list of element ranges, offset -> count
+	struct FreeList
+	{
+		std::map<uint32_t, uint32_t> ranges;
+
+		bool allocate(uint32_t count, uint32_t *offset);
+		void free(uint32_t offset, uint32_t count);
+	};
+
+	struct GeometryPage
+	{
+		VkBuffer vertexBuffer;
+		MemoryAllocation vertexBufferMemory;
+		FreeList freeVertices;
+
+		VkBuffer indexBuffer;
+		MemoryAllocation indexBufferMemory;
+		FreeList freeIndices;
+	};
+
+	DeviceMemoryAllocator *allocator;
+	VkDevice device;
+
+	// Pages are written on the transfer queue and read on the graphics queue at the same time (different ranges)
+	bool concurrent = false;
+	std::vector<uint32_t> queueFamilyIndices;
+
+	std::vector<GeometryPage> pages;
+
+	void createPage(uint32_t vertexCapacity, uint32_t indexCapacity);
+	void createPageBuffer(VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsageFlags, VkBuffer *buffer, MemoryAllocation *bufferMemory);
+};
@@ -0,0 +1,367 @@
+#include "GpuCuller.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+GpuCuller::GpuCuller()
+{
+}
+
+void GpuCuller::init(DeviceMemoryAllocator * newAllocator, VkDevice newDevice, SceneBuffer * newSceneBuffer, DepthPyramid * newDepthPyramid,
+	uint32_t imageCount, PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	sceneBuffer = newSceneBuffer;
+	depthPyramid = newDepthPyramid;
+
+	// Stays unsupported (renderer records draws on the CPU) without indirect count draws
+	if (drawIndexedIndirectCount == nullptr)
+	{
+		return;
+	}
+	cmdDrawIndexedIndirectCount = drawIndexedIndirectCount;
+
+	createPipelineLayout();
+	pipeline = createPipeline(readFile(GPU_CULL_SHADER_FILE));
+	if (depthPyramid->isSupported())
+	{
+		occlusionPipeline = createPipeline(readFile(GPU_CULL_OCCLUSION_SHADER_FILE));
+	}
+
+	// Cleared by the first cull: nothing counts as visible before the first late pass
+	createBuffer(allocator, device, sizeof(uint32_t) * GPU_CULL_VISIBILITY_SLOTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &visibilityBuffer, &visibilityMemory);
+
+	imageBuffers.resize(imageCount);
+	createDescriptorSets();
+}
+
+bool GpuCuller::isSupported()
+{
+	return pipeline != VK_NULL_HANDLE;
+}
+
+bool GpuCuller::isOcclusionSupported()
+{
+	return occlusionPipeline != VK_NULL_HANDLE;
+}
+
+void GpuCuller::setDraws(uint32_t image, const std::vector<GpuCullDraw> &draws, uint32_t batchCount)
+{
+	ImageBuffers &buffers = imageBuffers[image];
+
+	// Grow to the next power of two, the image's buffers aren't used by any submission right now
+	uint32_t drawCount = static_cast<uint32_t>(draws.size());
+	if (drawCount > buffers.drawCapacity || batchCount > buffers.batchCapacity)
+	{
+		uint32_t drawCapacity = std::max(buffers.drawCapacity, GPU_CULL_WORKGROUP_SIZE);
+		while (drawCapacity < drawCount) drawCapacity *= 2;
+		uint32_t batchCapacity = std::max(buffers.batchCapacity, 16u);
+		while (batchCapacity < batchCount) batchCapacity *= 2;
+
+		destroyImageBuffers(buffers);
+		createImageBuffers(buffers, drawCapacity, batchCapacity);
+		writeDescriptorSet(image);
+	}
+
+	if (drawCount > 0)
+	{
+		memcpy(buffers.drawMemory.mapped, draws.data(), sizeof(GpuCullDraw) * drawCount);
+		allocator->flush(buffers.drawMemory, 0, sizeof(GpuCullDraw) * drawCount);
+	}
+	buffers.drawCount = drawCount;
+	buffers.batchCount = batchCount;
+}
+
+void GpuCuller::updateSceneBuffer(uint32_t image)
+{
+	// Sets without buffers yet are written by their first setDraws
+	if (!isSupported() || imageBuffers[image].drawBuffer == VK_NULL_HANDLE) return;
+
+	writeDescriptorSet(image);
+}
+
+void GpuCuller::recordCull(VkCommandBuffer commandBuffer, uint32_t image, const Frustum & frustum, GpuCullPass pass)
+{
+	ImageBuffers &buffers = imageBuffers[image];
+	if (buffers.batchCount == 0) return;
+
+	if (pass != GPU_CULL_LATE)
+	{
+		// Every batch of both passes starts with no visible draws
+		vkCmdFillBuffer(commandBuffer, buffers.countBuffer, 0, sizeof(uint32_t) * buffers.batchCount * 2, 0);
+		if (!visibilityCleared)
+		{
+			vkCmdFillBuffer(commandBuffer, visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+			visibilityCleared = true;
+		}
+	}
+
+	// Also orders the visibility accesses after those of earlier passes and frames (barriers cover earlier submissions too)
+	VkMemoryBarrier clearBarrier = {};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	CullConstants constants = {};
+	std::copy(frustum.planes.begin(), frustum.planes.end(), constants.planes);
+	constants.drawCount = buffers.drawCount;
+	constants.batchCount = buffers.batchCount;
+	constants.pass = pass;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass == GPU_CULL_LATE ? occlusionPipeline : pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &buffers.descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+	vkCmdDispatch(commandBuffer, (buffers.drawCount + GPU_CULL_WORKGROUP_SIZE - 1) / GPU_CULL_WORKGROUP_SIZE, 1, 1);
+
+	// Commands and counts are read by the indirect draws of the geometry subpass
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+		1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCuller::recordDraws(VkCommandBuffer commandBuffer, uint32_t image, GpuCullPass pass, uint32_t batch, uint32_t firstCommand, uint32_t maxDrawCount)
+{
+	ImageBuffers &buffers = imageBuffers[image];
+
+	// Late pass commands and counts follow those of the early pass
+	if (pass == GPU_CULL_LATE)
+	{
+		firstCommand += buffers.drawCount;
+		batch += buffers.batchCount;
+	}
+
+	cmdDrawIndexedIndirectCount(commandBuffer, buffers.commandBuffer, sizeof(VkDrawIndexedIndirectCommand) * firstCommand,
+		buffers.countBuffer, sizeof(uint32_t) * batch, maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void GpuCuller::destroy()
+{
+	for (auto &buffers : imageBuffers)
+	{
+		destroyImageBuffers(buffers);
+	}
+	imageBuffers.clear();
+
+	if (occlusionPipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(device, occlusionPipeline, nullptr);
+		occlusionPipeline = VK_NULL_HANDLE;
+	}
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		destroyBuffer(allocator, device, visibilityBuffer, visibilityMemory);
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+}
+
+GpuCuller::~GpuCuller()
+{
+}
+
+void GpuCuller::createPipelineLayout()
+{
+	// Transforms, draws, commands, counts and visibility (storage buffers), view projection and depth pyramid.
+	// The pyramid is only written and used (by the late pass) when occlusion culling is supported
+	std::array<VkDescriptorSetLayoutBinding, 7> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Cull Descriptor Set Layout!");
+	}
+
+	// Frustum planes, draw and batch counts, pass
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Cull Pipeline Layout!");
+	}
+}
+
+VkPipeline GpuCuller::createPipeline(const std::vector<char> &shaderCode)
+{
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = shaderCode.size();
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(shaderCode.data());
+
+	VkShaderModule shaderModule;
+	VkResult result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	VkPipeline newPipeline;
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &newPipeline);
+
+	// Module is no longer needed once the pipeline exists
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Cull Pipeline!");
+	}
+	return newPipeline;
+}
+
+void GpuCuller::createDescriptorSets()
+{
+	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(imageBuffers.size() * 5);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(imageBuffers.size());
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[2].descriptorCount = static_cast<uint32_t>(imageBuffers.size());
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = static_cast<uint32_t>(imageBuffers.size());
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkResult result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Cull Descriptor Pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> setLayouts(imageBuffers.size(), descriptorSetLayout);
+	std::vector<VkDescriptorSet> descriptorSets(imageBuffers.size());
+
+	VkDescriptorSetAllocateInfo setAllocateInfo = {};
+	setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocateInfo.descriptorPool = descriptorPool;
+	setAllocateInfo.descriptorSetCount = static_cast<uint32_t>(setLayouts.size());
+	setAllocateInfo.pSetLayouts = setLayouts.data();
+
+	result = vkAllocateDescriptorSets(device, &setAllocateInfo, descriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate Cull Descriptor Sets!");
+	}
+
+	// Sets are written once the image has buffers (first setDraws)
+	for (size_t i = 0; i < imageBuffers.size(); i++)
+	{
+		imageBuffers[i].descriptorSet = descriptorSets[i];
+	}
+}
+
+void GpuCuller::createImageBuffers(ImageBuffers &buffers, uint32_t drawCapacity, uint32_t batchCapacity)
+{
+	createBuffer(allocator, device, sizeof(GpuCullDraw) * drawCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &buffers.drawBuffer, &buffers.drawMemory);
+	createBuffer(allocator, device, sizeof(VkDrawIndexedIndirectCommand) * drawCapacity * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers.commandBuffer, &buffers.commandMemory);
+	createBuffer(allocator, device, sizeof(uint32_t) * batchCapacity * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers.countBuffer, &buffers.countMemory);
+
+	buffers.drawCapacity = drawCapacity;
+	buffers.batchCapacity = batchCapacity;
+}
+
+void GpuCuller::destroyImageBuffers(ImageBuffers &buffers)
+{
+	if (buffers.drawBuffer == VK_NULL_HANDLE) return;
+
+	destroyBuffer(allocator, device, buffers.drawBuffer, buffers.drawMemory);
+	destroyBuffer(allocator, device, buffers.commandBuffer, buffers.commandMemory);
+	destroyBuffer(allocator, device, buffers.countBuffer, buffers.countMemory);
+	buffers.drawBuffer = VK_NULL_HANDLE;
+	buffers.commandBuffer = VK_NULL_HANDLE;
+	buffers.countBuffer = VK_NULL_HANDLE;
+	buffers.drawCapacity = 0;
+	buffers.batchCapacity = 0;
+}
+
+void GpuCuller::writeDescriptorSet(uint32_t image)
+{
+	ImageBuffers &buffers = imageBuffers[image];
+
+	std::array<VkDescriptorBufferInfo, 6> bufferInfos = {};
+	bufferInfos[0] = sceneBuffer->getTransformInfo(image);
+	bufferInfos[1] = { buffers.drawBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { buffers.commandBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { buffers.countBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[4] = { visibilityBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[5] = sceneBuffer->getViewProjectionInfo(image);
+
+	std::vector<VkWriteDescriptorSet> setWrites(bufferInfos.size());
+	for (uint32_t i = 0; i < setWrites.size(); i++)
+	{
+		setWrites[i] = {};
+		setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWrites[i].dstSet = buffers.descriptorSet;
+		setWrites[i].dstBinding = i;
+		setWrites[i].dstArrayElement = 0;
+		setWrites[i].descriptorType = i == 5 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		setWrites[i].descriptorCount = 1;
+		setWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	VkDescriptorImageInfo pyramidInfo = {};
+	if (isOcclusionSupported())
+	{
+		pyramidInfo = depthPyramid->getPyramidInfo(image);
+
+		VkWriteDescriptorSet pyramidWrite = {};
+		pyramidWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		pyramidWrite.dstSet = buffers.descriptorSet;
+		pyramidWrite.dstBinding = 6;
+		pyramidWrite.dstArrayElement = 0;
+		pyramidWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		pyramidWrite.descriptorCount = 1;
+		pyramidWrite.pImageInfo = &pyramidInfo;
+		setWrites.push_back(pyramidWrite);
+	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <vector>
+
+#include "Utilities.h"
+#include "SceneBuffer.h"
+#include "Frustum.h"
+#include "DepthPyramid.h"
+
+// Compute shader doing the culling (built from Shaders/cull.comp by Shaders/compile_shaders.bat)
+const char *const GPU_CULL_SHADER_FILE = "Shaders/cull_comp.spv";
+// Same shader built with OCCLUSION_CULLING, for the late pass of occlusion culling
+const char *const GPU_CULL_OCCLUSION_SHADER_FILE = "Shaders/cull_occlusion_comp.spv";
+const uint32_t GPU_CULL_WORKGROUP_SIZE = 64;		// local_size_x of cull.comp
+
+// Meshes whose visibility is remembered between frames for occlusion culling (1 uint each)
+const uint32_t GPU_CULL_VISIBILITY_SLOTS = 256 * 1024;
+const uint32_t GPU_CULL_NO_VISIBILITY = 0xFFFFFFFF;	// Draw without a slot: always drawn by the early pass
+
+// Which draws a cull dispatch keeps (matches the pass values of cull.comp)
+enum GpuCullPass
+{
+	GPU_CULL_FRUSTUM,					// Everything in the frustum, no occlusion culling
+	GPU_CULL_EARLY,						// In the frustum and visible last frame
+	GPU_CULL_LATE,						// Not drawn by the early pass, but in the frustum and not behind the early pass depth pyramid
+	GPU_CULL_PASS_COUNT
+};
+
+// One draw as the cull shader reads it (matches DrawInput in cull.comp, std430 layout)
+struct GpuCullDraw
+{
+	glm::vec4 bounds;					// Bounding sphere in model space (xyz: center, w: radius)
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t transformIndex;			// Model or instance transform in the scene buffer, also the draw's firstInstance
+	uint32_t batch;						// Batch whose draw count the draw increments if visible
+	uint32_t firstCommand;				// First indirect command of the batch
+	uint32_t visibilitySlot;			// Visibility of the mesh last frame, GPU_CULL_NO_VISIBILITY if it has none
+	uint32_t padding;
+};
+
+// Frustum culls draws on the GPU and writes the visible ones as indirect commands, compacted per batch. A batch is a set
+// of draws that share all bound state and is drawn with a single vkCmdDrawIndexedIndirectCount, so the CPU cost only
+// depends on the number of batches. Buffers are per swapchain image, like the scene buffer whose transforms are read.
+//
+// With a depth pyramid, draws are culled in two passes (occlusion culling): the early pass draws what was visible last
+// frame, the pyramid is built from its depth, and the late pass draws whatever else isn't hidden behind that depth.
+// The late pass also records each mesh's visibility for the next frame's early pass.
+class GpuCuller
+{
+public:
+	GpuCuller();
+
+	// drawIndexedIndirectCount: from VK_KHR_draw_indirect_count, nullptr if the device can't do indirect count draws
+	// (culler then stays unsupported)
+	// Occlusion culling needs depthPyramid to be supported as well
+	void init(DeviceMemoryAllocator *newAllocator, VkDevice newDevice, SceneBuffer *newSceneBuffer, DepthPyramid *newDepthPyramid,
+		uint32_t imageCount, PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount);
+	bool isSupported();
+	bool isOcclusionSupported();
+
+	// Replace the draws of an image (only once the image's previous submission has finished)
+	void setDraws(uint32_t image, const std::vector<GpuCullDraw> &draws, uint32_t batchCount);
+	// Point the image's set at its region of the scene buffer again, after the region was replaced (same timing as setDraws)
+	void updateSceneBuffer(uint32_t image);
+
+	// Outside of a render pass: cull the image's draws for one pass and make the commands visible to indirect draws.
+	// The late pass has to follow the early pass of the same frame, after the image's depth pyramid was built
+	void recordCull(VkCommandBuffer commandBuffer, uint32_t image, const Frustum &frustum, GpuCullPass pass);
+	// Inside the render pass: draw whichever commands of the batch the pass kept
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t image, GpuCullPass pass, uint32_t batch, uint32_t firstCommand, uint32_t maxDrawCount);
+
+	void destroy();
+
+	~GpuCuller();
+
+private:
+	struct ImageBuffers
+	{
+		VkBuffer drawBuffer = VK_NULL_HANDLE;		// GpuCullDraw of each draw (host visible)
+		MemoryAllocation drawMemory;
+		VkBuffer commandBuffer = VK_NULL_HANDLE;	// VkDrawIndexedIndirectCommand of each visible draw, early pass then late pass
+		MemoryAllocation commandMemory;
+		VkBuffer countBuffer = VK_NULL_HANDLE;		// Visible draws of each batch, early pass then late pass
+		MemoryAllocation countMemory;
+
+		uint32_t drawCapacity = 0;
+		uint32_t batchCapacity = 0;
+		uint32_t drawCount = 0;
+		uint32_t batchCount = 0;
+
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	};
+
+	// Matches the push constants of cull.comp
+	struct CullConstants
+	{
+		glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+		uint32_t drawCount;
+		uint32_t batchCount;
+		uint32_t pass;
+	};
+
+	DeviceMemoryAllocator *allocator;
+	VkDevice device;
+	SceneBuffer *sceneBuffer;
+	DepthPyramid *depthPyramid;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkPipeline occlusionPipeline = VK_NULL_HANDLE;	// Late pass, the only one reading the depth pyramid
+
+	// Visibility of each mesh slot, shared by all images (each frame reads what the frame before wrote)
+	VkBuffer visibilityBuffer = VK_NULL_HANDLE;
+	MemoryAllocation visibilityMemory;
+	bool visibilityCleared = false;
+
+	std::vector<ImageBuffers> imageBuffers;
+
+	void createPipelineLayout();
+	VkPipeline createPipeline(const std::vector<char> &shaderCode);
+	void createDescriptorSets();
+	void createImageBuffers(ImageBuffers &buffers, uint32_t drawCapacity, uint32_t batchCapacity);
+	void destroyImageBuffers(ImageBuffers &buffers);
+	void writeDescriptorSet(uint32_t image);
+};
@@ -0,0 +1,146 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+GpuProfiler::GpuProfiler()
+{
+}
+
+void GpuProfiler::init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t queueFamilyIndex, uint32_t slotCount)
+{
+	device = newDevice;
+	slotPending.assign(slotCount, false);
+
+	// Queue family must be able to write timestamps at all
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(newPhysicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(newPhysicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+	uint32_t validBits = queueFamilyList[queueFamilyIndex].timestampValidBits;
+	if (validBits == 0)
+	{
+		// Profiler stays disabled, every call becomes a no-op
+		return;
+	}
+	timestampMask = validBits >= 64 ? ~0ULL : ((1ULL << validBits) - 1);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(newPhysicalDevice, &deviceProperties);
+	timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+	// One set of timestamps for each slot
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = slotCount * GPU_TIMESTAMP_COUNT;
+
+	VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Timestamp Query Pool!");
+	}
+
+	for (auto &scopeHistory : history)
+	{
+		scopeHistory.resize(GPU_TIMING_HISTORY);
+	}
+}
+
+bool GpuProfiler::isSupported()
+{
+	return queryPool != VK_NULL_HANDLE;
+}
+
+void GpuProfiler::resetQueries(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	if (!isSupported()) return;
+
+	// Queries must be reset before being written again (and outside of a render pass)
+	vkCmdResetQueryPool(commandBuffer, queryPool, slot * GPU_TIMESTAMP_COUNT, GPU_TIMESTAMP_COUNT);
+}
+
+void GpuProfiler::writeTimestamp(VkCommandBuffer commandBuffer, uint32_t slot, GpuTimestamp timestamp, VkPipelineStageFlagBits stage)
+{
+	if (!isSupported()) return;
+
+	vkCmdWriteTimestamp(commandBuffer, stage, queryPool, slot * GPU_TIMESTAMP_COUNT + timestamp);
+}
+
+void GpuProfiler::markSubmitted(uint32_t slot)
+{
+	if (!isSupported()) return;
+
+	slotPending[slot] = true;
+}
+
+void GpuProfiler::collect(uint32_t slot)
+{
+	if (!isSupported() || !slotPending[slot]) return;
+
+	// No WAIT flag: the slot's fence has signaled, so results are either there or the frame is skipped
+	std::array<uint64_t, GPU_TIMESTAMP_COUNT> timestamps;
+	VkResult result = vkGetQueryPoolResults(device, queryPool, slot * GPU_TIMESTAMP_COUNT, GPU_TIMESTAMP_COUNT,
+		sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	slotPending[slot] = false;
+	if (result != VK_SUCCESS)
+	{
+		return;
+	}
+
+	// Convert tick deltas to milliseconds
+	auto elapsed = [&](GpuTimestamp begin, GpuTimestamp end)
+	{
+		uint64_t ticks = ((timestamps[end] & timestampMask) - (timestamps[begin] & timestampMask)) & timestampMask;
+		return static_cast<double>(ticks) * timestampPeriod / 1000000.0;
+	};
+
+	history[GPU_SCOPE_RENDER_PASS][historyNext] = elapsed(GPU_TIMESTAMP_PASS_BEGIN, GPU_TIMESTAMP_PASS_END);
+	history[GPU_SCOPE_GEOMETRY_SUBPASS][historyNext] = elapsed(GPU_TIMESTAMP_PASS_BEGIN, GPU_TIMESTAMP_GEOMETRY_END);
+	history[GPU_SCOPE_SECOND_SUBPASS][historyNext] = elapsed(GPU_TIMESTAMP_GEOMETRY_END, GPU_TIMESTAMP_SECOND_END);
+
+	historyNext = (historyNext + 1) % GPU_TIMING_HISTORY;
+	historySize = std::min(historySize + 1, GPU_TIMING_HISTORY);
+}
+
+GpuTimingStats GpuProfiler::getStats(GpuTimingScope scope)
+{
+	GpuTimingStats stats;
+	if (historySize == 0)
+	{
+		return stats;
+	}
+
+	// Sort a copy of the samples we have so far (ring may not be full yet)
+	std::vector<double> samples(history[scope].begin(), history[scope].begin() + historySize);
+	std::sort(samples.begin(), samples.end());
+
+	double total = 0.0;
+	for (double sample : samples)
+	{
+		total += sample;
+	}
+
+	size_t p99Index = (samples.size() * 99 + 99) / 100 - 1;
+
+	stats.min = samples.front();
+	stats.avg = total / samples.size();
+	stats.p99 = samples[std::min(p99Index, samples.size() - 1)];
+	stats.sampleCount = samples.size();
+
+	return stats;
+}
+
+void GpuProfiler::destroy()
+{
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = VK_NULL_HANDLE;
+	}
+}
+
+GpuProfiler::~GpuProfiler()
+{
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <array>
+
+#include "Utilities.h"
+
+// Number of past frames kept per scope for the rolling statistics
+const size_t GPU_TIMING_HISTORY = 256;
+
+// GPU scopes that are measured every frame
+enum GpuTimingScope
+{
+	GPU_SCOPE_RENDER_PASS,			// Whole render pass
+	GPU_SCOPE_GEOMETRY_SUBPASS,		// First subpass: meshes into color/depth attachments
+	GPU_SCOPE_SECOND_SUBPASS,		// Second subpass: input attachments onto swapchain image
+	GPU_SCOPE_COUNT
+};
+
+// Points in the command buffer where a timestamp is written
+enum GpuTimestamp
+{
+	GPU_TIMESTAMP_PASS_BEGIN,
+	GPU_TIMESTAMP_GEOMETRY_END,
+	GPU_TIMESTAMP_SECOND_END,
+	GPU_TIMESTAMP_PASS_END,
+	GPU_TIMESTAMP_COUNT
+};
+
+// Rolling timings of a scope in milliseconds
+struct GpuTimingStats
+{
+	double min = 0.0;
+	double avg = 0.0;
+	double p99 = 0.0;
+	size_t sampleCount = 0;
+};
+
+class GpuProfiler
+{
+public:
+	GpuProfiler();
+
+	// slotCount: sets of timestamps, one per command buffer that can be in flight
+	void init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t queueFamilyIndex, uint32_t slotCount);
+	bool isSupported();
+
+	// Recording (must be called with the slot of the command buffer being recorded)
+	void resetQueries(VkCommandBuffer commandBuffer, uint32_t slot);
+	void writeTimestamp(VkCommandBuffer commandBuffer, uint32_t slot, GpuTimestamp timestamp, VkPipelineStageFlagBits stage);
+	// A command buffer with the slot's queries was submitted
+	void markSubmitted(uint32_t slot);
+
+	// Read back results of the last submission of this slot. Only call once its fence has signaled, so this never stalls
+	void collect(uint32_t slot);
+
+	GpuTimingStats getStats(GpuTimingScope scope);
+
+	void destroy();
+
+	~GpuProfiler();
+
+private:
+	VkDevice device;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+
+	float timestampPeriod = 0.0f;		// Nanoseconds per timestamp tick
+	uint64_t timestampMask = 0;			// Valid bits of timestamps written on our queue
+
+	std::vector<bool> slotPending;
+
+	std::array<std::vector<double>, GPU_SCOPE_COUNT> history;
+	size_t historyNext = 0;
+	size_t historySize = 0;
+};
@@ -0,0 +1,195 @@
+#include "Lz4.h"
+
+#include <cstring>
+#include <vector>
+
+// Format limits: matches are at least 4 bytes, the last 5 bytes are always literals
+// and the last match starts at least 12 bytes before the end of the block
+const size_t LZ4_MIN_MATCH = 4;
+const size_t LZ4_LAST_LITERALS = 5;
+const size_t LZ4_MF_LIMIT = 12;
+const size_t LZ4_MAX_OFFSET = 65535;
+const uint32_t LZ4_HASH_BITS = 16;
+
+static uint32_t read32(const uint8_t *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint32_t hash4(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Length continuation bytes after a token nibble of 15
+static bool writeLength(size_t length, uint8_t *dst, size_t dstCapacity, size_t *op)
+{
+	while (length >= 255)
+	{
+		if (*op >= dstCapacity) return false;
+		dst[(*op)++] = 255;
+		length -= 255;
+	}
+	if (*op >= dstCapacity) return false;
+	dst[(*op)++] = static_cast<uint8_t>(length);
+	return true;
+}
+
+static bool readLength(const uint8_t *src, size_t srcSize, size_t *ip, size_t *length)
+{
+	uint8_t byte;
+	do
+	{
+		if (*ip >= srcSize) return false;
+		byte = src[(*ip)++];
+		*length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+// Token, literals and (unless it is the last sequence) offset and match length
+static bool writeSequence(const uint8_t *literals, size_t literalLength, size_t offset, size_t matchLength,
+	uint8_t *dst, size_t dstCapacity, size_t *op)
+{
+	if (*op >= dstCapacity) return false;
+	size_t tokenPos = (*op)++;
+
+	uint8_t token = static_cast<uint8_t>((literalLength < 15 ? literalLength : 15) << 4);
+	if (literalLength >= 15 && !writeLength(literalLength - 15, dst, dstCapacity, op)) return false;
+
+	if (*op + literalLength > dstCapacity) return false;
+	// Skipped when empty, literals may be null then (memcpy needs valid pointers even for 0 bytes)
+	if (literalLength > 0)
+	{
+		memcpy(dst + *op, literals, literalLength);
+	}
+	*op += literalLength;
+
+	if (matchLength > 0)
+	{
+		if (*op + 2 > dstCapacity) return false;
+		dst[(*op)++] = static_cast<uint8_t>(offset & 0xFF);
+		dst[(*op)++] = static_cast<uint8_t>(offset >> 8);
+
+		size_t extraLength = matchLength - LZ4_MIN_MATCH;
+		token |= static_cast<uint8_t>(extraLength < 15 ? extraLength : 15);
+		if (extraLength >= 15 && !writeLength(extraLength - 15, dst, dstCapacity, op)) return false;
+	}
+
+	dst[tokenPos] = token;
+	return true;
+}
+
+size_t Lz4::compressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t Lz4::compress(const uint8_t * src, size_t srcSize, uint8_t * dst, size_t dstCapacity)
+{
+	size_t ip = 0;
+	size_t anchor = 0;
+	size_t op = 0;
+
+	// Last position a 4 byte sequence was seen at (+1, 0 is empty)
+	std::vector<uint32_t> table(size_t(1) << LZ4_HASH_BITS, 0);
+
+	if (srcSize > LZ4_MF_LIMIT)
+	{
+		size_t matchLimit = srcSize - LZ4_LAST_LITERALS;
+		size_t lastMatchStart = srcSize - LZ4_MF_LIMIT;
+
+		while (ip <= lastMatchStart)
+		{
+			uint32_t sequence = read32(src + ip);
+			uint32_t &entry = table[hash4(sequence)];
+			size_t candidate = entry;
+			entry = static_cast<uint32_t>(ip + 1);
+
+			if (candidate == 0 || ip - (candidate - 1) > LZ4_MAX_OFFSET || read32(src + candidate - 1) != sequence)
+			{
+				ip++;
+				continue;
+			}
+			candidate--;
+
+			// Extend the match forwards...
+			size_t matchLength = LZ4_MIN_MATCH;
+			while (ip + matchLength < matchLimit && src[candidate + matchLength] == src[ip + matchLength])
+			{
+				matchLength++;
+			}
+
+			// ...and backwards into the pending literals
+			while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1])
+			{
+				ip--;
+				candidate--;
+				matchLength++;
+			}
+
+			if (!writeSequence(src + anchor, ip - anchor, ip - candidate, matchLength, dst, dstCapacity, &op))
+			{
+				return 0;
+			}
+
+			ip += matchLength;
+			anchor = ip;
+		}
+	}
+
+	// Whatever is left goes out as literals
+	if (!writeSequence(src + anchor, srcSize - anchor, 0, 0, dst, dstCapacity, &op))
+	{
+		return 0;
+	}
+	return op;
+}
+
+bool Lz4::decompress(const uint8_t * src, size_t srcSize, uint8_t * dst, size_t dstSize)
+{
+	size_t ip = 0;
+	size_t op = 0;
+
+	while (ip < srcSize)
+	{
+		uint8_t token = src[ip++];
+
+		// Literals
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(src, srcSize, &ip, &literalLength)) return false;
+		if (ip + literalLength > srcSize || op + literalLength > dstSize) return false;
+		// Skipped when empty, dst may be null for an empty output (memcpy needs valid pointers even for 0 bytes)
+		if (literalLength > 0)
+		{
+			memcpy(dst + op, src + ip, literalLength);
+		}
+		ip += literalLength;
+		op += literalLength;
+
+		// Last sequence has no match
+		if (ip == srcSize) break;
+
+		// Match
+		if (ip + 2 > srcSize) return false;
+		size_t offset = src[ip] | (static_cast<size_t>(src[ip + 1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > op) return false;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(src, srcSize, &ip, &matchLength)) return false;
+		matchLength += LZ4_MIN_MATCH;
+		if (op + matchLength > dstSize) return false;
+
+		// Byte by byte, the match may overlap the bytes it produces
+		for (size_t i = 0; i < matchLength; i++)
+		{
+			dst[op + i] = dst[op - offset + i];
+		}
+		op += matchLength;
+	}
+
+	return op == dstSize;
+}
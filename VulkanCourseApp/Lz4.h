@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4 block format (no frame header/checksums), enough for compressing chunks of cooked asset data.
+// Output is readable by any LZ4 block decoder and vice versa.
+class Lz4
+{
+public:
+	// Worst case compressed size of size bytes
+	static size_t compressBound(size_t size);
+
+	// Returns the compressed size, or 0 if dst is too small
+	static size_t compress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCapacity);
+	// Decompress exactly dstSize bytes, false if the data is corrupt or doesn't decompress to dstSize
+	static bool decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize);
+};
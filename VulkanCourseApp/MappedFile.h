@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+
+	// False if the file doesn't exist or can't be mapped
+	bool open(const std::string &fileName);
+	void close();
+
+	const uint8_t *getData();
+	size_t getSize();
+
+	~MappedFile();
+
+private:
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	void *fileHandle = nullptr;
+	void *mappingHandle = nullptr;
+#endif
+
+	// Owns the mapping
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+};
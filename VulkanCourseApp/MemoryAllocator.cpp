@@ -0,0 +1,359 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+DeviceMemoryAllocator::DeviceMemoryAllocator()
+{
+}
+
+void DeviceMemoryAllocator::init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice)
+{
+	physicalDevice = newPhysicalDevice;
+	device = newDevice;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+	nonCoherentAtomSize = std::max<VkDeviceSize>(deviceProperties.limits.nonCoherentAtomSize, 1);
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocate(const VkMemoryRequirements & requirements, VkMemoryPropertyFlags propertyFlags, bool linearResource)
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	MemoryAllocation allocation;
+	allocation.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, propertyFlags);
+
+	VkDeviceSize blockSize = getBlockSize(allocation.memoryTypeIndex);
+
+	// Very large resources (render targets, big textures) get memory of their own, they would only fragment a block
+	if (requirements.size > blockSize / 2)
+	{
+		VkMemoryAllocateInfo memoryAllocateInfo = {};
+		memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		memoryAllocateInfo.allocationSize = requirements.size;
+		memoryAllocateInfo.memoryTypeIndex = allocation.memoryTypeIndex;
+
+		VkResult result = vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &allocation.memory);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate Dedicated Device Memory!");
+		}
+
+		allocation.size = requirements.size;
+		allocation.mapped = mapMemory(allocation.memory, allocation.memoryTypeIndex);
+
+		stats.dedicatedCount++;
+		return allocation;
+	}
+
+	// Buddy ranges are aligned to their own size and are never smaller than MEMORY_MIN_ALLOCATION, so if the
+	// granularity fits in that, linear and optimal resources can never share a granularity page and can share blocks
+	bool blockLinear = bufferImageGranularity <= MEMORY_MIN_ALLOCATION ? true : linearResource;
+
+	// First try existing blocks of this kind...
+	VkDeviceSize offset = 0;
+	VkDeviceSize allocatedSize = 0;
+	int blockIndex = -1;
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		MemoryBlock &block = blocks[i];
+		if (block.memory != VK_NULL_HANDLE && block.memoryTypeIndex == allocation.memoryTypeIndex && block.linear == blockLinear
+			&& allocateFromBlock(block, requirements.size, requirements.alignment, &offset, &allocatedSize))
+		{
+			blockIndex = static_cast<int>(i);
+			break;
+		}
+	}
+
+	// ...otherwise start a new one
+	if (blockIndex < 0)
+	{
+		blockIndex = createBlock(allocation.memoryTypeIndex, blockLinear);
+		if (!allocateFromBlock(blocks[blockIndex], requirements.size, requirements.alignment, &offset, &allocatedSize))
+		{
+			throw std::runtime_error("Failed to sub-allocate Device Memory!");
+		}
+	}
+
+	MemoryBlock &block = blocks[blockIndex];
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = allocatedSize;
+	allocation.mapped = block.mapped ? static_cast<char *>(block.mapped) + offset : nullptr;
+	allocation.blockIndex = blockIndex;
+
+	stats.allocationCount++;
+	stats.usedBytes += allocatedSize;
+
+	return allocation;
+}
+
+void DeviceMemoryAllocator::free(const MemoryAllocation & allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE) return;
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	// Dedicated allocation, just give it back
+	if (allocation.blockIndex < 0)
+	{
+		if (allocation.mapped)
+		{
+			vkUnmapMemory(device, allocation.memory);
+		}
+		vkFreeMemory(device, allocation.memory, nullptr);
+		stats.dedicatedCount--;
+		return;
+	}
+
+	MemoryBlock &block = blocks[allocation.blockIndex];
+
+	auto allocated = block.allocatedOrders.find(allocation.offset);
+	if (allocated == block.allocatedOrders.end())
+	{
+		throw std::runtime_error("Failed to free Device Memory, range was not allocated!");
+	}
+
+	uint32_t order = allocated->second;
+	block.allocatedOrders.erase(allocated);
+
+	VkDeviceSize offset = allocation.offset;
+	VkDeviceSize rangeSize = MEMORY_MIN_ALLOCATION << order;
+	block.usedBytes -= rangeSize;
+	stats.allocationCount--;
+	stats.usedBytes -= rangeSize;
+
+	// Merge with buddy for as long as the buddy is free too
+	uint32_t maxOrder = static_cast<uint32_t>(block.freeLists.size()) - 1;
+	while (order < maxOrder)
+	{
+		VkDeviceSize buddy = offset ^ (MEMORY_MIN_ALLOCATION << order);
+		if (block.freeLists[order].erase(buddy) == 0)
+		{
+			break;
+		}
+		offset = std::min(offset, buddy);
+		order++;
+	}
+	block.freeLists[order].insert(offset);
+
+	// Release empty blocks, but keep the last one of its kind around so a load/unload cycle doesn't thrash
+	if (block.usedBytes == 0)
+	{
+		for (size_t i = 0; i < blocks.size(); i++)
+		{
+			if (static_cast<int>(i) != allocation.blockIndex && blocks[i].memory != VK_NULL_HANDLE
+				&& blocks[i].memoryTypeIndex == block.memoryTypeIndex && blocks[i].linear == block.linear)
+			{
+				freeBlock(allocation.blockIndex);
+				break;
+			}
+		}
+	}
+}
+
+void DeviceMemoryAllocator::flush(const MemoryAllocation & allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+	if (isCoherent(allocation)) return;
+
+	// Flushed range must be aligned to nonCoherentAtomSize (relative to the start of the VkDeviceMemory)
+	VkDeviceSize begin = allocation.offset + offset;
+	VkDeviceSize end = begin + size;
+	begin = begin / nonCoherentAtomSize * nonCoherentAtomSize;
+	end = (end + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+
+	VkMappedMemoryRange mappedRange = {};
+	mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	mappedRange.memory = allocation.memory;
+	mappedRange.offset = begin;
+	mappedRange.size = end - begin;
+
+	// Rounding up may run past the end of a dedicated allocation, the whole remainder is fine there
+	if (allocation.blockIndex < 0 && end > allocation.size)
+	{
+		mappedRange.size = VK_WHOLE_SIZE;
+	}
+
+	vkFlushMappedMemoryRanges(device, 1, &mappedRange);
+}
+
+bool DeviceMemoryAllocator::isCoherent(const MemoryAllocation & allocation)
+{
+	return (memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+MemoryAllocatorStats DeviceMemoryAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	return stats;
+}
+
+void DeviceMemoryAllocator::destroy()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		if (blocks[i].memory != VK_NULL_HANDLE)
+		{
+			freeBlock(static_cast<int>(i));
+		}
+	}
+	blocks.clear();
+}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator()
+{
+}
+
+uint32_t DeviceMemoryAllocator::findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((allowedTypes & (1 << i))
+			&& (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find a suitable Memory Type!");
+}
+
+VkDeviceSize DeviceMemoryAllocator::getBlockSize(uint32_t memoryTypeIndex)
+{
+	// Don't let a single block take more than an eighth of a small heap (e.g. the 256MB device local + host visible heap)
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+
+	VkDeviceSize blockSize = MEMORY_BLOCK_SIZE;
+	while (blockSize > heapSize / 8 && blockSize > MEMORY_MIN_ALLOCATION * 16)
+	{
+		blockSize /= 2;
+	}
+
+	return blockSize;
+}
+
+int DeviceMemoryAllocator::createBlock(uint32_t memoryTypeIndex, bool linear)
+{
+	MemoryBlock block;
+	block.memoryTypeIndex = memoryTypeIndex;
+	block.linear = linear;
+	block.size = getBlockSize(memoryTypeIndex);
+
+	VkMemoryAllocateInfo memoryAllocateInfo = {};
+	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocateInfo.allocationSize = block.size;
+	memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkResult result = vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &block.memory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate a Device Memory Block!");
+	}
+
+	block.mapped = mapMemory(block.memory, memoryTypeIndex);
+
+	// Whole block starts out as a single free range of the highest order
+	uint32_t maxOrder = 0;
+	while ((MEMORY_MIN_ALLOCATION << maxOrder) < block.size)
+	{
+		maxOrder++;
+	}
+	block.freeLists.resize(maxOrder + 1);
+	block.freeLists[maxOrder].insert(0);
+
+	stats.blockCount++;
+	stats.blockBytes += block.size;
+
+	// Reuse the slot of a released block, so block indices held by allocations stay valid
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		if (blocks[i].memory == VK_NULL_HANDLE)
+		{
+			blocks[i] = std::move(block);
+			return static_cast<int>(i);
+		}
+	}
+
+	blocks.push_back(std::move(block));
+	return static_cast<int>(blocks.size() - 1);
+}
+
+bool DeviceMemoryAllocator::allocateFromBlock(MemoryBlock & block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset, VkDeviceSize * allocatedSize)
+{
+	// Every range is aligned to its own size, so rounding up to the alignment covers it
+	VkDeviceSize needed = std::max(std::max(size, alignment), MEMORY_MIN_ALLOCATION);
+
+	uint32_t order = 0;
+	while ((MEMORY_MIN_ALLOCATION << order) < needed)
+	{
+		order++;
+	}
+
+	// Smallest free range that fits
+	uint32_t freeOrder = order;
+	while (freeOrder < block.freeLists.size() && block.freeLists[freeOrder].empty())
+	{
+		freeOrder++;
+	}
+	if (freeOrder >= block.freeLists.size())
+	{
+		return false;
+	}
+
+	VkDeviceSize rangeOffset = *block.freeLists[freeOrder].begin();
+	block.freeLists[freeOrder].erase(block.freeLists[freeOrder].begin());
+
+	// Split it down, putting the upper halves back on the free lists
+	while (freeOrder > order)
+	{
+		freeOrder--;
+		block.freeLists[freeOrder].insert(rangeOffset + (MEMORY_MIN_ALLOCATION << freeOrder));
+	}
+
+	block.allocatedOrders[rangeOffset] = order;
+	block.usedBytes += MEMORY_MIN_ALLOCATION << order;
+
+	*offset = rangeOffset;
+	*allocatedSize = MEMORY_MIN_ALLOCATION << order;
+	return true;
+}
+
+void DeviceMemoryAllocator::freeBlock(int blockIndex)
+{
+	MemoryBlock &block = blocks[blockIndex];
+
+	if (block.mapped)
+	{
+		vkUnmapMemory(device, block.memory);
+	}
+	vkFreeMemory(device, block.memory, nullptr);
+
+	stats.blockCount--;
+	stats.blockBytes -= block.size;
+
+	block = MemoryBlock();
+}
+
+void * DeviceMemoryAllocator::mapMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex)
+{
+	// Host visible memory stays mapped for its whole lifetime (a VkDeviceMemory can only be mapped once at a time)
+	if (!(memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+	{
+		return nullptr;
+	}
+
+	void *data = nullptr;
+	VkResult result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to map Device Memory!");
+	}
+
+	return data;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+
+// Size of the VkDeviceMemory blocks resources are placed in (smaller on small heaps)
+const VkDeviceSize MEMORY_BLOCK_SIZE = 64 * 1024 * 1024;
+// Smallest range handed out of a block
+const VkDeviceSize MEMORY_MIN_ALLOCATION = 256;
+
+// Range of device memory a resource is bound to
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;		// Memory to bind to (shared block, or dedicated allocation)
+	VkDeviceSize offset = 0;					// Offset of range into memory
+	VkDeviceSize size = 0;						// Size of range (at least the size requested)
+	void *mapped = nullptr;						// Host pointer to start of range (host visible memory is persistently mapped)
+	uint32_t memoryTypeIndex = 0;
+	int blockIndex = -1;						// Block range was placed in, -1 if dedicated allocation
+};
+
+struct MemoryAllocatorStats
+{
+	uint32_t blockCount = 0;					// Live vkAllocateMemory calls for shared blocks
+	uint32_t dedicatedCount = 0;				// Live vkAllocateMemory calls for dedicated allocations
+	uint32_t allocationCount = 0;				// Live sub-allocations in blocks
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize usedBytes = 0;
+};
+
+// Places resources in a few large VkDeviceMemory blocks per memory type using a buddy allocator,
+// instead of one vkAllocateMemory call per resource
+class DeviceMemoryAllocator
+{
+public:
+	DeviceMemoryAllocator();
+
+	void init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice);
+
+	// linearResource: buffers/linear images (true) or optimally tiled images (false), for bufferImageGranularity
+	MemoryAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags propertyFlags, bool linearResource);
+	void free(const MemoryAllocation &allocation);
+
+	// Make host writes visible to the device (only does anything for non-coherent memory)
+	void flush(const MemoryAllocation &allocation, VkDeviceSize offset, VkDeviceSize size);
+	bool isCoherent(const MemoryAllocation &allocation);
+
+	MemoryAllocatorStats getStats();
+
+	void destroy();
+
+	~DeviceMemoryAllocator();
+
+private:
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;		// VK_NULL_HANDLE if block slot is unused
+		void *mapped = nullptr;
+		uint32_t memoryTypeIndex = 0;
+		bool linear = true;
+		VkDeviceSize size = 0;
+		VkDeviceSize usedBytes = 0;
+
+		std::vector<std::set<VkDeviceSize>> freeLists;				// Free offsets for each order (size = MEMORY_MIN_ALLOCATION << order)
+		std::unordered_map<VkDeviceSize, uint32_t> allocatedOrders;	// Order of each allocated offset
+	};
+
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize bufferImageGranularity;
+	VkDeviceSize nonCoherentAtomSize;
+
+	std::mutex allocatorMutex;
+	std::vector<MemoryBlock> blocks;
+	MemoryAllocatorStats stats;
+
+	uint32_t findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties);
+	VkDeviceSize getBlockSize(uint32_t memoryTypeIndex);
+	int createBlock(uint32_t memoryTypeIndex, bool linear);
+	bool allocateFromBlock(MemoryBlock &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset, VkDeviceSize *allocatedSize);
+	void freeBlock(int blockIndex);
+	void *mapMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex);
+};
@@ -5,20 +5,29 @@ Mesh::Mesh()
 {
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool, 
+Mesh::Mesh(GeometryPool *newGeometryPool, UploadBatch *uploadBatch, 
 		std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, 
 		int newTexId)
+	: Mesh(newGeometryPool, uploadBatch, vertices->data(), static_cast<uint32_t>(vertices->size()),
+		indices->data(), static_cast<uint32_t>(indices->size()), newTexId)
 {
-	vertexCount = vertices->size();
-	indexCount = indices->size();
-	physicalDevice = newPhysicalDevice;
-	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
+}
+
+Mesh::Mesh(GeometryPool *newGeometryPool, UploadBatch *uploadBatch, 
+		const Vertex *vertices, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount, 
+		int newTexId)
+{
+	geometryPool = newGeometryPool;
+
+	// Suballocate vertex and index ranges from the shared pool, data is copied into staging right away
+	geometry = geometryPool->allocate(uploadBatch, vertices, vertexCount, indices, indexCount);
 
 	model.model = glm::mat4(1.0f);
 	texId = newTexId;
+
+	lods = { { 0, indexCount, 0.0f } };
+	bounds = { glm::vec3(0.0f), 0.0f };
+	box = { glm::vec3(0.0f), glm::vec3(0.0f) };
 }
 
 void Mesh::setModel(glm::mat4 newModel)
@@ -36,96 +45,70 @@ int Mesh::getTexId()
 	return texId;
 }
 
-int Mesh::getVertexCount()
+int Mesh::getGeometryPage()
 {
-	return vertexCount;
+	return geometry.page;
 }
 
-VkBuffer Mesh::getVertexBuffer()
+int Mesh::getVertexOffset()
 {
-	return vertexBuffer;
+	return static_cast<int>(geometry.vertexOffset);
 }
 
-int Mesh::getIndexCount()
+int Mesh::getVertexCount()
 {
-	return indexCount;
+	return static_cast<int>(geometry.vertexCount);
 }
 
-VkBuffer Mesh::getIndexBuffer()
+uint32_t Mesh::getFirstIndex()
 {
-	return indexBuffer;
+	return geometry.firstIndex;
 }
 
-void Mesh::destroyBuffers()
+int Mesh::getIndexCount()
 {
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	return static_cast<int>(geometry.indexCount);
 }
 
-
-Mesh::~Mesh()
+void Mesh::setLods(std::vector<MeshLod> newLods, BoundingSphere newBounds)
 {
+	lods = newLods;
+	bounds = newBounds;
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices)
+uint32_t Mesh::getLodCount()
 {
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
-
-	// Temporary buffer to "stage" vetex data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	// Create Staging Buffer and allocate memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		&stagingBuffer, &stagingBufferMemory);
-
-	// MAP MEMORY TO VERTEX BUFFER
-	void *data;																		// 1. Create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);				// 2. Map the Vertex Buffer Memory to that point
-	memcpy(data, vertices->data(), static_cast<size_t>(bufferSize));				// 3. Copy memory from vertices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);										// 4. Unmap the vertex buffer memory
-
-	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also VERTEX_BUFFER)
-	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is on the GPU and only accessible by it and not the CPU (host)
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
-
-	// Copy staging buffer to vertex buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
+	return static_cast<uint32_t>(lods.size());
+}
 
-	// Clean up staging buffer parts
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+MeshLod Mesh::getLod(uint32_t lod)
+{
+	return lods[lod];
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices)
+BoundingSphere Mesh::getBounds()
 {
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
+	return bounds;
+}
 
-	// Temporary buffer to "stage" index data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+void Mesh::setBoundingBox(BoundingBox newBox)
+{
+	box = newBox;
+}
 
-	// MAP MEMORY TO INDEX BUFFER
-	void *data;															
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);	
-	memcpy(data, indices->data(), static_cast<size_t>(bufferSize));	
-	vkUnmapMemory(device, stagingBufferMemory);
+BoundingBox Mesh::getBoundingBox()
+{
+	return box;
+}
 
-	// Create buffer for INDEX data on GPU access only area
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
+void Mesh::destroyBuffers()
+{
+	// Give the ranges back to the pool
+	geometryPool->free(geometry);
+	geometry = GeometryAllocation();
+}
 
-	// Copy from staging buffer to GPU access buffer
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
 
-	// Destroy and release staging buffer resources
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+Mesh::~Mesh()
+{
 }
-
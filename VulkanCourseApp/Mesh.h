@@ -6,6 +6,8 @@
 #include <vector>
 
 #include "Utilities.h"
+#include "GeometryPool.h"
+#include "MeshSimplifier.h"
 
 struct Model
 {
@@ -16,21 +18,33 @@ class Mesh
 {
 public:
 	Mesh();
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool, 
+	Mesh(GeometryPool *newGeometryPool, UploadBatch *uploadBatch, 
 		std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, 
 		int newTexId);
+	Mesh(GeometryPool *newGeometryPool, UploadBatch *uploadBatch, 
+		const Vertex *vertices, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount, 
+		int newTexId);
 
 	void setModel(glm::mat4 newModel);
 	Model getModel();
 
 	int getTexId();
 
+	// Location of the mesh's data in the geometry pool
+	int getGeometryPage();
+	int getVertexOffset();
 	int getVertexCount();
-	VkBuffer getVertexBuffer();
-
+	uint32_t getFirstIndex();
 	int getIndexCount();
-	VkBuffer getIndexBuffer();
+
+	// Index ranges of the levels of detail, all in the mesh's index range (a single LOD 0 covering all of it unless set)
+	void setLods(std::vector<MeshLod> newLods, BoundingSphere newBounds);
+	uint32_t getLodCount();
+	MeshLod getLod(uint32_t lod);
+	BoundingSphere getBounds();
+
+	void setBoundingBox(BoundingBox newBox);
+	BoundingBox getBoundingBox();
 
 	void destroyBuffers();
 
@@ -41,18 +55,11 @@ private:
 
 	int texId;
 
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
-
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
+	GeometryAllocation geometry;
+	GeometryPool *geometryPool;
 
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex> *vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t> *indices);
+	std::vector<MeshLod> lods;
+	BoundingSphere bounds;
+	BoundingBox box;
 };
 
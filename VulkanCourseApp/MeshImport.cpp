@@ -0,0 +1,106 @@
+#include "MeshImport.h"
+#include "CpuTracer.h"
+
+std::vector<std::string> MeshImport::loadMaterials(const aiScene * scene)
+{
+	CPU_TRACE_SCOPE("MeshImport::loadMaterials");
+
+	// Create 1:1 sized list of textures
+	std::vector<std::string> textureList(scene->mNumMaterials);
+
+	// Go through each material and copy its texture file name (if it exists)
+	for (size_t i = 0; i < scene->mNumMaterials; i++)
+	{
+		// Get the material
+		aiMaterial *material = scene->mMaterials[i];
+
+		// Initialize the texture to empty string (will be replaced if texture exists)
+		textureList[i] = "";
+
+		// Check for a Diffuse Texture (standard detail texture)
+		if (material->GetTextureCount(aiTextureType_DIFFUSE))
+		{
+			// Get the path of the texture file
+			aiString path;
+			if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS)
+			{
+				// Cut off any directory information present already
+				int idx = std::string(path.data).rfind("\\");
+				std::string fileName = std::string(path.data).substr(idx + 1);
+
+				textureList[i] = fileName;
+			}
+		}
+	}
+	return textureList;
+}
+
+void MeshImport::loadMesh(const aiMesh * mesh, std::vector<Vertex> *vertices, std::vector<uint32_t> *indices)
+{
+	CPU_TRACE_SCOPE("MeshImport::loadMesh");
+
+	// Resize vertex list to hold all vertices for mesh
+	vertices->resize(mesh->mNumVertices);
+
+	// Go through each vertex and copy it across to our own vertices implementation
+	for (size_t i = 0; i < mesh->mNumVertices; i++)
+	{
+		Vertex &vertex = (*vertices)[i];
+		vertex.pos = {mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z};
+
+		// Set tex coords if they exist
+		if(mesh->mTextureCoords[0]) 
+		{
+			vertex.tex = {mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y};
+		}
+		else
+		{
+			vertex.tex = {0.0f, 0.0f};
+		}
+
+		// Set color (just white for now; not really used)
+		vertex.col = {1.0f, 1.0f, 1.0f};
+	}
+
+	// Iterate over indices through faces and copy across
+	indices->clear();
+	indices->reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
+	for (size_t i = 0; i < mesh->mNumFaces; i++)
+	{
+		const aiFace &face = mesh->mFaces[i];
+
+		for(size_t j = 0; j < face.mNumIndices; j++)
+		{
+			indices->push_back(face.mIndices[j]);
+		}
+	}
+}
+
+CookedModel MeshImport::loadModel(const aiScene * scene)
+{
+	CPU_TRACE_SCOPE("MeshImport::loadModel");
+
+	CookedModel model;
+	model.textureNames = loadMaterials(scene);
+	loadNode(scene->mRootNode, scene, &model);
+	return model;
+}
+
+void MeshImport::loadNode(const aiNode * node, const aiScene * scene, CookedModel * model)
+{
+	// Meshes at this node, then the ones of its children (same order as MeshModel::LoadNode)
+	for (size_t i = 0; i < node->mNumMeshes; i++)
+	{
+		const aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
+
+		CookedModel::Mesh cookedMesh;
+		loadMesh(mesh, &cookedMesh.vertices, &cookedMesh.indices);
+		cookedMesh.materialIndex = mesh->mMaterialIndex;
+		model->meshes.push_back(std::move(cookedMesh));
+	}
+
+	for (size_t i = 0; i < node->mNumChildren; i++)
+	{
+		loadNode(node->mChildren[i], scene, model);
+	}
+}
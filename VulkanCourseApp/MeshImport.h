@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "Vertex.h"
+#include "CookedMesh.h"
+
+// Post processing every model is imported with (runtime and asset cooker must match)
+const unsigned int MESH_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices;
+
+// Conversion of an imported Assimp scene into the engine's vertex layout. Needs no device, so the asset cooker
+// shares it with the runtime import.
+class MeshImport
+{
+public:
+	// Diffuse texture file name of each material (1:1 with the scene's materials), empty if it has none
+	static std::vector<std::string> loadMaterials(const aiScene *scene);
+	// Vertices and triangle list indices of one mesh
+	static void loadMesh(const aiMesh *mesh, std::vector<Vertex> *vertices, std::vector<uint32_t> *indices);
+	// Every mesh of the scene in node order, with the materials' texture names
+	static CookedModel loadModel(const aiScene *scene);
+
+private:
+	static void loadNode(const aiNode *node, const aiScene *scene, CookedModel *model);
+};
@@ -1,9 +1,13 @@
 #include "MeshModel.h"
+#include "MeshImport.h"
+#include "CpuTracer.h"
 
 
 
 MeshModel::MeshModel()
-{}
+{
+	model = glm::mat4(1.0f);
+}
 
 MeshModel::MeshModel(std::vector<Mesh> newMeshList)
 {
@@ -35,6 +39,36 @@ glm::mat4 MeshModel::getModel()
 	return model;
 }
 
+TransferTicket MeshModel::getUploadTicket()
+{
+	return uploadTicket;
+}
+
+void MeshModel::setUploadTicket(TransferTicket newUploadTicket)
+{
+	uploadTicket = newUploadTicket;
+}
+
+std::vector<int> MeshModel::getTextureIds()
+{
+	return textureIds;
+}
+
+void MeshModel::setTextureIds(std::vector<int> newTextureIds)
+{
+	textureIds = newTextureIds;
+}
+
+MeshOptimizeReport MeshModel::getOptimizeReport()
+{
+	return optimizeReport;
+}
+
+void MeshModel::setOptimizeReport(MeshOptimizeReport newOptimizeReport)
+{
+	optimizeReport = newOptimizeReport;
+}
+
 void MeshModel::destroyMeshModel()
 {
 	for (auto &mesh : meshList)
@@ -48,99 +82,56 @@ MeshModel::~MeshModel()
 
 std::vector<std::string> MeshModel::LoadMaterials(const aiScene * scene)
 {
-	// Create 1:1 sized list of textures
-	std::vector<std::string> textureList(scene->mNumMaterials);
-
-	// Go through each material and copy its texture file name (if it exists)
-	for (size_t i = 0; i < scene->mNumMaterials; i++)
-	{
-		// Get the material
-		aiMaterial *material = scene->mMaterials[i];
-		
-		// Initialize the texture to empty string (will be replaced if texture exists)
-		textureList[i] = "";
-		
-		// Check for a Diffuse Texture (standard detail texture)
-		if (material->GetTextureCount(aiTextureType_DIFFUSE))
-		{
-			// Get the path of the texture file
-			aiString path;
-			if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS)
-			{
-				// Cut off any directory information present already
-				int idx = std::string(path.data).rfind("\\");
-				std::string fileName = std::string(path.data).substr(idx + 1);
-
-				textureList[i] = fileName;
-			}
-		}
-	}
-	return textureList;
+	return MeshImport::loadMaterials(scene);
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, 
-	aiNode * node, const aiScene * scene, std::vector<int> matToTex)
+std::vector<Mesh> MeshModel::LoadNode(GeometryPool *geometryPool, UploadBatch *uploadBatch, 
+	aiNode * node, const aiScene * scene, std::vector<int> matToTex,
+	const MeshOptimizeOptions &optimizeOptions, MeshOptimizeReport *optimizeReport)
 {
+	CPU_TRACE_SCOPE("MeshModel::LoadNode");
+
 	std::vector<Mesh> meshList;
 
 	// Go through each mesh at this node and create it, then add it to our meshList
 	for (size_t i = 0; i < node->mNumMeshes; i++)
 	{
 		meshList.push_back(
-			LoadMesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, scene->mMeshes[node->mMeshes[i]], scene, matToTex)
+			LoadMesh(geometryPool, uploadBatch, scene->mMeshes[node->mMeshes[i]], scene, matToTex, optimizeOptions, optimizeReport)
 		);
 	}
 
 	// Go through each node and load it, then append their meshes to this node's meshList
 	for (size_t i = 0; i < node->mNumChildren; i++)
 	{
-		std::vector<Mesh> newList = LoadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, node->mChildren[i], scene, matToTex);
+		std::vector<Mesh> newList = LoadNode(geometryPool, uploadBatch, node->mChildren[i], scene, matToTex,
+			optimizeOptions, optimizeReport);
 		meshList.insert(meshList.end(), newList.begin(), newList.end());
 	}
 
 	return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, 
-	aiMesh * mesh, const aiScene * scene, std::vector<int> matToTex)
+Mesh MeshModel::LoadMesh(GeometryPool *geometryPool, UploadBatch *uploadBatch, 
+	aiMesh * mesh, const aiScene * scene, std::vector<int> matToTex,
+	const MeshOptimizeOptions &optimizeOptions, MeshOptimizeReport *optimizeReport)
 {
+	CPU_TRACE_SCOPE("MeshModel::LoadMesh");
+
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
+	MeshImport::loadMesh(mesh, &vertices, &indices);
 
-	// Resize vertex list to hold all vertices for mesh
-	vertices.resize(mesh->mNumVertices);
-
-	// Go through each vertex and copy it across to our own vertices implementation
-	for (size_t i = 0; i < mesh->mNumVertices; i++)
-	{
-		vertices[i].pos = {mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z};
-
-		// Set tex coords if they exist
-		if(mesh->mTextureCoords[0]) 
-		{
-			vertices[i].tex = {mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y};
-		}
-		else
-		{
-			vertices[i].tex = {0.0f, 0.0f};
-		}
-
-		// Set color (just white for now; not really used)
-		vertices[i].col = {1.0f, 1.0f, 1.0f};
-	}
-
-	// Iterate over indices through faces and copy across
-	for (size_t i = 0; i < mesh->mNumFaces; i++)
-	{
-		aiFace face = mesh->mFaces[i];
+	// Simplified versions appended after the full mesh, all sharing its vertices
+	std::vector<MeshLod> lods = MeshSimplifier::buildLods(vertices, &indices);
 
-		for(size_t j = 0; j < face.mNumIndices; j++)
-		{
-			indices.push_back(face.mIndices[j]);
-		}
-	}
+	// Assimp's face order is whatever the file had, reorder for the vertex cache, overdraw and vertex fetch
+	MeshOptimizer::optimize(&vertices, &indices, lods, optimizeOptions, optimizeReport);
 
-	Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+	CPU_TRACE_SCOPE("Mesh stage");
+	Mesh newMesh = Mesh(geometryPool, uploadBatch, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+	newMesh.setLods(lods, MeshSimplifier::computeBoundingSphere(vertices));
+	newMesh.setBoundingBox(MeshSimplifier::computeBoundingBox(vertices));
 
 	return newMesh;
 }
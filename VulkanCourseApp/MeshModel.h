@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include "Mesh.h"
+#include "MeshOptimizer.h"
 #include <assimp/scene.h>
 
 class MeshModel
@@ -14,18 +15,35 @@ public:
 	glm::mat4 getModel();
 	void setModel(glm::mat4 newModel);
 
+	TransferTicket getUploadTicket();
+	void setUploadTicket(TransferTicket newUploadTicket);
+
+	// Textures the model holds a reference to (one entry per reference)
+	std::vector<int> getTextureIds();
+	void setTextureIds(std::vector<int> newTextureIds);
+
+	// Vertex cache statistics of the meshes before/after optimizing them on import (empty for cooked models)
+	MeshOptimizeReport getOptimizeReport();
+	void setOptimizeReport(MeshOptimizeReport newOptimizeReport);
+
 	void destroyMeshModel();
 
 	static std::vector<std::string> LoadMaterials(const aiScene *scene);
-	static std::vector<Mesh> LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, 
-		VkCommandPool transferCommandPool, aiNode *node, const aiScene *scene, std::vector<int> matToTex);
-	static Mesh LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, 
-		VkCommandPool transferCommandPool, aiMesh *mesh, const aiScene *scene, std::vector<int> matToTex);
+	static std::vector<Mesh> LoadNode(GeometryPool *geometryPool, UploadBatch *uploadBatch, 
+		aiNode *node, const aiScene *scene, std::vector<int> matToTex,
+		const MeshOptimizeOptions &optimizeOptions, MeshOptimizeReport *optimizeReport);
+	static Mesh LoadMesh(GeometryPool *geometryPool, UploadBatch *uploadBatch, 
+		aiMesh *mesh, const aiScene *scene, std::vector<int> matToTex,
+		const MeshOptimizeOptions &optimizeOptions, MeshOptimizeReport *optimizeReport);
 
 	~MeshModel();
 
 private:
 	std::vector<Mesh> meshList;
 	glm::mat4 model;
+
+	TransferTicket uploadTicket = 0;		// Model can only be drawn once this upload has completed
+	std::vector<int> textureIds;
+	MeshOptimizeReport optimizeReport;
 };
 
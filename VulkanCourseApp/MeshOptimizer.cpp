@@ -0,0 +1,317 @@
+#include "MeshOptimizer.h"
+#include "CpuTracer.h"
+
+#include <algorithm>
+#include <numeric>
+
+void MeshOptimizer::optimize(std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, const std::vector<MeshLod> &lods,
+	const MeshOptimizeOptions & options, MeshOptimizeReport * report)
+{
+	CPU_TRACE_SCOPE("MeshOptimizer::optimize");
+
+	// Only triangle lists
+	if (indices->size() % 3 != 0)
+	{
+		return;
+	}
+
+	uint32_t vertexCount = static_cast<uint32_t>(vertices->size());
+	auto lodIndices = [indices](const MeshLod &lod)
+	{
+		return std::vector<uint32_t>(indices->begin() + lod.firstIndex, indices->begin() + lod.firstIndex + lod.indexCount);
+	};
+
+	if (report && !lods.empty())
+	{
+		report->before.add(analyzeVertexCache(lodIndices(lods[0]), vertexCount, MESH_VERTEX_CACHE_SIZE));
+	}
+
+	if (options.vertexCache)
+	{
+		for (const auto &lod : lods)
+		{
+			std::vector<uint32_t> range = lodIndices(lod);
+			std::vector<uint32_t> clusters = optimizeVertexCache(&range, vertexCount, MESH_VERTEX_CACHE_SIZE);
+			if (options.overdraw)
+			{
+				optimizeOverdraw(&range, *vertices, clusters);
+			}
+			std::copy(range.begin(), range.end(), indices->begin() + lod.firstIndex);
+		}
+	}
+
+	// Last, it depends on the triangle order (LOD 0 comes first in the indices, so its fetches are the ones kept in order)
+	if (options.vertexFetch)
+	{
+		optimizeVertexFetch(vertices, indices);
+	}
+
+	if (report && !lods.empty())
+	{
+		report->after.add(analyzeVertexCache(lodIndices(lods[0]), static_cast<uint32_t>(vertices->size()), MESH_VERTEX_CACHE_SIZE));
+	}
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexCache(std::vector<uint32_t> *indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+	CPU_TRACE_SCOPE("MeshOptimizer::optimizeVertexCache");
+
+	std::vector<uint32_t> clusters;
+	size_t triangleCount = indices->size() / 3;
+	if (triangleCount == 0)
+	{
+		return clusters;
+	}
+
+	// Triangles using each vertex (offsets into adjacency), and how many of them are still to be emitted
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		liveTriangles[(*indices)[i]]++;
+	}
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	}
+	std::vector<uint32_t> adjacency(adjacencyOffsets[vertexCount]);
+	std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (size_t c = 0; c < 3; c++)
+		{
+			uint32_t v = (*indices)[t * 3 + c];
+			adjacency[adjacencyFill[v]++] = static_cast<uint32_t>(t);
+		}
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);		// Time each vertex last entered the cache
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnds;							// Recently used vertices to go back to when fanning runs out
+	std::vector<uint32_t> candidates;
+
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	uint32_t time = cacheSize + 1;
+	uint32_t cursor = 0;									// Next vertex to look at once there are no dead ends left
+	int64_t fanVertex = 0;
+
+	while (fanVertex >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacencyOffsets[fanVertex]; a < adjacencyOffsets[fanVertex + 1]; a++)
+		{
+			uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+
+			for (size_t c = 0; c < 3; c++)
+			{
+				uint32_t v = (*indices)[t * 3 + c];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+
+				// Not in the cache any more: transformed again, enters at the current time
+				if (time - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = time;
+					time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Next fanning vertex: the candidate that stays in the cache longest while its triangles are emitted
+		int64_t nextVertex = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (liveTriangles[v] == 0) continue;
+
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+			{
+				priority = time - cacheTime[v];
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				nextVertex = v;
+			}
+		}
+
+		if (nextVertex < 0)
+		{
+			// Dead end: go back to the most recent vertex with triangles left, otherwise to the next unfinished one in input order
+			while (!deadEnds.empty() && nextVertex < 0)
+			{
+				uint32_t v = deadEnds.back();
+				deadEnds.pop_back();
+				if (liveTriangles[v] > 0)
+				{
+					nextVertex = v;
+				}
+			}
+			while (cursor < vertexCount && nextVertex < 0)
+			{
+				if (liveTriangles[cursor] > 0)
+				{
+					nextVertex = cursor;
+				}
+				cursor++;
+			}
+
+			// A jump, whatever gets emitted next is unrelated to what came before
+			if (nextVertex >= 0)
+			{
+				clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+			}
+		}
+
+		fanVertex = nextVertex;
+	}
+
+	// First fan always starts a cluster
+	clusters.insert(clusters.begin(), 0);
+	clusters.erase(std::unique(clusters.begin(), clusters.end()), clusters.end());
+	if (clusters.back() == output.size() / 3)
+	{
+		clusters.pop_back();
+	}
+
+	indices->swap(output);
+
+	return clusters;
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<uint32_t> *indices, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &clusters)
+{
+	CPU_TRACE_SCOPE("MeshOptimizer::optimizeOverdraw");
+
+	size_t triangleCount = indices->size() / 3;
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	// Area weighted centroid and normal of each cluster, and the centroid of the whole mesh
+	struct Cluster
+	{
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+		glm::vec3 centroid;
+		glm::vec3 normal;
+		float sortKey;
+	};
+	std::vector<Cluster> clusterList(clusters.size());
+
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		Cluster &cluster = clusterList[c];
+		cluster.firstTriangle = clusters[c];
+		cluster.triangleCount = static_cast<uint32_t>((c + 1 < clusters.size() ? clusters[c + 1] : triangleCount) - clusters[c]);
+		cluster.centroid = glm::vec3(0.0f);
+		cluster.normal = glm::vec3(0.0f);
+
+		float clusterArea = 0.0f;
+		for (uint32_t t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; t++)
+		{
+			const glm::vec3 &p0 = vertices[(*indices)[t * 3]].pos;
+			const glm::vec3 &p1 = vertices[(*indices)[t * 3 + 1]].pos;
+			const glm::vec3 &p2 = vertices[(*indices)[t * 3 + 2]].pos;
+
+			// Length of the cross product is twice the area, so it weights both sums
+			glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(areaNormal);
+
+			cluster.centroid += (p0 + p1 + p2) * (area / 3.0f);
+			cluster.normal += areaNormal;
+			clusterArea += area;
+		}
+
+		meshCentroid += cluster.centroid;
+		meshArea += clusterArea;
+		if (clusterArea > 0.0f)
+		{
+			cluster.centroid /= clusterArea;
+		}
+		float normalLength = glm::length(cluster.normal);
+		if (normalLength > 0.0f)
+		{
+			cluster.normal /= normalLength;
+		}
+	}
+	if (meshArea > 0.0f)
+	{
+		meshCentroid /= meshArea;
+	}
+
+	// Clusters facing outwards, far from the center, are the ones most likely to hide others
+	for (auto &cluster : clusterList)
+	{
+		cluster.sortKey = glm::dot(cluster.centroid - meshCentroid, cluster.normal);
+	}
+	std::stable_sort(clusterList.begin(), clusterList.end(), [](const Cluster &a, const Cluster &b)
+	{
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<uint32_t> output;
+	output.reserve(indices->size());
+	for (const auto &cluster : clusterList)
+	{
+		output.insert(output.end(), indices->begin() + cluster.firstTriangle * 3,
+			indices->begin() + (cluster.firstTriangle + cluster.triangleCount) * 3);
+	}
+	indices->swap(output);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex> *vertices, std::vector<uint32_t> *indices)
+{
+	CPU_TRACE_SCOPE("MeshOptimizer::optimizeVertexFetch");
+
+	std::vector<uint32_t> remap(vertices->size(), UINT32_MAX);
+	std::vector<Vertex> output;
+	output.reserve(vertices->size());
+
+	for (uint32_t &index : *indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = static_cast<uint32_t>(output.size());
+			output.push_back((*vertices)[index]);
+		}
+		index = remap[index];
+	}
+	vertices->swap(output);
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats;
+	stats.triangleCount = indices.size() / 3;
+
+	// Time each vertex entered the cache, it has left again once cacheSize others entered after it
+	std::vector<uint64_t> cacheTime(vertexCount, 0);
+	uint64_t time = cacheSize + 1;
+	for (uint32_t index : indices)
+	{
+		if (cacheTime[index] == 0)
+		{
+			stats.vertexCount++;
+		}
+		if (time - cacheTime[index] > cacheSize)
+		{
+			cacheTime[index] = time;
+			time++;
+			stats.transformCount++;
+		}
+	}
+
+	return stats;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Vertex.h"
+#include "MeshSimplifier.h"
+
+// Post-transform vertex cache the optimizer and the statistics assume (FIFO)
+const uint32_t MESH_VERTEX_CACHE_SIZE = 16;
+
+// Stages of MeshOptimizer::optimize, in the order they run
+struct MeshOptimizeOptions
+{
+	bool vertexCache = true;		// Reorder triangles for the post-transform cache (Tipsify)
+	bool overdraw = true;			// Reorder the clusters Tipsify leaves so outward facing ones draw first (needs vertexCache)
+	bool vertexFetch = true;		// Renumber vertices in order of first use, so fetches walk the vertex buffer forwards
+};
+
+// Post-transform cache efficiency of index lists, sums so the meshes of a model can be added up
+struct VertexCacheStats
+{
+	uint64_t triangleCount = 0;
+	uint64_t vertexCount = 0;		// Distinct vertices referenced
+	uint64_t transformCount = 0;	// Cache misses, i.e. vertex shader invocations
+
+	// Average cache miss ratio: transforms per triangle (3 without any reuse, ~0.5 at best)
+	float getAcmr() const
+	{
+		return triangleCount > 0 ? static_cast<float>(transformCount) / triangleCount : 0.0f;
+	}
+	// Average transform to vertex ratio: transforms per vertex (1 at best)
+	float getAtvr() const
+	{
+		return vertexCount > 0 ? static_cast<float>(transformCount) / vertexCount : 0.0f;
+	}
+	void add(const VertexCacheStats &other)
+	{
+		triangleCount += other.triangleCount;
+		vertexCount += other.vertexCount;
+		transformCount += other.transformCount;
+	}
+};
+
+// Cache statistics of meshes before and after optimizing them
+struct MeshOptimizeReport
+{
+	VertexCacheStats before;
+	VertexCacheStats after;
+};
+
+// Reorders triangle lists and vertices for the GPU, without changing what gets drawn
+class MeshOptimizer
+{
+public:
+	// Run the enabled stages, triangles are reordered within each LOD's index range. report (optional) gets the
+	// statistics of LOD 0 before and after added to it.
+	static void optimize(std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, const std::vector<MeshLod> &lods,
+		const MeshOptimizeOptions &options, MeshOptimizeReport *report);
+
+	// Tipsify (Sander, Nehab, Barczak 2007): fans around recently used vertices so they are still in the cache.
+	// Returns the first triangle of each cluster (cut wherever it had to jump to an unrelated part of the mesh).
+	static std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t> *indices, uint32_t vertexCount, uint32_t cacheSize);
+	// Sort clusters by how far they face away from the mesh center, so surfaces likely to occlude others draw first.
+	// Triangles inside a cluster keep their order, so the cache efficiency is mostly kept.
+	static void optimizeOverdraw(std::vector<uint32_t> *indices, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &clusters);
+	// Renumber vertices in order of first use by the indices, dropping the ones never used
+	static void optimizeVertexFetch(std::vector<Vertex> *vertices, std::vector<uint32_t> *indices);
+
+	// Simulate a FIFO cache of cacheSize over the indices
+	static VertexCacheStats analyzeVertexCache(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize);
+};
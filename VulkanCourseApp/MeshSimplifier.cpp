@@ -0,0 +1,329 @@
+#include "MeshSimplifier.h"
+#include "CpuTracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+
+// Sum of squared distances to a set of planes, weighted by the area of the triangles they came from
+struct Quadric
+{
+	double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+	double weight = 0;
+
+	void addPlane(double a, double b, double c, double d, double w)
+	{
+		a2 += w * a * a; b2 += w * b * b; c2 += w * c * c;
+		ab += w * a * b; ac += w * a * c; bc += w * b * c;
+		ad += w * a * d; bd += w * b * d; cd += w * c * d;
+		d2 += w * d * d;
+		weight += w;
+	}
+
+	void add(const Quadric &other)
+	{
+		a2 += other.a2; b2 += other.b2; c2 += other.c2;
+		ab += other.ab; ac += other.ac; bc += other.bc;
+		ad += other.ad; bd += other.bd; cd += other.cd;
+		d2 += other.d2;
+		weight += other.weight;
+	}
+
+	// Mean squared distance of p to the planes
+	double evaluate(const glm::vec3 &p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double sum = a2 * x * x + b2 * y * y + c2 * z * z
+			+ 2 * (ab * x * y + ac * x * z + bc * y * z)
+			+ 2 * (ad * x + bd * y + cd * z) + d2;
+		return weight > 0 ? std::max(sum, 0.0) / weight : 0.0;
+	}
+};
+
+struct Collapse
+{
+	uint32_t from;
+	uint32_t to;
+	double cost;									// Mean squared distance, orders the collapses
+};
+
+// Largest distance of p to any of the planes (a, b, c, d), the error a collapse is accepted and reported by
+static float maxPlaneDistance(const std::vector<glm::vec4> &planes, const std::vector<uint32_t> &planeIndices, const glm::vec3 &p)
+{
+	float distance = 0.0f;
+	for (uint32_t plane : planeIndices)
+	{
+		distance = std::max(distance, std::abs(glm::dot(glm::vec3(planes[plane]), p) + planes[plane].w));
+	}
+	return distance;
+}
+
+std::vector<uint32_t> MeshSimplifier::simplify(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+	size_t targetIndexCount, float maxError, float *resultError)
+{
+	CPU_TRACE_SCOPE("MeshSimplifier::simplify");
+
+	*resultError = 0.0f;
+	std::vector<uint32_t> result = indices;
+	if (indices.size() % 3 != 0)
+	{
+		return result;
+	}
+
+	uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+
+	// Quadric of every vertex from the planes of the triangles around it. The planes themselves are kept too, a vertex
+	// gathers those of every vertex collapsed onto it, so the error of a collapse is the distance to the farthest one.
+	std::vector<Quadric> quadrics(vertexCount);
+	std::vector<glm::vec4> planes;
+	std::vector<std::vector<uint32_t>> vertexPlanes(vertexCount);
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		const glm::vec3 &p0 = vertices[indices[i]].pos;
+		const glm::vec3 &p1 = vertices[indices[i + 1]].pos;
+		const glm::vec3 &p2 = vertices[indices[i + 2]].pos;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f) continue;
+		normal /= length;
+
+		double d = -glm::dot(normal, p0);
+		for (size_t c = 0; c < 3; c++)
+		{
+			quadrics[indices[i + c]].addPlane(normal.x, normal.y, normal.z, d, length * 0.5);
+			vertexPlanes[indices[i + c]].push_back(static_cast<uint32_t>(planes.size()));
+		}
+		planes.push_back(glm::vec4(normal, static_cast<float>(d)));
+	}
+
+	// Vertices on an edge used by one triangle (border or UV seam) or more than two (non-manifold) never move
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::unordered_map<uint64_t, uint32_t> edgeUses;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (size_t c = 0; c < 3; c++)
+			{
+				uint32_t a = indices[i + c];
+				uint32_t b = indices[i + (c + 1) % 3];
+				edgeUses[static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b)]++;
+			}
+		}
+		for (const auto &edge : edgeUses)
+		{
+			if (edge.second != 2)
+			{
+				locked[static_cast<uint32_t>(edge.first >> 32)] = true;
+				locked[static_cast<uint32_t>(edge.first)] = true;
+			}
+		}
+	}
+
+	// Mean squared distance is never above the largest squared distance, so nothing past maxCost can be accepted
+	double maxCost = static_cast<double>(maxError) * maxError;
+	float resultDistance = 0.0f;
+	std::vector<uint32_t> mergedPlanes;
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> remap(vertexCount);
+
+	// Passes of independent collapses, cheapest first, until the target is met or nothing is cheap enough any more
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3;
+
+		// Triangles around each vertex
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (uint32_t index : result)
+		{
+			adjacencyOffsets[index + 1]++;
+		}
+		std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+		adjacency.resize(result.size());
+		std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			adjacency[adjacencyFill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// Every edge direction once (an interior edge appears in opposite directions in its two triangles)
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (size_t c = 0; c < 3; c++)
+			{
+				uint32_t from = result[i + c];
+				uint32_t to = result[i + (c + 1) % 3];
+				if (locked[from]) continue;
+
+				Quadric quadric = quadrics[from];
+				quadric.add(quadrics[to]);
+				collapses.push_back({ from, to, quadric.evaluate(vertices[to].pos) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t targetTriangles = targetIndexCount / 3;
+		size_t collapseCount = 0;
+		for (const auto &collapse : collapses)
+		{
+			if (triangleCount <= targetTriangles || collapse.cost > maxCost) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			// Reject collapses that flip a triangle that stays
+			bool flips = false;
+			size_t removedTriangles = 0;
+			const glm::vec3 &newPosition = vertices[collapse.to].pos;
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++)
+			{
+				const uint32_t *triangle = &result[adjacency[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					removedTriangles++;
+					continue;
+				}
+
+				glm::vec3 positions[3] = { vertices[triangle[0]].pos, vertices[triangle[1]].pos, vertices[triangle[2]].pos };
+				glm::vec3 oldNormal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+				for (size_t c = 0; c < 3; c++)
+				{
+					if (triangle[c] == collapse.from)
+					{
+						positions[c] = newPosition;
+					}
+				}
+				glm::vec3 newNormal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+				flips = glm::dot(oldNormal, newNormal) <= 0.0f;
+			}
+			if (flips) continue;
+
+			// Planes of both vertices, the surface around either of them ends up at the new position
+			mergedPlanes.clear();
+			std::set_union(vertexPlanes[collapse.from].begin(), vertexPlanes[collapse.from].end(),
+				vertexPlanes[collapse.to].begin(), vertexPlanes[collapse.to].end(), std::back_inserter(mergedPlanes));
+			float distance = maxPlaneDistance(planes, mergedPlanes, newPosition);
+			if (distance > maxError) continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			vertexPlanes[collapse.to].swap(mergedPlanes);
+			std::vector<uint32_t>().swap(vertexPlanes[collapse.from]);
+			triangleCount -= removedTriangles;
+			resultDistance = std::max(resultDistance, distance);
+			collapseCount++;
+
+			// Everything around the collapse changed, so nothing else there collapses in this pass
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++)
+			{
+				const uint32_t *triangle = &result[adjacency[a] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+			}
+		}
+
+		if (collapseCount == 0) break;
+
+		// Apply the collapses and drop the triangles that became degenerate
+		size_t writeIndex = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = remap[result[i]];
+			uint32_t b = remap[result[i + 1]];
+			uint32_t c = remap[result[i + 2]];
+			if (a == b || b == c || a == c) continue;
+
+			result[writeIndex++] = a;
+			result[writeIndex++] = b;
+			result[writeIndex++] = c;
+		}
+		result.resize(writeIndex);
+	}
+
+	*resultError = resultDistance;
+	return result;
+}
+
+std::vector<MeshLod> MeshSimplifier::buildLods(const std::vector<Vertex> &vertices, std::vector<uint32_t> *indices)
+{
+	CPU_TRACE_SCOPE("MeshSimplifier::buildLods");
+
+	std::vector<MeshLod> lods;
+	lods.push_back({ 0, static_cast<uint32_t>(indices->size()), 0.0f });
+	if (indices->size() % 3 != 0)
+	{
+		return lods;
+	}
+
+	// Every LOD is simplified from the full mesh, so its error is relative to what it stands in for
+	std::vector<uint32_t> fullMesh = *indices;
+	float maxError = computeBoundingSphere(vertices).radius * MESH_LOD_MAX_ERROR;
+	float targetRatio = 1.0f;
+
+	for (uint32_t lod = 1; lod < MESH_MAX_LODS; lod++)
+	{
+		targetRatio *= MESH_LOD_REDUCTION;
+		size_t targetTriangles = static_cast<size_t>(fullMesh.size() / 3 * targetRatio);
+		if (targetTriangles < MESH_LOD_MIN_TRIANGLES) break;
+
+		float error;
+		std::vector<uint32_t> lodIndices = simplify(vertices, fullMesh, targetTriangles * 3, maxError, &error);
+
+		// Not worth another draw range if the error bound (or locked borders) stopped it early
+		if (lodIndices.size() > lods.back().indexCount * MESH_LOD_MIN_REDUCTION) break;
+
+		lods.push_back({ static_cast<uint32_t>(indices->size()), static_cast<uint32_t>(lodIndices.size()), std::max(error, lods.back().error) });
+		indices->insert(indices->end(), lodIndices.begin(), lodIndices.end());
+	}
+
+	return lods;
+}
+
+BoundingSphere MeshSimplifier::computeBoundingSphere(const std::vector<Vertex> &vertices)
+{
+	BoundingSphere bounds = { glm::vec3(0.0f), 0.0f };
+	if (vertices.empty())
+	{
+		return bounds;
+	}
+
+	// Centre of the bounding box, not the smallest sphere but close enough for picking LODs
+	BoundingBox box = computeBoundingBox(vertices);
+	bounds.center = (box.minimum + box.maximum) * 0.5f;
+
+	float radiusSquared = 0.0f;
+	for (const auto &vertex : vertices)
+	{
+		glm::vec3 offset = vertex.pos - bounds.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	bounds.radius = std::sqrt(radiusSquared);
+
+	return bounds;
+}
+
+BoundingBox MeshSimplifier::computeBoundingBox(const std::vector<Vertex> &vertices)
+{
+	BoundingBox box = { glm::vec3(0.0f), glm::vec3(0.0f) };
+	if (vertices.empty())
+	{
+		return box;
+	}
+
+	box.minimum = vertices[0].pos;
+	box.maximum = vertices[0].pos;
+	for (const auto &vertex : vertices)
+	{
+		box.minimum = glm::min(box.minimum, vertex.pos);
+		box.maximum = glm::max(box.maximum, vertex.pos);
+	}
+
+	return box;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Vertex.h"
+
+// Level of detail chain every mesh gets on import
+const uint32_t MESH_MAX_LODS = 4;						// Including LOD 0, the full mesh
+const float MESH_LOD_REDUCTION = 0.5f;					// Triangles each LOD aims for, relative to the one before
+const float MESH_LOD_MIN_REDUCTION = 0.8f;				// Fewer triangles than this relative to the one before, or the chain stops
+const float MESH_LOD_MAX_ERROR = 0.05f;					// Largest error of any LOD, relative to the mesh's bounding sphere radius
+const uint32_t MESH_LOD_MIN_TRIANGLES = 64;				// Meshes this small aren't simplified further
+
+// Range of a mesh's indices drawing one level of detail (relative to the mesh's first index)
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;										// Distance the surface may be off from LOD 0, in object space
+};
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// Axis aligned, in object space
+struct BoundingBox
+{
+	glm::vec3 minimum;
+	glm::vec3 maximum;
+};
+
+// Quadric error metric edge collapse (Garland, Heckbert 1997) restricted to collapsing a vertex onto a neighbour, so
+// simplified meshes only reference vertices of the original one and every LOD shares one vertex buffer.
+class MeshSimplifier
+{
+public:
+	// Indices of a version of the mesh with about targetIndexCount indices, or as close as it gets without any collapse
+	// costing more than maxError. Borders (in index space, which includes UV seams) keep all their vertices.
+	// The error of a collapse is the distance of the vertex it keeps to the farthest plane of the original triangles
+	// the two vertices stand in for, in object space (not the area weighted mean of the quadric, which orders them).
+	// resultError: largest error of the collapses done
+	static std::vector<uint32_t> simplify(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+		size_t targetIndexCount, float maxError, float *resultError);
+
+	// Append the LODs of the triangle list in indices to it, each simplified from the full mesh.
+	// Returns LOD 0 (the original indices) followed by every LOD generated.
+	static std::vector<MeshLod> buildLods(const std::vector<Vertex> &vertices, std::vector<uint32_t> *indices);
+
+	// Sphere is centred on the bounding box
+	static BoundingSphere computeBoundingSphere(const std::vector<Vertex> &vertices);
+	static BoundingBox computeBoundingBox(const std::vector<Vertex> &vertices);
+};
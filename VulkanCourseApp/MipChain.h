@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Number of levels in a full mip chain, down to 1x1
+static uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t mipLevels = 1;
+	while ((width | height) >> mipLevels)
+	{
+		mipLevels++;
+	}
+	return mipLevels;
+}
+
+// Bytes of an RGBA8 mip chain with all levels packed one after the other
+static size_t getMipChainSize(uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	size_t size = 0;
+	for (uint32_t level = 0; level < mipLevels; level++)
+	{
+		size += static_cast<size_t>(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * 4;
+	}
+	return size;
+}
+
+// Fill the lower levels of an RGBA8 mip chain on the CPU (2x2 box filter), level 0 must already be at the start of mipChain
+// and the other levels are written after it, packed one after the other. Only used when the GPU can't blit the texture format.
+static void buildMipChain(uint8_t *mipChain, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	size_t srcOffset = 0;
+	size_t dstOffset = static_cast<size_t>(width) * height * 4;
+	for (uint32_t level = 1; level < mipLevels; level++)
+	{
+		uint32_t dstWidth = std::max(width / 2, 1u);
+		uint32_t dstHeight = std::max(height / 2, 1u);
+
+		for (uint32_t y = 0; y < dstHeight; y++)
+		{
+			// Odd sizes: last row/column is averaged with itself
+			uint32_t y0 = std::min(y * 2, height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, height - 1);
+			for (uint32_t x = 0; x < dstWidth; x++)
+			{
+				uint32_t x0 = std::min(x * 2, width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, width - 1);
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					uint32_t sum = mipChain[srcOffset + (static_cast<size_t>(y0) * width + x0) * 4 + c]
+						+ mipChain[srcOffset + (static_cast<size_t>(y0) * width + x1) * 4 + c]
+						+ mipChain[srcOffset + (static_cast<size_t>(y1) * width + x0) * 4 + c]
+						+ mipChain[srcOffset + (static_cast<size_t>(y1) * width + x1) * 4 + c];
+					mipChain[dstOffset + (static_cast<size_t>(y) * dstWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+
+		srcOffset = dstOffset;
+		dstOffset += static_cast<size_t>(dstWidth) * dstHeight * 4;
+		width = dstWidth;
+		height = dstHeight;
+	}
+}
@@ -0,0 +1,100 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+
+void RenderQueueStats::add(const RenderQueueStats &other)
+{
+	drawCount += other.drawCount;
+	bindCount += other.bindCount;
+	redundantBinds += other.redundantBinds;
+}
+
+RenderQueue::RenderQueue()
+{
+}
+
+void RenderQueue::clear()
+{
+	draws.clear();
+	keys.clear();
+	order.clear();
+}
+
+void RenderQueue::push(const RenderDraw &draw, float depth)
+{
+	keys.push_back(makeKey(draw.pipeline, static_cast<uint32_t>(draw.texId), static_cast<uint32_t>(draw.geometryPage), depth));
+	order.push_back(static_cast<uint32_t>(draws.size()));
+	draws.push_back(draw);
+}
+
+void RenderQueue::sort()
+{
+	size_t count = keys.size();
+	if (count < 2) return;
+
+	// Histograms of all 8 bytes in one go
+	std::vector<uint32_t> counts(8 * 256, 0);
+	for (uint64_t key : keys)
+	{
+		for (int byte = 0; byte < 8; byte++)
+		{
+			counts[byte * 256 + ((key >> (byte * 8)) & 0xFF)]++;
+		}
+	}
+
+	scratchKeys.resize(count);
+	scratchOrder.resize(count);
+	for (int byte = 0; byte < 8; byte++)
+	{
+		uint32_t *byteCounts = &counts[byte * 256];
+
+		// Every key has the same byte here, this pass wouldn't move anything
+		if (byteCounts[(keys[0] >> (byte * 8)) & 0xFF] == count) continue;
+
+		// Counts to offsets
+		uint32_t offset = 0;
+		for (int i = 0; i < 256; i++)
+		{
+			uint32_t byteCount = byteCounts[i];
+			byteCounts[i] = offset;
+			offset += byteCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t destination = byteCounts[(keys[i] >> (byte * 8)) & 0xFF]++;
+			scratchKeys[destination] = keys[i];
+			scratchOrder[destination] = order[i];
+		}
+		keys.swap(scratchKeys);
+		order.swap(scratchOrder);
+	}
+}
+
+size_t RenderQueue::getCount()
+{
+	return keys.size();
+}
+
+const RenderDraw &RenderQueue::getDraw(size_t index)
+{
+	return draws[order[index]];
+}
+
+uint64_t RenderQueue::makeKey(uint32_t pipeline, uint32_t texture, uint32_t geometryPage, float depth)
+{
+	// Front to back: nearer draws get smaller keys
+	uint32_t depthMax = (1u << RENDER_QUEUE_DEPTH_BITS) - 1;
+	float normalizedDepth = std::min(std::max(depth / RENDER_QUEUE_DEPTH_RANGE, 0.0f), 1.0f);
+	uint64_t quantizedDepth = static_cast<uint64_t>(normalizedDepth * depthMax);
+
+	uint64_t key = pipeline & ((1u << RENDER_QUEUE_PIPELINE_BITS) - 1);
+	key = (key << RENDER_QUEUE_TEXTURE_BITS) | (texture & ((1u << RENDER_QUEUE_TEXTURE_BITS) - 1));
+	key = (key << RENDER_QUEUE_PAGE_BITS) | (geometryPage & ((1u << RENDER_QUEUE_PAGE_BITS) - 1));
+	key = (key << RENDER_QUEUE_DEPTH_BITS) | quantizedDepth;
+	return key;
+}
+
+RenderQueue::~RenderQueue()
+{
+}
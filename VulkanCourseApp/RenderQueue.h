@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sort key layout, most significant first: pipeline | texture | geometry page | depth
+const uint32_t RENDER_QUEUE_PIPELINE_BITS = 8;
+const uint32_t RENDER_QUEUE_TEXTURE_BITS = 16;
+const uint32_t RENDER_QUEUE_PAGE_BITS = 16;
+const uint32_t RENDER_QUEUE_DEPTH_BITS = 24;
+
+// View depth mapped onto the depth bits, anything further sorts as if it were at this depth
+const float RENDER_QUEUE_DEPTH_RANGE = 1000.0f;
+
+// Everything one indexed draw needs, the state fields are what the key is made of
+struct RenderDraw
+{
+	uint32_t pipeline;
+	int texId;
+	int geometryPage;
+	uint32_t indexCount;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+};
+
+// Binds made while recording draws from the queue, and the ones sorting saved
+struct RenderQueueStats
+{
+	uint32_t drawCount = 0;
+	uint32_t bindCount = 0;						// Descriptor set and vertex/index buffer binds recorded
+	uint32_t redundantBinds = 0;				// Binds a recording rebinding everything for every draw would have made on top
+
+	void add(const RenderQueueStats &other);
+};
+
+// Draws of a pass sorted by 64 bit keys, so draws sharing state end up next to each other (and opaque draws front to back
+// within the same state), and recording only binds what changes from one draw to the next
+class RenderQueue
+{
+public:
+	RenderQueue();
+
+	void clear();
+	// depth: distance in front of the camera
+	void push(const RenderDraw &draw, float depth);
+	// LSD radix sort, a byte per pass (passes where every key has the same byte are skipped), stable for equal keys
+	void sort();
+
+	size_t getCount();
+	// In sorted order once sorted
+	const RenderDraw &getDraw(size_t index);
+
+	static uint64_t makeKey(uint32_t pipeline, uint32_t texture, uint32_t geometryPage, float depth);
+
+	~RenderQueue();
+
+private:
+	std::vector<RenderDraw> draws;
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> order;				// Draw of each key
+
+	// Other half of each radix pass, kept between frames
+	std::vector<uint64_t> scratchKeys;
+	std::vector<uint32_t> scratchOrder;
+};
@@ -0,0 +1,126 @@
+#include "SceneBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+SceneBuffer::SceneBuffer()
+{
+}
+
+void SceneBuffer::init(DeviceMemoryAllocator * newAllocator, VkPhysicalDevice physicalDevice, VkDevice newDevice,
+	uint32_t newRegionCount, VkDeviceSize newViewProjectionSize)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	viewProjectionSize = newViewProjectionSize;
+
+	// The transforms range bound as a storage buffer must start at a multiple of the alignment
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	VkDeviceSize alignment = std::max<VkDeviceSize>({ deviceProperties.limits.minUniformBufferOffsetAlignment,
+		deviceProperties.limits.minStorageBufferOffsetAlignment, 1 });
+
+	transformOffset = (viewProjectionSize + alignment - 1) / alignment * alignment;
+	maxTransforms = static_cast<uint32_t>(deviceProperties.limits.maxStorageBufferRange / sizeof(glm::mat4));
+
+	regions.resize(newRegionCount);
+	for (auto &region : regions)
+	{
+		createRegion(region, std::min(SCENE_TRANSFORMS_INITIAL_CAPACITY, maxTransforms));
+	}
+}
+
+bool SceneBuffer::reserveTransforms(uint32_t region, uint32_t count)
+{
+	Region &sceneRegion = regions[region];
+	if (count <= sceneRegion.transformCapacity) return false;
+
+	if (count > maxTransforms)
+	{
+		throw std::runtime_error("Failed to grow the Scene Buffer, the Model Transforms don't fit in a Storage Buffer!");
+	}
+
+	// Double, so a growing scene only reallocates a few times. The region's image is idle, so its buffer can go right away.
+	uint32_t transformCapacity = std::max(sceneRegion.transformCapacity, 1u);
+	while (transformCapacity < count)
+	{
+		transformCapacity = static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(transformCapacity) * 2, maxTransforms));
+	}
+
+	destroyRegion(sceneRegion);
+	createRegion(sceneRegion, transformCapacity);
+	return true;
+}
+
+void SceneBuffer::writeViewProjection(uint32_t region, const void * data)
+{
+	write(regions[region], 0, data, viewProjectionSize);
+}
+
+void SceneBuffer::writeTransforms(uint32_t region, const glm::mat4 * transforms, uint32_t first, uint32_t count)
+{
+	if (count == 0) return;
+
+	if (first + count > regions[region].transformCapacity)
+	{
+		throw std::runtime_error("Scene Buffer has no room for more Model Transforms!");
+	}
+
+	write(regions[region], transformOffset + sizeof(glm::mat4) * first, transforms, sizeof(glm::mat4) * count);
+}
+
+VkDescriptorBufferInfo SceneBuffer::getViewProjectionInfo(uint32_t region)
+{
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = regions[region].buffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = viewProjectionSize;
+	return bufferInfo;
+}
+
+VkDescriptorBufferInfo SceneBuffer::getTransformInfo(uint32_t region)
+{
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = regions[region].buffer;
+	bufferInfo.offset = transformOffset;
+	bufferInfo.range = sizeof(glm::mat4) * regions[region].transformCapacity;
+	return bufferInfo;
+}
+
+void SceneBuffer::destroy()
+{
+	for (auto &region : regions)
+	{
+		destroyRegion(region);
+	}
+	regions.clear();
+}
+
+SceneBuffer::~SceneBuffer()
+{
+}
+
+void SceneBuffer::createRegion(Region & region, uint32_t transformCapacity)
+{
+	// Only HOST_VISIBLE is required: non-coherent memory is flushed after each write
+	createBuffer(allocator, device, transformOffset + sizeof(glm::mat4) * transformCapacity,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		&region.buffer, &region.bufferMemory);
+	region.transformCapacity = transformCapacity;
+}
+
+void SceneBuffer::destroyRegion(Region & region)
+{
+	if (region.buffer == VK_NULL_HANDLE) return;
+
+	destroyBuffer(allocator, device, region.buffer, region.bufferMemory);
+	region.buffer = VK_NULL_HANDLE;
+	region.transformCapacity = 0;
+}
+
+void SceneBuffer::write(Region & region, VkDeviceSize offset, const void * data, VkDeviceSize size)
+{
+	memcpy(static_cast<char *>(region.bufferMemory.mapped) + offset, data, static_cast<size_t>(size));
+	allocator->flush(region.bufferMemory, offset, size);
+}
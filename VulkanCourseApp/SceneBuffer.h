@@ -0,0 +1,59 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+
+// Model transforms each region of the scene buffer has room for at first, regions grow as the scene does
+const uint32_t SCENE_TRANSFORMS_INITIAL_CAPACITY = 16 * 1024;
+
+// Persistently mapped buffers, a region per swapchain image, holding the ViewProjection uniform and the model
+// transforms (storage buffer indexed by gl_InstanceIndex). Offsets never change, so recorded command buffers can be
+// resubmitted while only the data is rewritten. A region is only written once its image's last submission has finished,
+// which is also when it is grown: each region is its own buffer, so one image's region is replaced without touching the rest.
+class SceneBuffer
+{
+public:
+	SceneBuffer();
+
+	void init(DeviceMemoryAllocator *newAllocator, VkPhysicalDevice physicalDevice, VkDevice newDevice,
+		uint32_t newRegionCount, VkDeviceSize newViewProjectionSize);
+
+	// Make room for count transforms in the region (doubling its capacity, up to what the device can bind as a storage buffer).
+	// Returns true if the region was replaced: its data is gone and descriptors pointing at it have to be written again.
+	bool reserveTransforms(uint32_t region, uint32_t count);
+
+	void writeViewProjection(uint32_t region, const void *data);
+	// Transforms first..first + count - 1 of the region
+	void writeTransforms(uint32_t region, const glm::mat4 *transforms, uint32_t first, uint32_t count);
+
+	VkDescriptorBufferInfo getViewProjectionInfo(uint32_t region);
+	VkDescriptorBufferInfo getTransformInfo(uint32_t region);
+
+	void destroy();
+
+	~SceneBuffer();
+
+private:
+	DeviceMemoryAllocator *allocator;
+	VkDevice device;
+
+	struct Region
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation bufferMemory;
+		uint32_t transformCapacity = 0;
+	};
+
+	std::vector<Region> regions;
+	VkDeviceSize viewProjectionSize = 0;
+	VkDeviceSize transformOffset = 0;		// Start of the transforms in a region
+	uint32_t maxTransforms = 0;				// Most transforms a single storage buffer binding can hold
+
+	void createRegion(Region &region, uint32_t transformCapacity);
+	void destroyRegion(Region &region);
+	void write(Region &region, VkDeviceSize offset, const void *data, VkDeviceSize size);
+};
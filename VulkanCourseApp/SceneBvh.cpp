@@ -0,0 +1,638 @@
+#include "SceneBvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+static BoundingBox unite(const BoundingBox &a, const BoundingBox &b)
+{
+	return { glm::min(a.minimum, b.minimum), glm::max(a.maximum, b.maximum) };
+}
+
+static float surfaceArea(const BoundingBox &box)
+{
+	glm::vec3 size = box.maximum - box.minimum;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static bool contains(const BoundingBox &outer, const BoundingBox &inner)
+{
+	return outer.minimum.x <= inner.minimum.x && outer.minimum.y <= inner.minimum.y && outer.minimum.z <= inner.minimum.z
+		&& inner.maximum.x <= outer.maximum.x && inner.maximum.y <= outer.maximum.y && inner.maximum.z <= outer.maximum.z;
+}
+
+static BoundingBox enlarge(const BoundingBox &box)
+{
+	glm::vec3 margin = (box.maximum - box.minimum) * SCENE_BVH_FAT_MARGIN;
+	return { box.minimum - margin, box.maximum + margin };
+}
+
+enum FrustumOverlap
+{
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTING,
+	FRUSTUM_INSIDE
+};
+
+static FrustumOverlap classify(const Frustum &frustum, const BoundingBox &box)
+{
+	glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+	glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+
+	FrustumOverlap overlap = FRUSTUM_INSIDE;
+	for (const auto &plane : frustum.planes)
+	{
+		// Signed distance of the centre, and how far the box reaches towards the plane
+		float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		float reach = std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+		if (distance + reach < 0.0f)
+		{
+			return FRUSTUM_OUTSIDE;
+		}
+		if (distance - reach < 0.0f)
+		{
+			overlap = FRUSTUM_INTERSECTING;
+		}
+	}
+	return overlap;
+}
+
+// Slab test, t where the ray enters the box (0 if it starts inside)
+static bool intersectRay(const BoundingBox &box, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, float *enter)
+{
+	float tMin = 0.0f;
+	float tMax = maxDistance;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float t1 = (box.minimum[axis] - origin[axis]) * inverseDirection[axis];
+		float t2 = (box.maximum[axis] - origin[axis]) * inverseDirection[axis];
+		tMin = std::max(tMin, std::min(t1, t2));
+		tMax = std::min(tMax, std::max(t1, t2));
+	}
+
+	*enter = tMin;
+	return tMin <= tMax && tMin < maxDistance;
+}
+
+BoundingBox transformBoundingBox(const glm::mat4 &transform, const BoundingBox &box)
+{
+	glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+	glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+
+	// Each world axis gets the extents projected onto it (Arvo 1990)
+	glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; row++)
+	{
+		worldExtent[row] = std::abs(transform[0][row]) * extent.x + std::abs(transform[1][row]) * extent.y + std::abs(transform[2][row]) * extent.z;
+	}
+
+	return { worldCenter - worldExtent, worldCenter + worldExtent };
+}
+
+SceneBvh::SceneBvh()
+{
+}
+
+void SceneBvh::init()
+{
+	// Rebuilds take a while on big scenes, one thread of their own keeps them from holding up anything else
+	buildThread.init(1);
+}
+
+uint32_t SceneBvh::insert(const BoundingBox &bounds)
+{
+	uint32_t proxy;
+	if (!freeProxies.empty())
+	{
+		proxy = freeProxies.back();
+		freeProxies.pop_back();
+	}
+	else
+	{
+		proxy = static_cast<uint32_t>(proxies.size());
+		proxies.push_back(Proxy());
+	}
+
+	proxies[proxy].bounds = enlarge(bounds);
+	proxies[proxy].alive = true;
+	proxies[proxy].node = insertLeaf(proxy);
+
+	if (building)
+	{
+		changedProxies.push_back(proxy);
+	}
+	return proxy;
+}
+
+void SceneBvh::remove(uint32_t proxy)
+{
+	removeLeaf(proxies[proxy].node);
+	proxies[proxy].node = SCENE_BVH_NULL;
+	proxies[proxy].alive = false;
+	freeProxies.push_back(proxy);
+
+	if (building)
+	{
+		changedProxies.push_back(proxy);
+	}
+}
+
+bool SceneBvh::update(uint32_t proxy, const BoundingBox &bounds)
+{
+	if (contains(proxies[proxy].bounds, bounds))
+	{
+		return false;
+	}
+
+	// Refit: the leaf stays where it is and its ancestors grow around it, rebuilds restore the tree's quality
+	uint32_t leaf = proxies[proxy].node;
+	proxies[proxy].bounds = enlarge(bounds);
+	nodes[leaf].bounds = proxies[proxy].bounds;
+	refitAncestors(nodes[leaf].parent);
+
+	if (building)
+	{
+		changedProxies.push_back(proxy);
+	}
+	return true;
+}
+
+void SceneBvh::maintain()
+{
+	if (building)
+	{
+		if (pendingBuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			adoptRebuild();
+		}
+		return;
+	}
+
+	if (++maintainCount < SCENE_BVH_CHECK_INTERVAL) return;
+	maintainCount = 0;
+
+	// Nothing to improve on with fewer than two leaves
+	if (root == SCENE_BVH_NULL || nodes[root].children[0] == SCENE_BVH_NULL) return;
+
+	if (builtCost < 0.0f || getCost() > builtCost * SCENE_BVH_REBUILD_RATIO)
+	{
+		startRebuild();
+	}
+}
+
+void SceneBvh::queryFrustum(const Frustum &frustum, std::vector<uint32_t> *inside, std::vector<uint32_t> *intersecting)
+{
+	if (root == SCENE_BVH_NULL) return;
+
+	std::vector<uint32_t> stack = { root };
+	while (!stack.empty())
+	{
+		uint32_t index = stack.back();
+		stack.pop_back();
+		const Node &node = nodes[index];
+
+		FrustumOverlap overlap = classify(frustum, node.bounds);
+		if (overlap == FRUSTUM_OUTSIDE)
+		{
+			continue;
+		}
+
+		if (node.children[0] == SCENE_BVH_NULL)
+		{
+			(overlap == FRUSTUM_INSIDE ? inside : intersecting)->push_back(node.proxy);
+		}
+		else if (overlap == FRUSTUM_INSIDE)
+		{
+			// Whole subtree is inside, no more plane tests
+			std::vector<uint32_t> subtree = { index };
+			while (!subtree.empty())
+			{
+				const Node &subtreeNode = nodes[subtree.back()];
+				subtree.pop_back();
+				if (subtreeNode.children[0] == SCENE_BVH_NULL)
+				{
+					inside->push_back(subtreeNode.proxy);
+				}
+				else
+				{
+					subtree.push_back(subtreeNode.children[0]);
+					subtree.push_back(subtreeNode.children[1]);
+				}
+			}
+		}
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(node.children[1]);
+		}
+	}
+}
+
+void SceneBvh::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> *results)
+{
+	if (root == SCENE_BVH_NULL) return;
+
+	std::vector<uint32_t> stack = { root };
+	while (!stack.empty())
+	{
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+
+		// Distance from the centre to the nearest point of the box
+		glm::vec3 offset = glm::max(glm::max(node.bounds.minimum - center, center - node.bounds.maximum), glm::vec3(0.0f));
+		if (glm::dot(offset, offset) > radius * radius)
+		{
+			continue;
+		}
+
+		if (node.children[0] == SCENE_BVH_NULL)
+		{
+			results->push_back(node.proxy);
+		}
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(node.children[1]);
+		}
+	}
+}
+
+float SceneBvh::queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, const std::function<float(uint32_t proxy)> &hitProxy)
+{
+	if (root == SCENE_BVH_NULL) return maxDistance;
+
+	// Zero components get a tiny one instead, so the slabs never see 0 * infinity
+	glm::vec3 inverseDirection;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float component = std::abs(direction[axis]) > 1e-20f ? direction[axis] : std::copysign(1e-20f, direction[axis]);
+		inverseDirection[axis] = 1.0f / component;
+	}
+
+	std::vector<uint32_t> stack = { root };
+	while (!stack.empty())
+	{
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+
+		// Boxes entered beyond the nearest hit so far can't hold a nearer one
+		float enter;
+		if (!intersectRay(node.bounds, origin, inverseDirection, maxDistance, &enter))
+		{
+			continue;
+		}
+
+		if (node.children[0] == SCENE_BVH_NULL)
+		{
+			maxDistance = std::min(maxDistance, hitProxy(node.proxy));
+		}
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(node.children[1]);
+		}
+	}
+	return maxDistance;
+}
+
+float SceneBvh::getCost()
+{
+	if (root == SCENE_BVH_NULL || nodes[root].children[0] == SCENE_BVH_NULL) return 0.0f;
+
+	float rootArea = surfaceArea(nodes[root].bounds);
+	if (rootArea <= 0.0f) return 0.0f;
+
+	// Free nodes look like leaves, so only nodes in the tree are counted
+	float internalArea = 0.0f;
+	for (const auto &node : nodes)
+	{
+		if (node.children[0] != SCENE_BVH_NULL)
+		{
+			internalArea += surfaceArea(node.bounds);
+		}
+	}
+	return internalArea / rootArea;
+}
+
+void SceneBvh::destroy()
+{
+	if (building)
+	{
+		pendingBuild.wait();
+		building = false;
+	}
+	buildThread.destroy();
+
+	nodes.clear();
+	freeNodes.clear();
+	root = SCENE_BVH_NULL;
+	proxies.clear();
+	freeProxies.clear();
+	changedProxies.clear();
+}
+
+SceneBvh::~SceneBvh()
+{
+}
+
+uint32_t SceneBvh::allocateNode()
+{
+	if (!freeNodes.empty())
+	{
+		uint32_t node = freeNodes.back();
+		freeNodes.pop_back();
+		return node;
+	}
+
+	nodes.push_back(Node());
+	return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void SceneBvh::freeNode(uint32_t node)
+{
+	nodes[node] = Node();
+	freeNodes.push_back(node);
+}
+
+uint32_t SceneBvh::insertLeaf(uint32_t proxy)
+{
+	BoundingBox bounds = proxies[proxy].bounds;
+
+	uint32_t leaf = allocateNode();
+	nodes[leaf].bounds = bounds;
+	nodes[leaf].proxy = proxy;
+
+	if (root == SCENE_BVH_NULL)
+	{
+		root = leaf;
+		return leaf;
+	}
+
+	// Walk down to the sibling that adds the least surface area (Goldsmith, Salmon 1987), ancestors of the
+	// new parent all grow to contain the leaf, which every step down has to pay for too
+	uint32_t index = root;
+	while (nodes[index].children[0] != SCENE_BVH_NULL)
+	{
+		float nodeArea = surfaceArea(nodes[index].bounds);
+		float combinedArea = surfaceArea(unite(nodes[index].bounds, bounds));
+
+		float siblingCost = 2.0f * combinedArea;
+		float inheritedCost = 2.0f * (combinedArea - nodeArea);
+
+		float childCosts[2];
+		for (int i = 0; i < 2; i++)
+		{
+			const Node &child = nodes[nodes[index].children[i]];
+			float grownArea = surfaceArea(unite(child.bounds, bounds));
+			childCosts[i] = (child.children[0] == SCENE_BVH_NULL ? grownArea : grownArea - surfaceArea(child.bounds)) + inheritedCost;
+		}
+
+		if (siblingCost <= childCosts[0] && siblingCost <= childCosts[1])
+		{
+			break;
+		}
+		index = childCosts[0] <= childCosts[1] ? nodes[index].children[0] : nodes[index].children[1];
+	}
+
+	// New parent of the sibling and the leaf takes the sibling's place
+	uint32_t sibling = index;
+	uint32_t oldParent = nodes[sibling].parent;
+	uint32_t newParent = allocateNode();
+	nodes[newParent].parent = oldParent;
+	nodes[newParent].bounds = unite(nodes[sibling].bounds, bounds);
+	nodes[newParent].children[0] = sibling;
+	nodes[newParent].children[1] = leaf;
+	nodes[sibling].parent = newParent;
+	nodes[leaf].parent = newParent;
+
+	if (oldParent == SCENE_BVH_NULL)
+	{
+		root = newParent;
+	}
+	else
+	{
+		nodes[oldParent].children[nodes[oldParent].children[0] == sibling ? 0 : 1] = newParent;
+		refitAncestors(oldParent);
+	}
+	return leaf;
+}
+
+void SceneBvh::removeLeaf(uint32_t leaf)
+{
+	if (leaf == root)
+	{
+		root = SCENE_BVH_NULL;
+		freeNode(leaf);
+		return;
+	}
+
+	// Sibling takes the parent's place
+	uint32_t parent = nodes[leaf].parent;
+	uint32_t grandParent = nodes[parent].parent;
+	uint32_t sibling = nodes[parent].children[0] == leaf ? nodes[parent].children[1] : nodes[parent].children[0];
+
+	nodes[sibling].parent = grandParent;
+	if (grandParent == SCENE_BVH_NULL)
+	{
+		root = sibling;
+	}
+	else
+	{
+		nodes[grandParent].children[nodes[grandParent].children[0] == parent ? 0 : 1] = sibling;
+		refitAncestors(grandParent);
+	}
+
+	freeNode(parent);
+	freeNode(leaf);
+}
+
+void SceneBvh::refitAncestors(uint32_t node)
+{
+	while (node != SCENE_BVH_NULL)
+	{
+		nodes[node].bounds = unite(nodes[nodes[node].children[0]].bounds, nodes[nodes[node].children[1]].bounds);
+		node = nodes[node].parent;
+	}
+}
+
+void SceneBvh::startRebuild()
+{
+	// The build thread gets a copy of the leaves, the tree stays usable (and changeable) meanwhile
+	std::vector<BuildLeaf> leaves;
+	for (uint32_t i = 0; i < proxies.size(); i++)
+	{
+		if (proxies[i].alive)
+		{
+			leaves.push_back({ i, proxies[i].bounds, (proxies[i].bounds.minimum + proxies[i].bounds.maximum) * 0.5f });
+		}
+	}
+
+	auto task = std::make_shared<std::packaged_task<BuildResult()>>([leaves]()
+	{
+		return build(leaves);
+	});
+	pendingBuild = task->get_future();
+	buildThread.enqueue([task]() { (*task)(); });
+
+	changedProxies.clear();
+	building = true;
+}
+
+void SceneBvh::adoptRebuild()
+{
+	BuildResult result = pendingBuild.get();
+	building = false;
+
+	nodes = std::move(result.nodes);
+	freeNodes.clear();
+	root = result.root;
+
+	// Leaf of each proxy in the new tree
+	std::vector<uint32_t> leafNodes(proxies.size(), SCENE_BVH_NULL);
+	for (uint32_t i = 0; i < nodes.size(); i++)
+	{
+		if (nodes[i].children[0] == SCENE_BVH_NULL)
+		{
+			leafNodes[nodes[i].proxy] = i;
+		}
+	}
+
+	std::vector<bool> changed(proxies.size(), false);
+	for (uint32_t proxy : changedProxies)
+	{
+		changed[proxy] = true;
+	}
+	changedProxies.clear();
+
+	// Untouched proxies keep the leaf they were built into, changed ones are taken out with their stale bounds and put back in
+	for (uint32_t i = 0; i < proxies.size(); i++)
+	{
+		if (!changed[i])
+		{
+			proxies[i].node = leafNodes[i];
+			continue;
+		}
+
+		if (leafNodes[i] != SCENE_BVH_NULL)
+		{
+			removeLeaf(leafNodes[i]);
+		}
+		proxies[i].node = proxies[i].alive ? insertLeaf(i) : SCENE_BVH_NULL;
+	}
+
+	builtCost = getCost();
+}
+
+SceneBvh::BuildResult SceneBvh::build(std::vector<BuildLeaf> leaves)
+{
+	BuildResult result;
+	if (!leaves.empty())
+	{
+		result.nodes.reserve(2 * leaves.size() - 1);
+		result.root = buildNode(result.nodes, leaves, 0, leaves.size(), SCENE_BVH_NULL);
+	}
+	return result;
+}
+
+uint32_t SceneBvh::buildNode(std::vector<Node> &buildNodes, std::vector<BuildLeaf> &leaves, size_t begin, size_t end, uint32_t parent)
+{
+	uint32_t index = static_cast<uint32_t>(buildNodes.size());
+	buildNodes.push_back(Node());
+	buildNodes[index].parent = parent;
+
+	if (end - begin == 1)
+	{
+		buildNodes[index].bounds = leaves[begin].bounds;
+		buildNodes[index].proxy = leaves[begin].proxy;
+		return index;
+	}
+
+	BoundingBox bounds = leaves[begin].bounds;
+	BoundingBox centroidBounds = { leaves[begin].centroid, leaves[begin].centroid };
+	for (size_t i = begin + 1; i < end; i++)
+	{
+		bounds = unite(bounds, leaves[i].bounds);
+		centroidBounds = unite(centroidBounds, { leaves[i].centroid, leaves[i].centroid });
+	}
+	buildNodes[index].bounds = bounds;
+
+	// Cheapest split between centroid bins on any axis: leaves on each side times the area of their bounds
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidBounds.maximum[axis] - centroidBounds.minimum[axis];
+		if (extent <= 0.0f) continue;
+
+		float binScale = SCENE_BVH_SAH_BINS / extent;
+		BoundingBox binBounds[SCENE_BVH_SAH_BINS];
+		uint32_t binCounts[SCENE_BVH_SAH_BINS] = {};
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t bin = std::min(static_cast<uint32_t>((leaves[i].centroid[axis] - centroidBounds.minimum[axis]) * binScale), SCENE_BVH_SAH_BINS - 1);
+			binBounds[bin] = binCounts[bin] == 0 ? leaves[i].bounds : unite(binBounds[bin], leaves[i].bounds);
+			binCounts[bin]++;
+		}
+
+		// Right side of each split (split i: bins i.. on the right)
+		float rightAreas[SCENE_BVH_SAH_BINS];
+		uint32_t rightCounts[SCENE_BVH_SAH_BINS];
+		BoundingBox side;
+		uint32_t sideCount = 0;
+		for (uint32_t i = SCENE_BVH_SAH_BINS - 1; i > 0; i--)
+		{
+			if (binCounts[i] > 0)
+			{
+				side = sideCount == 0 ? binBounds[i] : unite(side, binBounds[i]);
+				sideCount += binCounts[i];
+			}
+			rightAreas[i] = sideCount > 0 ? surfaceArea(side) : 0.0f;
+			rightCounts[i] = sideCount;
+		}
+
+		sideCount = 0;
+		for (uint32_t i = 0; i + 1 < SCENE_BVH_SAH_BINS; i++)
+		{
+			if (binCounts[i] > 0)
+			{
+				side = sideCount == 0 ? binBounds[i] : unite(side, binBounds[i]);
+				sideCount += binCounts[i];
+			}
+			if (sideCount == 0 || rightCounts[i + 1] == 0) continue;
+
+			float cost = sideCount * surfaceArea(side) + rightCounts[i + 1] * rightAreas[i + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i + 1;
+			}
+		}
+	}
+
+	size_t middle;
+	if (bestAxis >= 0)
+	{
+		float binScale = SCENE_BVH_SAH_BINS / (centroidBounds.maximum[bestAxis] - centroidBounds.minimum[bestAxis]);
+		middle = std::partition(leaves.begin() + begin, leaves.begin() + end, [&](const BuildLeaf &leaf)
+		{
+			uint32_t bin = std::min(static_cast<uint32_t>((leaf.centroid[bestAxis] - centroidBounds.minimum[bestAxis]) * binScale), SCENE_BVH_SAH_BINS - 1);
+			return bin < bestSplit;
+		}) - leaves.begin();
+	}
+	else
+	{
+		// All centroids in one spot, any split is as good as another
+		middle = (begin + end) / 2;
+	}
+
+	uint32_t left = buildNode(buildNodes, leaves, begin, middle, index);
+	uint32_t right = buildNode(buildNodes, leaves, middle, end, index);
+	buildNodes[index].children[0] = left;
+	buildNodes[index].children[1] = right;
+	return index;
+}
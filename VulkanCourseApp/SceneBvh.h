@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "MeshSimplifier.h"
+#include "ThreadPool.h"
+
+const uint32_t SCENE_BVH_NULL = 0xFFFFFFFF;
+
+// Leaf bounds are enlarged by this fraction of their size on each side, so small moves don't touch the tree
+const float SCENE_BVH_FAT_MARGIN = 0.1f;
+
+// Tree quality is checked every this many maintain calls, and rebuilt once its SAH cost is this much worse than after the last build
+const uint32_t SCENE_BVH_CHECK_INTERVAL = 64;
+const float SCENE_BVH_REBUILD_RATIO = 1.25f;
+
+// Binned SAH build: centroid bins per axis
+const uint32_t SCENE_BVH_SAH_BINS = 12;
+
+// World space box around a box transformed by transform
+BoundingBox transformBoundingBox(const glm::mat4 &transform, const BoundingBox &box);
+
+// Dynamic bounding volume hierarchy over world space boxes (one leaf per proxy). Inserts pick their place by the surface
+// area heuristic, moves only refit the leaf's ancestors, and the tree is rebuilt with a binned SAH build on a background
+// thread whenever refits have made it noticeably worse. Proxy ids are reused and stay small, so they can index arrays.
+class SceneBvh
+{
+public:
+	SceneBvh();
+
+	void init();
+
+	uint32_t insert(const BoundingBox &bounds);
+	void remove(uint32_t proxy);
+	// Refit after a move, returns false if the proxy's enlarged bounds still contain the new ones (nothing changed)
+	bool update(uint32_t proxy, const BoundingBox &bounds);
+
+	// Once per frame: adopts a finished rebuild, and starts one when the tree got worse
+	void maintain();
+
+	// Proxies whose (enlarged) bounds are completely inside the frustum, and those that only intersect it
+	void queryFrustum(const Frustum &frustum, std::vector<uint32_t> *inside, std::vector<uint32_t> *intersecting);
+	// Proxies whose (enlarged) bounds overlap the sphere
+	void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> *results);
+	// Calls hitProxy for every proxy whose (enlarged) bounds the ray origin + t * direction, 0 <= t < maxDistance, enters.
+	// hitProxy returns t of the object's actual hit (maxDistance or more for a miss), later proxies only have to beat the nearest one.
+	// Returns the nearest t, or maxDistance if nothing was hit.
+	float queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, const std::function<float(uint32_t proxy)> &hitProxy);
+
+	// Sum of the surface areas of the internal nodes relative to the root's, what queries cost roughly
+	float getCost();
+
+	// Waits for a running rebuild
+	void destroy();
+
+	~SceneBvh();
+
+private:
+	struct Node
+	{
+		BoundingBox bounds;
+		uint32_t parent = SCENE_BVH_NULL;
+		uint32_t children[2] = { SCENE_BVH_NULL, SCENE_BVH_NULL };	// Both SCENE_BVH_NULL for leaves
+		uint32_t proxy = SCENE_BVH_NULL;							// Leaves only
+	};
+
+	struct Proxy
+	{
+		BoundingBox bounds;				// Enlarged
+		uint32_t node = SCENE_BVH_NULL;
+		bool alive = false;
+	};
+
+	struct BuildLeaf
+	{
+		uint32_t proxy;
+		BoundingBox bounds;
+		glm::vec3 centroid;
+	};
+
+	struct BuildResult
+	{
+		std::vector<Node> nodes;
+		uint32_t root = SCENE_BVH_NULL;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+	uint32_t root = SCENE_BVH_NULL;
+
+	std::vector<Proxy> proxies;
+	std::vector<uint32_t> freeProxies;
+
+	// Background rebuild, of a snapshot of the leaves. Proxies changed meanwhile are put back in after the new tree is adopted.
+	ThreadPool buildThread;
+	std::future<BuildResult> pendingBuild;
+	bool building = false;
+	std::vector<uint32_t> changedProxies;
+	uint32_t maintainCount = 0;
+	float builtCost = -1.0f;			// Cost right after the last adopted rebuild (negative: never rebuilt)
+
+	uint32_t allocateNode();
+	void freeNode(uint32_t node);
+	uint32_t insertLeaf(uint32_t proxy);
+	void removeLeaf(uint32_t leaf);
+	void refitAncestors(uint32_t node);
+
+	void startRebuild();
+	void adoptRebuild();
+	static BuildResult build(std::vector<BuildLeaf> leaves);
+	static uint32_t buildNode(std::vector<Node> &buildNodes, std::vector<BuildLeaf> &leaves, size_t begin, size_t end, uint32_t parent);
+};
@@ -2,4 +2,7 @@ C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -V shader.frag
 C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -o second_vert.spv -V second.vert
 C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -o second_frag.spv -V second.frag
+C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -o cull_comp.spv -V cull.comp
+C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -DOCCLUSION_CULLING -o cull_occlusion_comp.spv -V cull.comp
+C:/VulkanSDK/1.3.250.1/Bin/glslangValidator.exe -o depth_pyramid_comp.spv -V depth_pyramid.comp
 pause
\ No newline at end of file
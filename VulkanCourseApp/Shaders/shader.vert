@@ -8,20 +8,16 @@ layout (set = 0, binding = 0) uniform UboViewProjection {
 	mat4 view;
 } uboViewProjection;
 
-// NOT IN USE, LEFT FOR REFERENCE
-layout (set = 0, binding = 1) uniform UboModel{
-	mat4 model;
-} uboModel;
-
-layout(push_constant) uniform PushModel {
-	mat4 model;
-} pushModel;
+// Transforms of all models, each draw's firstInstance is the id of the model it belongs to
+layout (set = 0, binding = 1) readonly buffer ModelTransforms {
+	mat4 model[];
+} modelTransforms;
 
 layout (location = 0) out vec3 fragCol;
 layout (location = 1) out vec2 fragTex;
 
 void main() {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * modelTransforms.model[gl_InstanceIndex] * vec4(pos, 1.0);
 	fragCol = col;
 	fragTex = tex;
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+
+TextureCache::TextureCache()
+{
+}
+
+int TextureCache::acquireByPath(const std::string & path)
+{
+	auto found = pathToId.find(path);
+	if (found == pathToId.end())
+	{
+		return -1;
+	}
+
+	entries[found->second].refCount++;
+	return found->second;
+}
+
+int TextureCache::acquireByContent(const std::string & path, uint64_t contentHash)
+{
+	auto found = hashToId.find(contentHash);
+	if (found == hashToId.end())
+	{
+		return -1;
+	}
+
+	CacheEntry &entry = entries[found->second];
+	entry.refCount++;
+	entry.paths.push_back(path);
+	pathToId[path] = found->second;
+	return found->second;
+}
+
+void TextureCache::insert(int id, const std::string & path, uint64_t contentHash)
+{
+	CacheEntry entry;
+	entry.refCount = 1;
+	entry.contentHash = contentHash;
+	entry.paths.push_back(path);
+	entries[id] = entry;
+
+	pathToId[path] = id;
+	hashToId[contentHash] = id;
+}
+
+bool TextureCache::release(int id)
+{
+	auto found = entries.find(id);
+	if (found == entries.end() || found->second.refCount == 0)
+	{
+		return false;
+	}
+
+	if (--found->second.refCount > 0)
+	{
+		return false;
+	}
+
+	// Last reference gone, forget every name of the texture
+	for (const auto &path : found->second.paths)
+	{
+		pathToId.erase(path);
+	}
+	hashToId.erase(found->second.contentHash);
+	entries.erase(found);
+	return true;
+}
+
+uint32_t TextureCache::getRefCount(int id)
+{
+	auto found = entries.find(id);
+	return found == entries.end() ? 0 : found->second.refCount;
+}
+
+size_t TextureCache::getTextureCount()
+{
+	return entries.size();
+}
+
+std::string TextureCache::resolvePath(const std::string & fileName)
+{
+	// Model files may use either separator
+	std::string path = "Textures/" + fileName;
+	std::replace(path.begin(), path.end(), '\\', '/');
+
+	// Drop "./" components and repeated separators
+	std::string resolved;
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find('/', start);
+		if (end == std::string::npos)
+		{
+			end = path.size();
+		}
+
+		std::string component = path.substr(start, end - start);
+		if (!component.empty() && component != ".")
+		{
+			if (!resolved.empty())
+			{
+				resolved += '/';
+			}
+			resolved += component;
+		}
+		start = end + 1;
+	}
+
+	return resolved;
+}
+
+uint64_t TextureCache::hashContent(const std::vector<char>& data)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (char byte : data)
+	{
+		hash ^= static_cast<uint8_t>(byte);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+TextureCache::~TextureCache()
+{
+}
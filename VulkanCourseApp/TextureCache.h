@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Tracks which texture files are already loaded, so a texture shared by several materials or models is only
+// decoded and uploaded once. Lookups are by resolved file path first, then by a hash of the file contents
+// (catches the same image stored under different names). Ids are whatever the renderer uses to find the
+// texture (its descriptor index), the cache only counts references to them.
+class TextureCache
+{
+public:
+	TextureCache();
+
+	// Id of a texture loaded from this path with one more reference taken, or -1
+	int acquireByPath(const std::string &path);
+	// Id of a texture with identical file contents with one more reference taken, or -1. On a hit path
+	// becomes another name for it, so the next lookup of path doesn't need to read the file.
+	int acquireByContent(const std::string &path, uint64_t contentHash);
+
+	// Register a newly loaded texture, holding one reference
+	void insert(int id, const std::string &path, uint64_t contentHash);
+
+	// Drop a reference, returns true if it was the last one (the texture can then be destroyed)
+	bool release(int id);
+
+	uint32_t getRefCount(int id);
+	size_t getTextureCount();
+
+	// Resolved path of a texture file name (same file always maps to the same string)
+	static std::string resolvePath(const std::string &fileName);
+	// 64 bit FNV-1a of the file data
+	static uint64_t hashContent(const std::vector<char> &data);
+
+	~TextureCache();
+
+private:
+	struct CacheEntry
+	{
+		uint32_t refCount = 0;
+		uint64_t contentHash = 0;
+		std::vector<std::string> paths;			// Every path this texture was requested under
+	};
+
+	std::unordered_map<int, CacheEntry> entries;
+	std::unordered_map<std::string, int> pathToId;
+	std::unordered_map<uint64_t, int> hashToId;
+};
@@ -0,0 +1,181 @@
+#include "TextureLoader.h"
+#include "CpuTracer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// Memory the image decoded on this thread should end up in. stb_image allocates its output in one piece, which is
+// handed this memory instead of the heap, so the pixels are decoded straight into staging memory without a copy.
+struct DecodeTarget
+{
+	void *memory = nullptr;
+	size_t minSize = 0;				// Size of the output pixels
+	size_t maxSize = 0;				// Space available (decoders may ask for one byte of padding)
+	bool taken = false;				// Currently handed out to the decoder
+};
+static thread_local DecodeTarget decodeTarget;
+
+static void *decodeMalloc(size_t size)
+{
+	if (decodeTarget.memory && !decodeTarget.taken && size >= decodeTarget.minSize && size <= decodeTarget.maxSize)
+	{
+		decodeTarget.taken = true;
+		return decodeTarget.memory;
+	}
+	return malloc(size);
+}
+
+static void *decodeRealloc(void *pointer, size_t oldSize, size_t newSize)
+{
+	if (pointer && pointer == decodeTarget.memory)
+	{
+		// Target can't grow, move the data to the heap
+		void *moved = malloc(newSize);
+		if (moved)
+		{
+			memcpy(moved, pointer, oldSize < newSize ? oldSize : newSize);
+			decodeTarget.taken = false;
+		}
+		return moved;
+	}
+	return realloc(pointer, newSize);
+}
+
+static void decodeFree(void *pointer)
+{
+	if (pointer && pointer == decodeTarget.memory)
+	{
+		decodeTarget.taken = false;
+		return;
+	}
+	free(pointer);
+}
+
+#define STBI_MALLOC(size) decodeMalloc(size)
+#define STBI_REALLOC_SIZED(pointer, oldSize, newSize) decodeRealloc(pointer, oldSize, newSize)
+#define STBI_FREE(pointer) decodeFree(pointer)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+TextureLoader::TextureLoader()
+{
+}
+
+void TextureLoader::init(uint32_t threadCount)
+{
+	threadPool.init(threadCount);
+}
+
+size_t TextureLoader::decodeAsync(const std::string & fileName, std::vector<char> fileData, void * target, int width, int height,
+	uint32_t mipLevels, bool buildMipChain)
+{
+	size_t job = nextJob++;
+
+	// Task owns the file contents until it is done with them
+	auto sharedData = std::make_shared<std::vector<char>>(std::move(fileData));
+	threadPool.enqueue([this, job, fileName, sharedData, target, width, height, mipLevels, buildMipChain]()
+	{
+		TextureDecode result;
+		result.job = job;
+		result.fileName = fileName;
+		try
+		{
+			decode(fileName, *sharedData, target, width, height, mipLevels, buildMipChain);
+		}
+		catch (const std::exception &e)
+		{
+			result.error = e.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back(result);
+		}
+		decodeFinished.notify_all();
+	});
+
+	return job;
+}
+
+std::vector<TextureDecode> TextureLoader::waitDecoded()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	decodeFinished.wait(lock, [this]() { return !finished.empty(); });
+
+	std::vector<TextureDecode> decoded;
+	decoded.swap(finished);
+	return decoded;
+}
+
+void TextureLoader::destroy()
+{
+	threadPool.destroy();
+	finished.clear();
+}
+
+void TextureLoader::readInfo(const std::string & fileName, const std::vector<char>& fileData, int * width, int * height)
+{
+	int channels;
+	if (!stbi_info_from_memory(reinterpret_cast<const stbi_uc *>(fileData.data()), static_cast<int>(fileData.size()), width, height, &channels))
+	{
+		throw std::runtime_error("Failed to load a Texture file! (" + fileName + ")");
+	}
+}
+
+size_t TextureLoader::getDecodeSize(int width, int height, uint32_t mipLevels, bool buildMipChain)
+{
+	size_t pixelsSize = buildMipChain ? getMipChainSize(width, height, mipLevels) : static_cast<size_t>(width) * height * 4;
+	return pixelsSize + 1;
+}
+
+void TextureLoader::decode(const std::string & fileName, const std::vector<char>& fileData, void * target, int width, int height,
+	uint32_t mipLevels, bool buildMipChain)
+{
+	CPU_TRACE_SCOPE("Decode texture");
+
+	// Level 0 goes to the start of target, however much of it the mip chain needs
+	size_t levelSize = static_cast<size_t>(width) * height * 4;
+	decodeTarget.memory = target;
+	decodeTarget.minSize = levelSize;
+	decodeTarget.maxSize = levelSize + 1;
+	decodeTarget.taken = false;
+
+	// Num of channels image uses
+	int channels;
+	int decodedWidth, decodedHeight;
+
+	// Decode pixel data from the file contents, always expanded to RGBA
+	stbi_uc *pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(fileData.data()), static_cast<int>(fileData.size()),
+		&decodedWidth, &decodedHeight, &channels, STBI_rgb_alpha);
+
+	decodeTarget = DecodeTarget();
+
+	if (!pixels)
+	{
+		throw std::runtime_error("Failed to load a Texture file! (" + fileName + ")");
+	}
+	if (decodedWidth != width || decodedHeight != height)
+	{
+		if (pixels != target) stbi_image_free(pixels);
+		throw std::runtime_error("Texture file changed size while loading! (" + fileName + ")");
+	}
+
+	// Decoder finished in a buffer of its own (e.g. converted between formats at the end)
+	if (pixels != target)
+	{
+		CPU_TRACE_SCOPE("Copy decoded texture");
+		memcpy(target, pixels, levelSize);
+		stbi_image_free(pixels);
+	}
+
+	if (buildMipChain)
+	{
+		CPU_TRACE_SCOPE("buildMipChain");
+		::buildMipChain(static_cast<uint8_t *>(target), width, height, mipLevels);
+	}
+}
+
+TextureLoader::~TextureLoader()
+{
+}
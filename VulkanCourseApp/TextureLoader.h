@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "MipChain.h"
+#include "ThreadPool.h"
+
+// Result of a decode queued with TextureLoader::decodeAsync
+struct TextureDecode
+{
+	size_t job = 0;
+	std::string fileName;
+	std::string error;					// Set if decoding failed
+};
+
+// Decodes texture files as RGBA8 straight into memory given by the caller (mapped staging memory), on a pool of
+// worker threads. Results are collected in the order they finish, so the caller can upload each texture as soon as it is ready.
+class TextureLoader
+{
+public:
+	TextureLoader();
+
+	void init(uint32_t threadCount);
+
+	// Queue file contents for decoding into target, returns the job id the result will carry. target must hold
+	// getDecodeSize() bytes and stay valid until the result has been collected.
+	// buildMipChain: also fill the lower levels after level 0 (GPU can't blit the texture format)
+	size_t decodeAsync(const std::string &fileName, std::vector<char> fileData, void *target, int width, int height,
+		uint32_t mipLevels, bool buildMipChain);
+	// Block until at least one queued decode has finished, then return every finished one
+	std::vector<TextureDecode> waitDecoded();
+
+	void destroy();
+
+	// Size of an image from its file header, without decoding it (throws if the format isn't supported)
+	static void readInfo(const std::string &fileName, const std::vector<char> &fileData, int *width, int *height);
+	// Bytes target needs for a decode (the decoder may write one byte past the pixels)
+	static size_t getDecodeSize(int width, int height, uint32_t mipLevels, bool buildMipChain);
+	// Decode on the calling thread (throws on failure)
+	static void decode(const std::string &fileName, const std::vector<char> &fileData, void *target, int width, int height,
+		uint32_t mipLevels, bool buildMipChain);
+
+	~TextureLoader();
+
+private:
+	ThreadPool threadPool;
+
+	std::mutex mutex;
+	std::condition_variable decodeFinished;
+	std::vector<TextureDecode> finished;
+	size_t nextJob = 0;
+};
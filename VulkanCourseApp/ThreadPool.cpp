@@ -0,0 +1,78 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool()
+{
+}
+
+void ThreadPool::init(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		// hardware_concurrency may report 0 if it can't tell
+		threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	stopping = false;
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	taskAvailable.notify_one();
+}
+
+uint32_t ThreadPool::getThreadCount()
+{
+	return static_cast<uint32_t>(workers.size());
+}
+
+void ThreadPool::destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+ThreadPool::~ThreadPool()
+{
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			// Only stop once everything queued has run
+			if (tasks.empty())
+			{
+				return;
+			}
+
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+
+		task();
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued tasks in submission order
+class ThreadPool
+{
+public:
+	ThreadPool();
+
+	// threadCount 0: one thread per hardware thread, minus the calling one
+	void init(uint32_t threadCount);
+
+	// Tasks must not throw, report failures through whatever they write their results to
+	void enqueue(std::function<void()> task);
+
+	uint32_t getThreadCount();
+
+	// Finishes the tasks already queued, then joins the workers
+	void destroy();
+
+	~ThreadPool();
+
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	std::deque<std::function<void()>> tasks;
+	bool stopping = false;
+
+	void workerLoop();
+};
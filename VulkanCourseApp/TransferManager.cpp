@@ -0,0 +1,600 @@
+#include "TransferManager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+static VkImageMemoryBarrier createMipBarrier(VkImage image, uint32_t baseMipLevel, uint32_t levelCount, VkImageLayout oldLayout,
+	VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcAccessMask = srcAccessMask;
+	barrier.dstAccessMask = dstAccessMask;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = baseMipLevel;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	return barrier;
+}
+
+void UploadBatch::uploadBuffer(const void * data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, bool concurrent)
+{
+	if (size == 0) return;
+
+	BufferCopy bufferCopy;
+	bufferCopy.dstBuffer = dstBuffer;
+
+	// Region of data to copy from and to
+	bufferCopy.region.srcOffset = stage(data, size, &bufferCopy.stagingBuffer);
+	bufferCopy.region.dstOffset = dstOffset;
+	bufferCopy.region.size = size;
+	bufferCopies.push_back(bufferCopy);
+
+	VkBufferMemoryBarrier bufferMemoryBarrier = {};
+	bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferMemoryBarrier.dstAccessMask = dstAccess;
+	bufferMemoryBarrier.buffer = dstBuffer;
+	bufferMemoryBarrier.offset = dstOffset;
+	bufferMemoryBarrier.size = size;
+	bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	if (concurrent)
+	{
+		concurrentBufferBarriers.push_back(bufferMemoryBarrier);
+	}
+	else
+	{
+		bufferBarriers.push_back(bufferMemoryBarrier);
+	}
+
+	dstStages |= dstStage;
+}
+
+void UploadBatch::uploadImage(const void * data, VkDeviceSize size, VkImage dstImage, uint32_t width, uint32_t height,
+	uint32_t mipLevels, bool generateMipmaps)
+{
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset = stage(data, size, &stagingBuffer);
+	recordImageUpload(stagingBuffer, stagingOffset, dstImage, width, height, mipLevels, generateMipmaps);
+}
+
+void * UploadBatch::reserveImage(VkDeviceSize size, VkImage dstImage, uint32_t width, uint32_t height,
+	uint32_t mipLevels, bool generateMipmaps)
+{
+	// Staging buffer of its own, so the batch can be appended to another one whenever the data is ready
+	StagingBuffer staging;
+	staging.size = size;
+	staging.head = size;
+	createBuffer(allocator, device, staging.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging.buffer, &staging.memory);
+
+	// Insert before the current chunk, which other stage() calls keep filling
+	stagingBuffers.insert(stagingBuffers.empty() ? stagingBuffers.end() : stagingBuffers.end() - 1, staging);
+
+	recordImageUpload(staging.buffer, 0, dstImage, width, height, mipLevels, generateMipmaps);
+	return staging.memory.mapped;
+}
+
+void UploadBatch::append(UploadBatch & other)
+{
+	// Other batch's chunks are never filled further, keep the current chunk of this one last
+	stagingBuffers.insert(stagingBuffers.empty() ? stagingBuffers.end() : stagingBuffers.end() - 1,
+		other.stagingBuffers.begin(), other.stagingBuffers.end());
+	bufferCopies.insert(bufferCopies.end(), other.bufferCopies.begin(), other.bufferCopies.end());
+	imageCopies.insert(imageCopies.end(), other.imageCopies.begin(), other.imageCopies.end());
+	mipChains.insert(mipChains.end(), other.mipChains.begin(), other.mipChains.end());
+	bufferBarriers.insert(bufferBarriers.end(), other.bufferBarriers.begin(), other.bufferBarriers.end());
+	concurrentBufferBarriers.insert(concurrentBufferBarriers.end(), other.concurrentBufferBarriers.begin(), other.concurrentBufferBarriers.end());
+	imageBarriers.insert(imageBarriers.end(), other.imageBarriers.begin(), other.imageBarriers.end());
+	dstStages |= other.dstStages;
+
+	other = UploadBatch();
+}
+
+void UploadBatch::recordImageUpload(VkBuffer stagingBuffer, VkDeviceSize stagingOffset, VkImage dstImage, uint32_t width, uint32_t height,
+	uint32_t mipLevels, bool generateMipmaps)
+{
+	generateMipmaps = generateMipmaps && mipLevels > 1;
+	VkDeviceSize levelOffset = stagingOffset;
+
+	// One copy per level held in data
+	uint32_t copiedLevels = generateMipmaps ? 1 : mipLevels;
+	for (uint32_t level = 0; level < copiedLevels; level++)
+	{
+		uint32_t levelWidth = std::max(width >> level, 1u);
+		uint32_t levelHeight = std::max(height >> level, 1u);
+
+		ImageCopy imageCopy = {};
+		imageCopy.stagingBuffer = stagingBuffer;
+		imageCopy.dstImage = dstImage;
+		imageCopy.region.bufferOffset = levelOffset;
+		imageCopy.region.bufferRowLength = 0;										// Row length of data to calculate data spacing
+		imageCopy.region.bufferImageHeight = 0;										// Image height to calculate data spacing
+		imageCopy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageCopy.region.imageSubresource.mipLevel = level;
+		imageCopy.region.imageSubresource.baseArrayLayer = 0;
+		imageCopy.region.imageSubresource.layerCount = 1;
+		imageCopy.region.imageOffset = {0, 0, 0};
+		imageCopy.region.imageExtent.width = levelWidth;							// Whole level, so any minImageTransferGranularity is satisfied
+		imageCopy.region.imageExtent.height = levelHeight;
+		imageCopy.region.imageExtent.depth = 1;
+		imageCopies.push_back(imageCopy);
+
+		levelOffset += static_cast<VkDeviceSize>(levelWidth) * levelHeight * 4;
+	}
+
+	// Transition the copied levels after the copy (done as part of the hand over to the graphics queue)
+	VkImageMemoryBarrier imageMemoryBarrier = {};
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageMemoryBarrier.image = dstImage;
+	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+	imageMemoryBarrier.subresourceRange.levelCount = copiedLevels;
+	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+	imageMemoryBarrier.subresourceRange.layerCount = 1;
+	if (generateMipmaps)
+	{
+		// Level 0 becomes the source of the first blit
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		dstStages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+		MipChain mipChain;
+		mipChain.image = dstImage;
+		mipChain.width = width;
+		mipChain.height = height;
+		mipChain.mipLevels = mipLevels;
+		mipChains.push_back(mipChain);
+	}
+	else
+	{
+		// Shader readable
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dstStages |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	imageBarriers.push_back(imageMemoryBarrier);
+}
+
+bool UploadBatch::isEmpty()
+{
+	return bufferCopies.empty() && imageCopies.empty();
+}
+
+VkDeviceSize UploadBatch::stage(const void * data, VkDeviceSize size, VkBuffer * stagingBuffer)
+{
+	// Keep offsets aligned for buffer to image copies (multiple of texel size and 4)
+	const VkDeviceSize stagingAlignment = 16;
+
+	// Start a new chunk if the data doesn't fit in the current one
+	if (stagingBuffers.empty() || stagingBuffers.back().head + size > stagingBuffers.back().size)
+	{
+		StagingBuffer staging;
+		staging.size = std::max(size, UPLOAD_STAGING_CHUNK_SIZE);
+		staging.head = 0;
+		createBuffer(allocator, device, staging.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging.buffer, &staging.memory);
+		stagingBuffers.push_back(staging);
+	}
+
+	StagingBuffer &staging = stagingBuffers.back();
+	VkDeviceSize offset = staging.head;
+
+	memcpy(static_cast<char *>(staging.memory.mapped) + offset, data, static_cast<size_t>(size));
+	staging.head = (offset + size + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+
+	*stagingBuffer = staging.buffer;
+	return offset;
+}
+
+TransferManager::TransferManager()
+{
+}
+
+void TransferManager::init(DeviceMemoryAllocator * newAllocator, VkDevice newDevice, QueueFamilyIndices queueFamilies,
+	VkQueue newTransferQueue, VkQueue newGraphicsQueue)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	transferFamily = static_cast<uint32_t>(queueFamilies.transferFamily);
+	graphicsFamily = static_cast<uint32_t>(queueFamilies.graphicsFamily);
+	transferQueue = newTransferQueue;
+	graphicsQueue = newGraphicsQueue;
+
+	transferCommandPool = createCommandPool(transferFamily);
+	if (!isSharedQueue())
+	{
+		acquireCommandPool = createCommandPool(graphicsFamily);
+	}
+}
+
+UploadBatch TransferManager::beginBatch()
+{
+	UploadBatch batch;
+	batch.allocator = allocator;
+	batch.device = device;
+	return batch;
+}
+
+TransferTicket TransferManager::submitBatch(UploadBatch & batch)
+{
+	if (batch.isEmpty())
+	{
+		// Nothing to wait for
+		return lastSubmitted;
+	}
+
+	PendingTransfer pending;
+	pending.transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
+	if (!isSharedQueue())
+	{
+		pending.acquireCommandBuffer = beginCommandBuffer(device, acquireCommandPool);
+	}
+
+	// PHASE 1: all images to TRANSFER_DST in one barrier
+	if (!batch.imageCopies.empty())
+	{
+		std::vector<VkImageMemoryBarrier> transferDstBarriers = batch.imageBarriers;
+		for (auto &barrier : transferDstBarriers)
+		{
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		}
+
+		vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, static_cast<uint32_t>(transferDstBarriers.size()), transferDstBarriers.data());
+	}
+
+	// PHASE 2: copies
+	for (auto &bufferCopy : batch.bufferCopies)
+	{
+		vkCmdCopyBuffer(pending.transferCommandBuffer, bufferCopy.stagingBuffer, bufferCopy.dstBuffer, 1, &bufferCopy.region);
+	}
+	for (auto &imageCopy : batch.imageCopies)
+	{
+		vkCmdCopyBufferToImage(pending.transferCommandBuffer, imageCopy.stagingBuffer, imageCopy.dstImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopy.region);
+	}
+
+	// PHASE 3: hand everything over to the graphics queue in one release (and one acquire)
+	recordOwnershipTransfer(pending, batch.dstStages, batch.bufferBarriers, batch.concurrentBufferBarriers, batch.imageBarriers);
+
+	// PHASE 4: blit the lower mip levels, after the acquire since blits need a graphics capable queue
+	if (!batch.mipChains.empty())
+	{
+		recordMipmapGeneration(isSharedQueue() ? pending.transferCommandBuffer : pending.acquireCommandBuffer, batch.mipChains);
+	}
+
+	// Staging buffers now belong to the submission, freed once its fence signals
+	pending.stagingBuffers = std::move(batch.stagingBuffers);
+	batch = UploadBatch();
+
+	submitTransfer(pending);
+	return pending.ticket;
+}
+
+void TransferManager::discardBatch(UploadBatch & batch)
+{
+	// Nothing was recorded from the batch, so no submission can be using its staging buffers
+	for (auto &staging : batch.stagingBuffers)
+	{
+		destroyBuffer(allocator, device, staging.buffer, staging.memory);
+	}
+	batch = UploadBatch();
+}
+
+void TransferManager::update()
+{
+	// Retire in submission order, so every ticket up to lastCompleted is known to be done
+	while (!pendingTransfers.empty() && vkGetFenceStatus(device, pendingTransfers.front().fence) == VK_SUCCESS)
+	{
+		lastCompleted = pendingTransfers.front().ticket;
+		retireTransfer(pendingTransfers.front());
+		pendingTransfers.pop_front();
+	}
+}
+
+bool TransferManager::isComplete(TransferTicket ticket)
+{
+	return ticket <= lastCompleted;
+}
+
+TransferTicket TransferManager::getLastSubmitted()
+{
+	return lastSubmitted;
+}
+
+TransferTicket TransferManager::getLastCompleted()
+{
+	return lastCompleted;
+}
+
+void TransferManager::waitIdle()
+{
+	while (!pendingTransfers.empty())
+	{
+		vkWaitForFences(device, 1, &pendingTransfers.front().fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		update();
+	}
+}
+
+void TransferManager::destroy()
+{
+	waitIdle();
+
+	if (acquireCommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, acquireCommandPool, nullptr);
+		acquireCommandPool = VK_NULL_HANDLE;
+	}
+	if (transferCommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, transferCommandPool, nullptr);
+		transferCommandPool = VK_NULL_HANDLE;
+	}
+}
+
+TransferManager::~TransferManager()
+{
+}
+
+bool TransferManager::isSharedQueue()
+{
+	return transferFamily == graphicsFamily;
+}
+
+VkCommandPool TransferManager::createCommandPool(uint32_t queueFamilyIndex)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;			// Upload command buffers are short lived
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	VkCommandPool commandPool;
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Transfer Command Pool!");
+	}
+
+	return commandPool;
+}
+
+void TransferManager::recordOwnershipTransfer(PendingTransfer & pending, VkPipelineStageFlags dstStage, std::vector<VkBufferMemoryBarrier> bufferBarriers,
+	std::vector<VkBufferMemoryBarrier> concurrentBufferBarriers, std::vector<VkImageMemoryBarrier> imageBarriers)
+{
+	if (isSharedQueue())
+	{
+		bufferBarriers.insert(bufferBarriers.end(), concurrentBufferBarriers.begin(), concurrentBufferBarriers.end());
+
+		// Same queue, a regular barrier makes the writes visible to dstStage
+		for (auto &barrier : bufferBarriers)
+		{
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		}
+		for (auto &barrier : imageBarriers)
+		{
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		}
+
+		vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr,
+			static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+			static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+		return;
+	}
+
+	// Release on the transfer queue: destination access is meaningless here (executed by the acquire)
+	std::vector<VkBufferMemoryBarrier> releaseBufferBarriers = bufferBarriers;
+	std::vector<VkImageMemoryBarrier> releaseImageBarriers = imageBarriers;
+	for (auto &barrier : releaseBufferBarriers)
+	{
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.dstAccessMask = 0;
+	}
+	for (auto &barrier : releaseImageBarriers)
+	{
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.dstAccessMask = 0;
+	}
+
+	vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+		static_cast<uint32_t>(releaseBufferBarriers.size()), releaseBufferBarriers.data(),
+		static_cast<uint32_t>(releaseImageBarriers.size()), releaseImageBarriers.data());
+
+	// Matching acquire on the graphics queue: same families and layouts, source access is covered by the semaphore
+	for (auto &barrier : bufferBarriers)
+	{
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.srcAccessMask = 0;
+	}
+	for (auto &barrier : imageBarriers)
+	{
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.srcAccessMask = 0;
+	}
+
+	// Concurrent buffers have no owner, the semaphore already made their writes visible and they only need ordering
+	for (auto &barrier : concurrentBufferBarriers)
+	{
+		barrier.srcAccessMask = 0;
+		bufferBarriers.push_back(barrier);
+	}
+
+	vkCmdPipelineBarrier(pending.acquireCommandBuffer, dstStage, dstStage, 0, 0, nullptr,
+		static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void TransferManager::recordMipmapGeneration(VkCommandBuffer commandBuffer, const std::vector<UploadBatch::MipChain> &mipChains)
+{
+	// Barriers of every image are merged, so the chain costs one vkCmdPipelineBarrier per level however many textures there are
+	std::vector<VkImageMemoryBarrier> barriers;
+	uint32_t maxMipLevels = 1;
+
+	// Lower levels hold nothing yet: no ownership transfer needed, UNDEFINED discards their contents
+	for (auto &mipChain : mipChains)
+	{
+		barriers.push_back(createMipBarrier(mipChain.image, 1, mipChain.mipLevels - 1, VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT));
+		maxMipLevels = std::max(maxMipLevels, mipChain.mipLevels);
+	}
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	for (uint32_t level = 1; level < maxMipLevels; level++)
+	{
+		// Level just blitted becomes the source of the next one (level 0 arrives as TRANSFER_SRC already)
+		if (level > 1)
+		{
+			barriers.clear();
+			for (auto &mipChain : mipChains)
+			{
+				if (level >= mipChain.mipLevels) continue;
+
+				barriers.push_back(createMipBarrier(mipChain.image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT));
+			}
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+				static_cast<uint32_t>(barriers.size()), barriers.data());
+		}
+
+		for (auto &mipChain : mipChains)
+		{
+			if (level >= mipChain.mipLevels) continue;
+
+			VkImageBlit blit = {};
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = level - 1;
+			blit.srcSubresource.baseArrayLayer = 0;
+			blit.srcSubresource.layerCount = 1;
+			blit.srcOffsets[1].x = static_cast<int32_t>(std::max(mipChain.width >> (level - 1), 1u));
+			blit.srcOffsets[1].y = static_cast<int32_t>(std::max(mipChain.height >> (level - 1), 1u));
+			blit.srcOffsets[1].z = 1;
+			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.dstSubresource.mipLevel = level;
+			blit.dstSubresource.baseArrayLayer = 0;
+			blit.dstSubresource.layerCount = 1;
+			blit.dstOffsets[1].x = static_cast<int32_t>(std::max(mipChain.width >> level, 1u));
+			blit.dstOffsets[1].y = static_cast<int32_t>(std::max(mipChain.height >> level, 1u));
+			blit.dstOffsets[1].z = 1;
+
+			vkCmdBlitImage(commandBuffer, mipChain.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				mipChain.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+		}
+	}
+
+	// Every level shader readable: all but the last were blit sources, the last one was only written
+	barriers.clear();
+	for (auto &mipChain : mipChains)
+	{
+		barriers.push_back(createMipBarrier(mipChain.image, 0, mipChain.mipLevels - 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT));
+		barriers.push_back(createMipBarrier(mipChain.image, mipChain.mipLevels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+	}
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+}
+
+void TransferManager::submitTransfer(PendingTransfer & pending)
+{
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &pending.fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Transfer Fence!");
+	}
+
+	vkEndCommandBuffer(pending.transferCommandBuffer);
+
+	VkSubmitInfo transferSubmitInfo = {};
+	transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	transferSubmitInfo.commandBufferCount = 1;
+	transferSubmitInfo.pCommandBuffers = &pending.transferCommandBuffer;
+
+	if (isSharedQueue())
+	{
+		if (vkQueueSubmit(transferQueue, 1, &transferSubmitInfo, pending.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit Transfer Command Buffer!");
+		}
+	}
+	else
+	{
+		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &pending.transferComplete) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a Transfer Semaphore!");
+		}
+
+		transferSubmitInfo.signalSemaphoreCount = 1;
+		transferSubmitInfo.pSignalSemaphores = &pending.transferComplete;
+
+		if (vkQueueSubmit(transferQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit Transfer Command Buffer!");
+		}
+
+		vkEndCommandBuffer(pending.acquireCommandBuffer);
+
+		// Acquire waits for the copies, fence covers both submissions
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo acquireSubmitInfo = {};
+		acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireSubmitInfo.waitSemaphoreCount = 1;
+		acquireSubmitInfo.pWaitSemaphores = &pending.transferComplete;
+		acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+		acquireSubmitInfo.commandBufferCount = 1;
+		acquireSubmitInfo.pCommandBuffers = &pending.acquireCommandBuffer;
+
+		if (vkQueueSubmit(graphicsQueue, 1, &acquireSubmitInfo, pending.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit Acquire Command Buffer!");
+		}
+	}
+
+	pending.ticket = ++lastSubmitted;
+	pendingTransfers.push_back(pending);
+}
+
+void TransferManager::retireTransfer(PendingTransfer & pending)
+{
+	for (auto &staging : pending.stagingBuffers)
+	{
+		destroyBuffer(allocator, device, staging.buffer, staging.memory);
+	}
+
+	vkFreeCommandBuffers(device, transferCommandPool, 1, &pending.transferCommandBuffer);
+	if (pending.acquireCommandBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeCommandBuffers(device, acquireCommandPool, 1, &pending.acquireCommandBuffer);
+	}
+	if (pending.transferComplete != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(device, pending.transferComplete, nullptr);
+	}
+	vkDestroyFence(device, pending.fence, nullptr);
+}
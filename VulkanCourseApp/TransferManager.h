@@ -0,0 +1,158 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <deque>
+
+#include "Utilities.h"
+
+// Size of the staging buffers a batch copies its data into (larger uploads get a buffer of their own)
+const VkDeviceSize UPLOAD_STAGING_CHUNK_SIZE = 8 * 1024 * 1024;
+
+// Identifies a submitted upload. Tickets increase with every submission and complete in order.
+typedef uint64_t TransferTicket;
+
+class TransferManager;
+
+// Uploads recorded together and submitted as one: data shares a few staging buffers, and the layout/ownership
+// barriers of all resources are merged into one vkCmdPipelineBarrier per phase
+class UploadBatch
+{
+public:
+	// Copy data into a buffer, made available to dstStage/dstAccess on the graphics queue.
+	// concurrent: buffer was created with VK_SHARING_MODE_CONCURRENT, so it needs no ownership transfer
+	void uploadBuffer(const void *data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, bool concurrent);
+	// Copy RGBA data into an image in UNDEFINED layout, left in SHADER_READ_ONLY_OPTIMAL for fragment shaders.
+	// generateMipmaps: data is level 0 and the other levels are blitted from it on the graphics queue (image needs
+	// TRANSFER_SRC usage and a format with linear blit support), otherwise data holds all levels packed one after the other
+	void uploadImage(const void *data, VkDeviceSize size, VkImage dstImage, uint32_t width, uint32_t height,
+		uint32_t mipLevels, bool generateMipmaps);
+	// Same as uploadImage, but returns mapped staging memory of size bytes for the caller to write the data into
+	// (e.g. decode straight into it) any time before the batch is submitted
+	void *reserveImage(VkDeviceSize size, VkImage dstImage, uint32_t width, uint32_t height,
+		uint32_t mipLevels, bool generateMipmaps);
+
+	// Move everything recorded in other into this batch
+	void append(UploadBatch &other);
+
+	bool isEmpty();
+
+private:
+	friend class TransferManager;
+
+	struct StagingBuffer
+	{
+		VkBuffer buffer;
+		MemoryAllocation memory;
+		VkDeviceSize size;
+		VkDeviceSize head;				// Next free byte
+	};
+
+	struct BufferCopy
+	{
+		VkBuffer stagingBuffer;
+		VkBuffer dstBuffer;
+		VkBufferCopy region;
+	};
+
+	struct ImageCopy
+	{
+		VkBuffer stagingBuffer;
+		VkImage dstImage;
+		VkBufferImageCopy region;
+	};
+
+	struct MipChain
+	{
+		VkImage image;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+	};
+
+	DeviceMemoryAllocator *allocator = nullptr;
+	VkDevice device = VK_NULL_HANDLE;
+
+	std::vector<StagingBuffer> stagingBuffers;
+	std::vector<BufferCopy> bufferCopies;
+	std::vector<ImageCopy> imageCopies;
+	std::vector<MipChain> mipChains;				// Images whose lower levels are generated after the hand over
+
+	// Barriers after the copies, and the stages that wait on them
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	std::vector<VkBufferMemoryBarrier> concurrentBufferBarriers;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	VkPipelineStageFlags dstStages = 0;
+
+	VkDeviceSize stage(const void *data, VkDeviceSize size, VkBuffer *stagingBuffer);
+	void recordImageUpload(VkBuffer stagingBuffer, VkDeviceSize stagingOffset, VkImage dstImage, uint32_t width, uint32_t height,
+		uint32_t mipLevels, bool generateMipmaps);
+};
+
+// Uploads data to device local resources on the transfer queue without waiting for it. Ownership of the
+// destination is released to the graphics queue family, which acquires it in its own small submission.
+class TransferManager
+{
+public:
+	TransferManager();
+
+	void init(DeviceMemoryAllocator *newAllocator, VkDevice newDevice, QueueFamilyIndices queueFamilies,
+		VkQueue newTransferQueue, VkQueue newGraphicsQueue);
+
+	UploadBatch beginBatch();
+	// Record and submit everything in the batch (one submission per queue, one fence), returns its ticket
+	TransferTicket submitBatch(UploadBatch &batch);
+	// Release the batch's staging memory without submitting anything (e.g. the data never made it into staging)
+	void discardBatch(UploadBatch &batch);
+
+	// Retire finished uploads and release their staging memory (never blocks)
+	void update();
+
+	// Whether everything up to and including ticket is resident
+	bool isComplete(TransferTicket ticket);
+	TransferTicket getLastSubmitted();
+	TransferTicket getLastCompleted();
+
+	void waitIdle();
+	void destroy();
+
+	~TransferManager();
+
+private:
+	struct PendingTransfer
+	{
+		TransferTicket ticket = 0;
+		VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;		// Only if transfer and graphics families differ
+		VkSemaphore transferComplete = VK_NULL_HANDLE;				// Acquire waits on the transfer through this
+		VkFence fence = VK_NULL_HANDLE;								// Signaled when the last submission of the upload finishes
+		std::vector<UploadBatch::StagingBuffer> stagingBuffers;
+	};
+
+	DeviceMemoryAllocator *allocator;
+	VkDevice device;
+
+	uint32_t transferFamily;
+	uint32_t graphicsFamily;
+	VkQueue transferQueue;
+	VkQueue graphicsQueue;
+
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+	VkCommandPool acquireCommandPool = VK_NULL_HANDLE;
+
+	TransferTicket lastSubmitted = 0;
+	TransferTicket lastCompleted = 0;
+	std::deque<PendingTransfer> pendingTransfers;
+
+	bool isSharedQueue();
+	VkCommandPool createCommandPool(uint32_t queueFamilyIndex);
+
+	void recordOwnershipTransfer(PendingTransfer &pending, VkPipelineStageFlags dstStage, std::vector<VkBufferMemoryBarrier> bufferBarriers,
+		std::vector<VkBufferMemoryBarrier> concurrentBufferBarriers, std::vector<VkImageMemoryBarrier> imageBarriers);
+	void recordMipmapGeneration(VkCommandBuffer commandBuffer, const std::vector<UploadBatch::MipChain> &mipChains);
+	void submitTransfer(PendingTransfer &pending);
+	void retireTransfer(PendingTransfer &pending);
+};
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <fstream>
+#include <algorithm>
+#include <cstdint>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include "MemoryAllocator.h"
+#include "MipChain.h"
+#include "Vertex.h"
+
 const int MAX_FRAME_DRAWS = 2;
 const int MAX_OBJECTS = 20;
 
@@ -13,19 +19,12 @@ const std::vector<const char *> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-// Vertex data representation
-struct Vertex
-{
-	glm::vec3 pos;	// Vertex position
-	glm::vec3 col;	// Vertex color (r, g, b)
-	glm::vec2 tex;	// Texture Coords (u, v)
-};
-
 // Indices (locations) of Queue Families (if they exist at all)
 struct QueueFamilyIndices
 {
 	int graphicsFamily = -1;		// Location of Graphics Queue Family
 	int presentationFamily  = -1;	// Location of Presentation Queue Family
+	int transferFamily = -1;		// Location of Queue Family used for uploads (transfer-only if the device has one, otherwise graphics)
 	// Check if queue families are valid
 	bool isValid()
 	{
@@ -72,25 +71,8 @@ static std::vector<char> readFile(const std::string &filename)
 	return fileBuffer;
 }
 
-static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
-{
-	// Get properties of physical device memory
-	VkPhysicalDeviceMemoryProperties memoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
-	{
-		if ((allowedTypes & (1 << i))														// Index of memory type must match corresponding bit in allowedTypes
-			&& (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)	// Desired property bit flags are part of memory type's property flags		
-		{
-			// This memory type is valid, return its index
-			return i;
-		}
-	}
-}
-
-static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsageFlags,
-	VkMemoryPropertyFlags bufferPropertyFlags, VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+static void createBuffer(DeviceMemoryAllocator *allocator, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsageFlags,
+	VkMemoryPropertyFlags bufferPropertyFlags, VkBuffer *buffer, MemoryAllocation *bufferMemory)
 {
 	// CREATE VERTEX BUFFER
 	// Information to create buffer (doesn't include assigning memory)
@@ -111,21 +93,18 @@ static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDev
 	vkGetBufferMemoryRequirements(device, *buffer, &memoryRequirements);
 
 	// ALLOCATE MEMORY TO BUFFER
-	VkMemoryAllocateInfo memoryAllocateInfo = {};
-	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocateInfo.allocationSize = memoryRequirements.size;
-	memoryAllocateInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memoryRequirements.memoryTypeBits, 
-		bufferPropertyFlags);																					// VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT	: CPU can interact w/ memory
-																												// VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : Allows placement of data straight into buffer after mapping (otherwise would have to specify manually)
-	// Allocate memory to VkDeviceMemory
-	result = vkAllocateMemory(device, &memoryAllocateInfo, nullptr, bufferMemory);
-	if(result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate Vertex Buffer Memory!");
-	}
+	// Range of a shared memory block (or a dedicated allocation for very large buffers)
+	*bufferMemory = allocator->allocate(memoryRequirements, bufferPropertyFlags, true);		// VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT	: CPU can interact w/ memory (stays mapped, see MemoryAllocation::mapped)
+																							// VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : Allows placement of data straight into buffer after mapping (otherwise would have to specify manually)
 
 	// Allocate memory to given Vertex Buffer
-	vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
+	vkBindBufferMemory(device, *buffer, bufferMemory->memory, bufferMemory->offset);
+}
+
+static void destroyBuffer(DeviceMemoryAllocator *allocator, VkDevice device, VkBuffer buffer, const MemoryAllocation &bufferMemory)
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator->free(bufferMemory);
 }
 
 static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool)
@@ -153,118 +132,3 @@ static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool command
 
 	return commandBuffer;
 }
-
-static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkCommandBuffer commandBuffer)
-{
-	// End commands
-	vkEndCommandBuffer(commandBuffer);
-
-	// Queue submission information
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	// Submit transfer command to transfer queue and wait until it finishes
-	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(queue);
-
-	// Free temporary command buffer back to pool
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
-static void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize)
-{
-	// Create buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	// Region of data to copy from and to
-	VkBufferCopy bufferCopyRegion = {};
-	bufferCopyRegion.srcOffset = 0;
-	bufferCopyRegion.dstOffset = 0;
-	bufferCopyRegion.size = bufferSize;
-
-	// Command to copy src buffer to dst buffer
-	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &bufferCopyRegion);
-
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkImage image, uint32_t width, uint32_t height)
-{
-	// Create buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	VkBufferImageCopy imageRegion = {};
-	imageRegion.bufferOffset = 0;
-	imageRegion.bufferRowLength = 0;												// Row length of data to calculate data spacing
-	imageRegion.bufferImageHeight = 0;												// Image height to calculate data spacing
-	imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	imageRegion.imageSubresource.mipLevel = 0;
-	imageRegion.imageSubresource.baseArrayLayer = 0;								// Starting array layer (if array)
-	imageRegion.imageSubresource.layerCount = 1;
-	imageRegion.imageOffset = {0, 0, 0};											// Offset into image (as opposed to raw data in bufferOffset)
-	imageRegion.imageExtent.width = width;											// Size of region of image to copy (x, y, z) 
-	imageRegion.imageExtent.height = height;
-	imageRegion.imageExtent.depth = 1;
-
-	// Copy buffer to given image
-	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-		1, &imageRegion);
-
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-	// Create buffer
-	VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
-
-	VkImageMemoryBarrier imageMemoryBarrier = {};
-	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	imageMemoryBarrier.oldLayout = oldLayout;
-	imageMemoryBarrier.newLayout = newLayout;
-	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;							// Queue family to transition from
-	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;							// Queue family to transition to
-	imageMemoryBarrier.image = image;															// Image being accessed and modified as part of barrier
-	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-	imageMemoryBarrier.subresourceRange.levelCount = 1;											// Num of mipmap levels to alter
-	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-	imageMemoryBarrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags srcStage;
-	VkPipelineStageFlags dstStage;
-
-	// If transitioning from new image to image ready to receive data...
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-	{
-		imageMemoryBarrier.srcAccessMask = 0;													// Memory access stage transition must happen after...
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;							// Memory access stage transition must happen before...
-
-		srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	} 
-	// If transitioning from transfer destination to shader readable...
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-	{
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-
-	vkCmdPipelineBarrier(commandBuffer, 
-		srcStage, dstStage,																	// Pipeline stages (match to src and dst AccessMasks)
-		0,																					// Dependency flags 
-		0, nullptr,																			// Memory Barrier count + data	
-		0, nullptr,																			// Buffer Memory Barrier count + data
-		1, &imageMemoryBarrier																// Image Memory Barrier count + data
-	);
-
-	endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
-
-}
\ No newline at end of file
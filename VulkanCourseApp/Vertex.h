@@ -0,0 +1,11 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Vertex data representation (also the layout of vertices in cooked mesh files)
+struct Vertex
+{
+	glm::vec3 pos;	// Vertex position
+	glm::vec3 col;	// Vertex color (r, g, b)
+	glm::vec2 tex;	// Texture Coords (u, v)
+};
@@ -1,5 +1,11 @@
 #include "VulkanRenderer.h"
+#include "CpuTracer.h"
 #include <iostream>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <map>
+#include <limits>
 
 VulkanRenderer::VulkanRenderer()
 {}
@@ -7,6 +13,7 @@ VulkanRenderer::VulkanRenderer()
 int VulkanRenderer::init(GLFWwindow * newWindow)
 {
 	window = newWindow;
+	headless = false;
 
 	try
 	{
@@ -15,30 +22,37 @@ int VulkanRenderer::init(GLFWwindow * newWindow)
 		createSurface();
 		getPhysicalDevice();
 		createLogicalDevice();
+		memoryAllocator.init(mainDevice.physicalDevice, mainDevice.logicalDevice);
+		transferManager.init(&memoryAllocator, mainDevice.logicalDevice, getQueueFamilies(mainDevice.physicalDevice), transferQueue, graphicsQueue);
+		geometryPool.init(&memoryAllocator, mainDevice.logicalDevice, getQueueFamilies(mainDevice.physicalDevice));
 		createSwapChain();
-		createColorBufferImage();
-		createDepthBufferImage();
-		createRenderPass();
-		createDescriptorSetLayout();
-		createPushConstantRange();
-		createGraphicsPipeline();
-		createFramebuffers();
-		createCommandPool();
-		createCommandBuffers();
-		createTextureSampler();
-		//allocateDynamicBufferTransferSpace();
-		createUniformBuffers();
-		createDescriptorPool();
-		createDescriptorSets();
-		createInputDescriptorSets();
-		createSynchronization();
-
-		uboViewProjection.projection = glm::perspective(glm::radians(45.0f), static_cast<float>(swapchainExtent.width) / static_cast<float>(swapchainExtent.height), 0.1f, 100.0f);
-		uboViewProjection.view = glm::lookAt(glm::vec3(10.0f, 0.0f, 100.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		uboViewProjection.projection[1][1] *= -1;
-
-		// Create default "no texture" texture 
-		createTexture("texture1.jpg");
+		createRendererResources();
+	}
+	catch (const std::runtime_error &e)
+	{
+		printf("ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
+
+int VulkanRenderer::initHeadless(uint32_t width, uint32_t height)
+{
+	window = nullptr;
+	headless = true;
+
+	try
+	{
+		createInstance();
+		setupDebugMessenger();
+		getPhysicalDevice();
+		createLogicalDevice();
+		memoryAllocator.init(mainDevice.physicalDevice, mainDevice.logicalDevice);
+		transferManager.init(&memoryAllocator, mainDevice.logicalDevice, getQueueFamilies(mainDevice.physicalDevice), transferQueue, graphicsQueue);
+		geometryPool.init(&memoryAllocator, mainDevice.logicalDevice, getQueueFamilies(mainDevice.physicalDevice));
+		createOffscreenTargets(width, height);
+		createRendererResources();
 	}
 	catch (const std::runtime_error &e)
 	{
@@ -54,47 +68,282 @@ void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
 	if (modelId >= modelList.size()) return;
 
 	modelList[modelId].setModel(newModel);
+
+	// Only the scene buffer is rewritten, recorded command buffers stay valid
+	modelTransforms[modelId] = newModel;
+	transformVersion++;
+
+	updateSceneObjects(modelProxies[modelId]);
+}
+
+int VulkanRenderer::createInstance(int modelId, glm::mat4 transform)
+{
+	if (modelId >= modelList.size()) return -1;
+
+	int instanceId;
+	if (!freeInstanceIds.empty())
+	{
+		instanceId = freeInstanceIds.back();
+		freeInstanceIds.pop_back();
+	}
+	else
+	{
+		instanceId = static_cast<int>(instanceList.size());
+		instanceList.push_back(ModelInstance());
+	}
+	instanceList[instanceId].modelId = modelId;
+	instanceList[instanceId].transform = transform;
+	modelInstanceIds[modelId].push_back(instanceId);
+	liveInstanceCount++;
+
+	instanceProxies.resize(instanceList.size());
+	insertSceneObjects(modelId, instanceId, &instanceProxies[instanceId]);
+
+	// Model's draws get another instance, and the transforms of later models move along
+	transformVersion++;
+	sceneVersion++;
+
+	return instanceId;
+}
+
+void VulkanRenderer::updateInstance(int instanceId, glm::mat4 newTransform)
+{
+	if (instanceId >= instanceList.size() || instanceList[instanceId].modelId < 0) return;
+
+	// Like updateModel, only the scene buffer is rewritten
+	instanceList[instanceId].transform = newTransform;
+	transformVersion++;
+
+	updateSceneObjects(instanceProxies[instanceId]);
+}
+
+void VulkanRenderer::destroyInstance(int instanceId)
+{
+	if (instanceId >= instanceList.size() || instanceList[instanceId].modelId < 0) return;
+
+	std::vector<int> &instanceIds = modelInstanceIds[instanceList[instanceId].modelId];
+	instanceIds.erase(std::find(instanceIds.begin(), instanceIds.end(), instanceId));
+
+	removeSceneObjects(&instanceProxies[instanceId]);
+	instanceList[instanceId].modelId = -1;
+	freeInstanceIds.push_back(instanceId);
+	liveInstanceCount--;
+
+	transformVersion++;
+	sceneVersion++;
+}
+
+void VulkanRenderer::destroyMeshModel(int modelId)
+{
+	if (modelId >= modelList.size()) return;
+
+	// Leave an empty model behind so the ids of the other models stay valid
+	MeshModel meshModel = modelList[modelId];
+	modelList[modelId] = MeshModel();
+	selectedLods[modelId].clear();
+	sceneVersion++;
+
+	// Its instances go with it
+	removeSceneObjects(&modelProxies[modelId]);
+	for (int instanceId : modelInstanceIds[modelId])
+	{
+		removeSceneObjects(&instanceProxies[instanceId]);
+		instanceList[instanceId].modelId = -1;
+		freeInstanceIds.push_back(instanceId);
+	}
+	liveInstanceCount -= modelInstanceIds[modelId].size();
+	modelInstanceIds[modelId].clear();
+	transformVersion++;
+
+	// Frames in flight (or its upload) may still read the geometry
+	deferDestroy([this, meshModel]() mutable
+	{
+		meshModel.destroyMeshModel();
+	});
+
+	for (int textureId : meshModel.getTextureIds())
+	{
+		releaseTexture(textureId);
+	}
+}
+
+int VulkanRenderer::pickModel(glm::vec3 origin, glm::vec3 direction, int *hitInstanceId)
+{
+	direction = glm::normalize(direction);
+
+	// Leaves are tested in the mesh's object space against its own box, rotated meshes aren't hit through the corners of their world box.
+	// Object space t is the same as world space t (an affine map keeps the ray's parameter), with a normalized direction that's the distance.
+	int hitModel = -1;
+	int hitInstance = -1;
+	float nearest = std::numeric_limits<float>::max();
+	sceneBvh.queryRay(origin, direction, nearest, [&](uint32_t proxy)
+	{
+		const SceneObject &object = sceneObjects[proxy];
+		glm::mat4 toObject = glm::inverse(getObjectTransform(object));
+		glm::vec3 objectOrigin = glm::vec3(toObject * glm::vec4(origin, 1.0f));
+		glm::vec3 objectDirection = glm::vec3(toObject * glm::vec4(direction, 0.0f));
+		BoundingBox box = modelList[object.modelId].getMesh(object.mesh)->getBoundingBox();
+
+		float enter = 0.0f;
+		float exit = nearest;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (std::abs(objectDirection[axis]) < 1e-20f)
+			{
+				// Parallel to the slab, misses unless it starts between its planes
+				if (objectOrigin[axis] < box.minimum[axis] || objectOrigin[axis] > box.maximum[axis]) return nearest;
+				continue;
+			}
+			float t1 = (box.minimum[axis] - objectOrigin[axis]) / objectDirection[axis];
+			float t2 = (box.maximum[axis] - objectOrigin[axis]) / objectDirection[axis];
+			enter = std::max(enter, std::min(t1, t2));
+			exit = std::min(exit, std::max(t1, t2));
+		}
+		if (enter > exit || enter >= nearest) return nearest;
+
+		nearest = enter;
+		hitModel = object.modelId;
+		hitInstance = object.instanceId;
+		return enter;
+	});
+
+	if (hitInstanceId)
+	{
+		*hitInstanceId = hitInstance;
+	}
+	return hitModel;
+}
+
+std::vector<int> VulkanRenderer::findModels(glm::vec3 center, float radius)
+{
+	// The BVH's leaves are enlarged, so candidates are checked against the mesh's actual world box
+	std::vector<uint32_t> proxies;
+	sceneBvh.querySphere(center, radius, &proxies);
+
+	std::vector<int> modelIds;
+	for (uint32_t proxy : proxies)
+	{
+		const SceneObject &object = sceneObjects[proxy];
+		BoundingBox box = transformBoundingBox(getObjectTransform(object), modelList[object.modelId].getMesh(object.mesh)->getBoundingBox());
+		glm::vec3 offset = glm::max(glm::max(box.minimum - center, center - box.maximum), glm::vec3(0.0f));
+		if (glm::dot(offset, offset) <= radius * radius)
+		{
+			modelIds.push_back(object.modelId);
+		}
+	}
+
+	std::sort(modelIds.begin(), modelIds.end());
+	modelIds.erase(std::unique(modelIds.begin(), modelIds.end()), modelIds.end());
+	return modelIds;
 }
 
 void VulkanRenderer::draw()
 {
+	CPU_TRACE_SCOPE("draw");
+
 	// -- Get next image --
 
 	// Wait for given fence to signal (open) from last draw before continuing
-	vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences [currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-	// Manually reset (close) fences
-	vkResetFences(mainDevice.logicalDevice, 1, &drawFences [currentFrame]);
+	{
+		CPU_TRACE_SCOPE("Wait for frame fence");
+		vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences [currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+
+	// Everything recorded for this frame's previous submission (frame N - MAX_FRAME_DRAWS) is done, free it all at once
+	vkResetCommandPool(mainDevice.logicalDevice, frameCommandPools[currentFrame], 0);
+
+	// Its timestamps can be read without stalling too
+	gpuProfiler.collect(currentFrame);
+
+	// Retire finished uploads, models whose data has landed become drawable
+	transferManager.update();
+
+	// Destroy released resources no frame or upload uses any more
+	runDeferredDestroys(false);
 
 	// Get index of next image to be drawn to, and signal semaphore when ready to be drawn to
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable [currentFrame], VK_NULL_HANDLE, &imageIndex);
+	if (headless)
+	{
+		// One offscreen target per frame in flight, so the fence we just waited on also guards the target
+		imageIndex = static_cast<uint32_t>(currentFrame);
+	}
+	else
+	{
+		CPU_TRACE_SCOPE("vkAcquireNextImageKHR");
+		vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable [currentFrame], VK_NULL_HANDLE, &imageIndex);
+	}
+
+	// The image's secondary command buffers and scene buffer region belong to whichever frame last drew to it, which may still be in flight
+	if (imageFences[imageIndex] != VK_NULL_HANDLE && imageFences[imageIndex] != drawFences[currentFrame])
+	{
+		CPU_TRACE_SCOPE("Wait for image fence");
+		vkWaitForFences(mainDevice.logicalDevice, 1, &imageFences[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+	imageFences[imageIndex] = drawFences[currentFrame];
+
+	// Manually reset (close) fences
+	vkResetFences(mainDevice.logicalDevice, 1, &drawFences [currentFrame]);
 
-	recordCommands(imageIndex);
-	updateUniformBuffers(imageIndex);
+	{
+		CPU_TRACE_SCOPE("updateScene");
+		updateScene();
+	}
+	{
+		CPU_TRACE_SCOPE("updateUniformBuffers");
+		updateUniformBuffers(imageIndex);
+	}
+
+	// Transforms and camera live in the scene buffer, so the image's geometry subpass is reused unless the scene changed
+	if (recordedSceneVersion[imageIndex] != sceneVersion)
+	{
+		CPU_TRACE_SCOPE("recordGeometrySubpass");
+		recordGeometrySubpass(imageIndex);
+		recordedSceneVersion[imageIndex] = sceneVersion;
+		recordCount++;
+	}
+	{
+		// Only a handful of commands around the secondary command buffers
+		CPU_TRACE_SCOPE("recordCommands");
+		recordCommands(imageIndex);
+	}
 
 	// -- Submit command buffer to render
 	// Queue submission information
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.waitSemaphoreCount = headless ? 0 : 1;						// Offscreen targets have no acquire to wait on
 	submitInfo.pWaitSemaphores = &imageAvailable [currentFrame];				// List of semaphores to wait on
 	VkPipelineStageFlags waitStages[] = {
 		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
 	};
 	submitInfo.pWaitDstStageMask = waitStages;								// Stages to check semaphores at
 	submitInfo.commandBufferCount = 1;										// Num of command buffers to submit
-	submitInfo.pCommandBuffers = &commandBuffers [imageIndex];				// Command buffer to submit
-	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffers [currentFrame];				// Command buffer to submit
+	submitInfo.signalSemaphoreCount = headless ? 0 : 1;						// Nothing presents offscreen targets
 	submitInfo.pSignalSemaphores = &renderFinished [currentFrame];			// Semaphores to signal when command buffer finishes
 
 	// Submit command buffer to queue
-	VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences [currentFrame]);
+	VkResult result;
+	{
+		CPU_TRACE_SCOPE("vkQueueSubmit");
+		result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences [currentFrame]);
+	}
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to submit Command Buffer to Queue!");
 	}
+	gpuProfiler.markSubmitted(currentFrame);
+	frameCount++;
+
+	if (headless)
+	{
+		// Get next frame
+		currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
+		return;
+	}
 
-	// -- Present rendered image to screen -- 
+	// -- Present rendered image to screen --
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
@@ -104,7 +353,10 @@ void VulkanRenderer::draw()
 	presentInfo.pImageIndices = &imageIndex;					// Index of images to in swapchains to present
 
 	// Present Image!
-	result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	{
+		CPU_TRACE_SCOPE("vkQueuePresentKHR");
+		result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	}
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to present Image!");
@@ -118,12 +370,18 @@ void VulkanRenderer::cleanup()
 	// Wait until no actions being run on device before destroying
 	vkDeviceWaitIdle(mainDevice.logicalDevice);
 
+	textureLoader.destroy();
+
+	transferManager.destroy();
+	runDeferredDestroys(true);
+
 	//_aligned_free(modelTransferSpace);
 
 	for (size_t i = 0; i < modelList.size(); i++)
 	{
 		modelList[i].destroyMeshModel();
 	}
+	geometryPool.destroy();
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool, nullptr);
 
@@ -135,9 +393,12 @@ void VulkanRenderer::cleanup()
 	vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
 	for (size_t i = 0; i < textureImages.size(); i++)
 	{
+		// Slot of a destroyed texture
+		if (textureImages[i] == VK_NULL_HANDLE) continue;
+
 		vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
 		vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, texturesImageMemory[i], nullptr);
+		memoryAllocator.free(texturesImageMemory[i]);
 	}
 
 
@@ -145,27 +406,21 @@ void VulkanRenderer::cleanup()
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView[i], nullptr);
 		vkDestroyImage(mainDevice.logicalDevice, depthBufferImage[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory[i], nullptr);
+		memoryAllocator.free(depthBufferImageMemory[i]);
 	}
 
 	for (size_t i = 0; i < colorBufferImage.size(); i++)
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageView[i], nullptr);
 		vkDestroyImage(mainDevice.logicalDevice,colorBufferImage[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, colorBufferImageMemory[i], nullptr);
+		memoryAllocator.free(colorBufferImageMemory[i]);
 	}
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
-	for (size_t i = 0; i < swapchainImages.size(); i++)
-	{
-		vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffers[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
-		
-		// LEGACY
-		/*vkDestroyBuffer(mainDevice.logicalDevice, modelUniformBuffersDynamic[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, modelUniformBufferMemoryDynamic[i], nullptr);*/
-	}
+	gpuCuller.destroy();
+	depthPyramid.destroy();
+	sceneBuffer.destroy();
 	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
 	{
 		vkDestroySemaphore(mainDevice.logicalDevice, renderFinished [i], nullptr);
@@ -173,22 +428,56 @@ void VulkanRenderer::cleanup()
 		vkDestroyFence(mainDevice.logicalDevice, drawFences [i], nullptr);
 	}
 
-	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
+	gpuProfiler.destroy();
+
+	for (auto pool : frameCommandPools)
+	{
+		vkDestroyCommandPool(mainDevice.logicalDevice, pool, nullptr);
+	}
+	for (auto &imagePools : secondaryCommandPools)
+	{
+		for (auto pool : imagePools)
+		{
+			vkDestroyCommandPool(mainDevice.logicalDevice, pool, nullptr);
+		}
+	}
+	recordThreads.destroy();
+	sceneBvh.destroy();
 	for (auto framebuffer : swapchainFramebuffers)
 	{
 		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
 	}
+	for (auto framebuffer : earlyFramebuffers)
+	{
+		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+	}
 	vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline, nullptr);
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, earlyGraphicsPipeline, nullptr);
 	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, lateRenderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, earlyRenderPass, nullptr);
 	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
 	for (auto image : swapchainImages)
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
 	}
-	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (headless)
+	{
+		// Offscreen targets are owned by us rather than by a swapchain
+		for (size_t i = 0; i < swapchainImages.size(); i++)
+		{
+			vkDestroyImage(mainDevice.logicalDevice, swapchainImages[i].image, nullptr);
+			memoryAllocator.free(offscreenImageMemory[i]);
+		}
+	}
+	else
+	{
+		vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
+	memoryAllocator.destroy();
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 	if (enableValidationLayers)
 	{
@@ -198,9 +487,117 @@ void VulkanRenderer::cleanup()
 }
 
 
+void VulkanRenderer::setLodBias(float newLodBias)
+{
+	lodBias = newLodBias;
+
+	// LODs get selected again on the next frame
+	transformVersion++;
+}
+
+void VulkanRenderer::setMeshOptimizeOptions(MeshOptimizeOptions newMeshOptimizeOptions)
+{
+	meshOptimizeOptions = newMeshOptimizeOptions;
+}
+
+MeshOptimizeReport VulkanRenderer::getMeshOptimizeReport(int modelId)
+{
+	if (modelId >= modelList.size()) return MeshOptimizeReport();
+
+	return modelList[modelId].getOptimizeReport();
+}
+
+uint64_t VulkanRenderer::getRecordCount()
+{
+	return recordCount;
+}
+
+RenderQueueStats VulkanRenderer::getRenderQueueStats()
+{
+	return renderQueueStats;
+}
+
+void VulkanRenderer::setGpuCulling(bool enabled)
+{
+	gpuCulling = enabled;
+
+	// Geometry subpasses get recorded again with the other kind of draws, and the CPU culls again if it is its turn
+	sceneVersion++;
+	transformVersion++;
+}
+
+bool VulkanRenderer::isGpuCullingActive()
+{
+	return gpuCulling && gpuCuller.isSupported();
+}
+
+void VulkanRenderer::setOcclusionCulling(bool enabled)
+{
+	occlusionCulling = enabled;
+
+	// Geometry subpasses get recorded again with or without the early pass
+	sceneVersion++;
+}
+
+bool VulkanRenderer::isOcclusionCullingActive()
+{
+	return isGpuCullingActive() && occlusionCulling && gpuCuller.isOcclusionSupported();
+}
+
+GpuTimingStats VulkanRenderer::getGpuTimings(GpuTimingScope scope)
+{
+	return gpuProfiler.getStats(scope);
+}
+
+MemoryAllocatorStats VulkanRenderer::getMemoryStats()
+{
+	return memoryAllocator.getStats();
+}
+
 VulkanRenderer::~VulkanRenderer()
 {}
 
+void VulkanRenderer::createRendererResources()
+{
+	// Everything past this point only needs swapchainImages/swapchainExtent, whether they come from a swapchain or offscreen targets
+	createColorBufferImage();
+	createDepthBufferImage();
+	createRenderPass();
+	createDescriptorSetLayout();
+	createGraphicsPipeline();
+	createFramebuffers();
+	recordThreads.init(0);
+	sceneBvh.init();
+	createCommandPool();
+	createCommandBuffers();
+	createTextureSampler();
+	//allocateDynamicBufferTransferSpace();
+	createUniformBuffers();
+	createDescriptorPool();
+	createDescriptorSets();
+	createInputDescriptorSets();
+	createSynchronization();
+
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = drawIndirectCountSupported ?
+		reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkCmdDrawIndexedIndirectCountKHR")) : nullptr;
+	depthPyramid.init(&memoryAllocator, mainDevice.logicalDevice, depthBufferImageView, swapchainExtent, depthSampleable);
+	gpuCuller.init(&memoryAllocator, mainDevice.logicalDevice, &sceneBuffer, &depthPyramid, static_cast<uint32_t>(swapchainImages.size()), drawIndexedIndirectCount);
+
+	gpuProfiler.init(mainDevice.physicalDevice, mainDevice.logicalDevice, getQueueFamilies(mainDevice.physicalDevice).graphicsFamily,
+		MAX_FRAME_DRAWS);
+
+	uboViewProjection.projection = glm::perspective(glm::radians(45.0f), static_cast<float>(swapchainExtent.width) / static_cast<float>(swapchainExtent.height), 0.1f, 100.0f);
+	uboViewProjection.view = glm::lookAt(glm::vec3(10.0f, 0.0f, 100.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	uboViewProjection.projection[1][1] *= -1;
+
+	textureLoader.init(0);
+
+	// Create default "no texture" texture
+	UploadBatch uploadBatch = transferManager.beginBatch();
+	createTexture("texture1.jpg", &uploadBatch);
+	transferManager.submitBatch(uploadBatch);
+}
+
 void VulkanRenderer::createInstance()
 {
 	// Information about the application itself
@@ -223,13 +620,16 @@ void VulkanRenderer::createInstance()
 	uint32_t glfwExtensionCount = 0;						// GLFW may require multiple extensions
 	const char** glfwExtensions;							// Extensions passed as array of cstrings, so need pointer (the array) to pointer (the cstring)
 
-	// Get GLFW extensions
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	// Add GLFW extensions to list of extensions
-	for (size_t i = 0; i < glfwExtensionCount; i++)
+	// Get GLFW extensions (headless rendering needs no surface, so no window system extensions)
+	if (!headless)
 	{
-		instanceExtensions.push_back(glfwExtensions [i]);
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		// Add GLFW extensions to list of extensions
+		for (size_t i = 0; i < glfwExtensionCount; i++)
+		{
+			instanceExtensions.push_back(glfwExtensions [i]);
+		}
 	}
 
 	if (enableValidationLayers)
@@ -278,7 +678,7 @@ void VulkanRenderer::createLogicalDevice()
 
 	// Vector for queue creation information and set for family indices (disallows duplicates)
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> queueFamilyIndices = {indices.graphicsFamily, indices.presentationFamily};
+	std::set<int> queueFamilyIndices = {indices.graphicsFamily, indices.presentationFamily, indices.transferFamily};
 	// Queues the logical device needs to create and info to do so 
 	for (int queueFamilyIndex : queueFamilyIndices)
 	{
@@ -295,8 +695,7 @@ void VulkanRenderer::createLogicalDevice()
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();								// List of queue create infos so device can create required queues
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());	// Number of enabled logical device extensions
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	std::vector<const char*> enabledExtensions = getRequiredDeviceExtensions();
 
 	// Physical Device Features the logical device will be using
 	VkPhysicalDeviceFeatures deviceFeatures = {};
@@ -305,6 +704,31 @@ void VulkanRenderer::createLogicalDevice()
 		deviceFeatures.samplerAnisotropy = VK_TRUE;												// Enable Anisotropy
 	}
 
+	// GPU culling draws with vkCmdDrawIndexedIndirectCountKHR (optional, the CPU records the draws without it)
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, extensions.data());
+
+	drawIndirectCountSupported = false;
+	for (const auto &extension : extensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+		{
+			drawIndirectCountSupported = mainDevice.deviceFeatures.multiDrawIndirect && mainDevice.deviceFeatures.drawIndirectFirstInstance;
+			break;
+		}
+	}
+	if (drawIndirectCountSupported)
+	{
+		enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		deviceFeatures.multiDrawIndirect = VK_TRUE;											// More than one draw per indirect call
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;									// firstInstance carries the transform index
+	}
+
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());	// Number of enabled logical device extensions
+	deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 	// Create the logical device for the given physical device
 	VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
@@ -317,6 +741,7 @@ void VulkanRenderer::createLogicalDevice()
 	// From given logical device, of given Queue Family, of given Queue Index (0 since only one queue), place reference in given VkQueue
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.transferFamily, 0, &transferQueue);
 }
 
 void VulkanRenderer::createSurface()
@@ -417,13 +842,38 @@ void VulkanRenderer::createSwapChain()
 		// Store image handle
 		SwapchainImage swapchainImage = {};
 		swapchainImage.image = image;
-		swapchainImage.imageView = createImageView(image, swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+		swapchainImage.imageView = createImageView(image, swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 
 		// Add to swapchain image list
 		swapchainImages.push_back(swapchainImage);
 	}
 }
 
+void VulkanRenderer::createOffscreenTargets(uint32_t width, uint32_t height)
+{
+	// Offscreen targets stand in for swapchain images, so the rest of the renderer doesn't need to know the difference
+	swapchainImageFormat = chooseSupportedFormat(
+		{ VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_B8G8R8A8_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+	);
+	swapchainExtent.width = width;
+	swapchainExtent.height = height;
+
+	// One target per frame in flight
+	offscreenImageMemory.resize(MAX_FRAME_DRAWS);
+
+	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
+	{
+		SwapchainImage offscreenImage = {};
+		offscreenImage.image = createImage(width, height, 1, swapchainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &offscreenImageMemory[i]);
+		offscreenImage.imageView = createImageView(offscreenImage.image, swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+		swapchainImages.push_back(offscreenImage);
+	}
+}
+
 void VulkanRenderer::createRenderPass()
 {
 	// Array of Subpasses
@@ -484,7 +934,8 @@ void VulkanRenderer::createRenderPass()
 	// Framebuffer data will be stored as an image, but images can be given different data layouts
 	// to give optimal use for certain operations
 	swapchainColorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;	// Image data layout before render pass starts
-	swapchainColorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;	// Image data layout after render pass (to change to)
+	swapchainColorAttachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL	// Image data layout after render pass (to change to)
+		: VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;								// Offscreen targets are read back instead of presented
 
 	// Attachment reference uses an attachment index that refers to index in the attachment list passed to renderPassCreateInfo
 	VkAttachmentReference swapchainColorAttachmentReference = {};
@@ -559,6 +1010,75 @@ void VulkanRenderer::createRenderPass()
 	{
 		throw std::runtime_error("Failed to create a Render Pass!");
 	}
+
+	// LATE RENDER PASS (occlusion culling)
+	// Same subpasses, but continues the color and depth of the early render pass instead of clearing them
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	renderPassAttachments = {swapchainColorAttachment, colorAttachment, depthAttachment};
+
+	// Depth goes back to being written once the depth pyramid build no longer reads it
+	subpassDependencies [0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	subpassDependencies [0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpassDependencies [0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &lateRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Late Render Pass!");
+	}
+
+	// EARLY RENDER PASS (occlusion culling)
+	// Only the geometry subpass: keeps color and depth for the late render pass, and leaves depth readable by the depth pyramid build
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	std::array<VkAttachmentDescription, 2> earlyAttachments = {colorAttachment, depthAttachment};
+
+	colorAttachmentReference.attachment = 0;
+	depthAttachmentReference.attachment = 1;
+
+	VkSubpassDescription earlySubpass = {};
+	earlySubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	earlySubpass.colorAttachmentCount = 1;
+	earlySubpass.pColorAttachments = &colorAttachmentReference;
+	earlySubpass.pDepthStencilAttachment = &depthAttachmentReference;
+
+	std::array<VkSubpassDependency, 2> earlyDependencies;
+
+	// Same as the render pass: after the previous use of the buffers
+	earlyDependencies[0] = subpassDependencies[0];
+
+	// Color and depth writes before the late render pass loads them, and depth before the pyramid build samples it
+	earlyDependencies[1].srcSubpass = 0;
+	earlyDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	earlyDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	earlyDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	earlyDependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	earlyDependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	earlyDependencies[1].dependencyFlags = 0;
+
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(earlyAttachments.size());
+	renderPassCreateInfo.pAttachments = earlyAttachments.data();
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &earlySubpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(earlyDependencies.size());
+	renderPassCreateInfo.pDependencies = earlyDependencies.data();
+
+	result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &earlyRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create an Early Render Pass!");
+	}
 }
 
 void VulkanRenderer::createDescriptorSetLayout()
@@ -581,7 +1101,15 @@ void VulkanRenderer::createDescriptorSetLayout()
 	modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;					
 	modelLayoutBinding.pImmutableSamplers = nullptr;	*/							
 
-	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {vpLayoutBinding};
+	// Model Transforms Binding Info (storage buffer indexed by gl_InstanceIndex, each draw's firstInstance is its first transform)
+	VkDescriptorSetLayoutBinding transformLayoutBinding = {};
+	transformLayoutBinding.binding = 1;
+	transformLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	transformLayoutBinding.descriptorCount = 1;
+	transformLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	transformLayoutBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {vpLayoutBinding, transformLayoutBinding};
 	// LEGACY
 	//std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {vpLayoutBinding, modelLayoutBinding};
 
@@ -654,14 +1182,6 @@ void VulkanRenderer::createDescriptorSetLayout()
 	}
 }
 
-void VulkanRenderer::createPushConstantRange()
-{
-	// Define push constant values (no 'create' needed)
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	pushConstantRange.offset = 0;												// Offset into given data to pass to push constant	
-	pushConstantRange.size = sizeof(Model);										// Size of data being passed
-}
-
 void VulkanRenderer::createGraphicsPipeline()
 {
 	auto vertexShaderCode = readFile("Shaders/vert.spv");
@@ -812,8 +1332,8 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;							// Model transforms come from the scene buffer rather than push constants
+	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
 
 	// Create pipeline layout
 	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
@@ -858,6 +1378,15 @@ void VulkanRenderer::createGraphicsPipeline()
 	{
 		throw std::runtime_error("Failed to create a Graphics Pipeline!");
 	}
+
+	// Same pipeline for the early render pass of occlusion culling (not compatible with the render pass)
+	pipelineCreateInfo.renderPass = earlyRenderPass;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &earlyGraphicsPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create an Early Graphics Pipeline!");
+	}
+	pipelineCreateInfo.renderPass = renderPass;
 	// Destroy shader modules, no longer needed after pipeline created
 	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
 	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
@@ -930,9 +1459,9 @@ void VulkanRenderer::createColorBufferImage()
 	);
 	for (size_t i = 0; i < swapchainImages.size(); i++)
 	{
-		colorBufferImage[i] = createImage(swapchainExtent.width, swapchainExtent.height, colorImageFormat, VK_IMAGE_TILING_OPTIMAL,
+		colorBufferImage[i] = createImage(swapchainExtent.width, swapchainExtent.height, 1, colorImageFormat, VK_IMAGE_TILING_OPTIMAL,
 			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorBufferImageMemory[i]);
-		colorBufferImageView[i] = createImageView(colorBufferImage[i], colorImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+		colorBufferImageView[i] = createImageView(colorBufferImage[i], colorImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 	}
 }
 
@@ -948,11 +1477,18 @@ void VulkanRenderer::createDepthBufferImage()
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
 	);
+
+	// Depth pyramid for occlusion culling is built by sampling depth
+	VkFormatProperties depthFormatProperties;
+	vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, depthImageFormat, &depthFormatProperties);
+	depthSampleable = (depthFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+
 	for (size_t i = 0; i < swapchainImages.size(); i++)
 	{
-		depthBufferImage[i] = createImage(swapchainExtent.width, swapchainExtent.height, depthImageFormat, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i]);
-		depthBufferImageView[i] = createImageView(depthBufferImage[i], depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+		depthBufferImage[i] = createImage(swapchainExtent.width, swapchainExtent.height, 1, depthImageFormat, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | (depthSampleable ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i]);
+		depthBufferImageView[i] = createImageView(depthBufferImage[i], depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 	}
 	
 }
@@ -985,6 +1521,31 @@ void VulkanRenderer::createFramebuffers()
 			throw std::runtime_error("Failed to create a framebuffer!");
 		}
 	}
+
+	// Color and depth buffers alone for the early render pass
+	earlyFramebuffers.resize(swapchainImages.size());
+	for (size_t i = 0; i < earlyFramebuffers.size(); i++)
+	{
+		std::array<VkImageView, 2> attachments = {
+			colorBufferImageView[i],
+			depthBufferImageView[i]
+		};
+
+		VkFramebufferCreateInfo framebufferCreateInfo = {};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = earlyRenderPass;
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		framebufferCreateInfo.pAttachments = attachments.data();
+		framebufferCreateInfo.width = swapchainExtent.width;
+		framebufferCreateInfo.height = swapchainExtent.height;
+		framebufferCreateInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &earlyFramebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a framebuffer!");
+		}
+	}
 }
 
 void VulkanRenderer::createCommandPool()
@@ -994,42 +1555,116 @@ void VulkanRenderer::createCommandPool()
 
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;			// Buffers only live for one frame, no individual reset: the whole pool is reset with vkResetCommandPool
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily; // Queue family type that buffers from this command pool will use
 
-	// Create a graphics queue family command pool
-	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &graphicsCommandPool);
-	if (result != VK_SUCCESS)
+	// Create a graphics queue family command pool for each frame in flight
+	// (upload command buffers come from the transfer manager's own pools)
+	frameCommandPools.resize(MAX_FRAME_DRAWS);
+	VkResult result;
+	for (auto &pool : frameCommandPools)
 	{
-		throw std::runtime_error("Failed to create a Command Pool!");
+		result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &pool);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a Command Pool!");
+		}
 	}
-}
-
-void VulkanRenderer::createCommandBuffers()
-{
-	// One command buffer for each framebuffer
-	commandBuffers.resize(swapchainFramebuffers.size());
 
-	VkCommandBufferAllocateInfo cbAllocInfo = {};
-	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cbAllocInfo.commandPool = graphicsCommandPool;
-	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;			// VK_COMMAND_BUFFER_LEVEL_PRIMARY		: Buffer you submit directly to queue. Can't be called by other buffers.
-																	// VK_COMMAND_BUFFER_LEVEL_SECONDARY	: Buffer can't be called directly. Can be called from other buffers via "vkCmdExecuteCommands" when recording commands in primary buffer.
-	cbAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	// Pools for the secondary command buffers of each image, one per recording thread (the calling one included).
+	// Reset as a whole with vkResetCommandPool whenever the image is recorded again
+	VkCommandPoolCreateInfo secondaryPoolInfo = {};
+	secondaryPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	secondaryPoolInfo.flags = 0;
+	secondaryPoolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
 
-	// Allocate command buffers and place handles in array of buffers
-	VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, commandBuffers.data());
-	if (result != VK_SUCCESS)
+	secondaryCommandPools.resize(swapchainFramebuffers.size());
+	for (auto &imagePools : secondaryCommandPools)
 	{
-		throw std::runtime_error("Failed to create Command Buffers!");
-	}
-}
+		imagePools.resize(recordThreads.getThreadCount() + 1);
+		for (auto &pool : imagePools)
+		{
+			result = vkCreateCommandPool(mainDevice.logicalDevice, &secondaryPoolInfo, nullptr, &pool);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create a Secondary Command Pool!");
+			}
+		}
+	}
+}
+
+void VulkanRenderer::createCommandBuffers()
+{
+	// One primary command buffer for each frame in flight, allocated once from its frame's pool (resetting the pool keeps it allocated)
+	commandBuffers.resize(MAX_FRAME_DRAWS);
+
+	VkResult result;
+	for (size_t i = 0; i < commandBuffers.size(); i++)
+	{
+		VkCommandBufferAllocateInfo cbAllocInfo = {};
+		cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cbAllocInfo.commandPool = frameCommandPools[i];
+		cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;			// VK_COMMAND_BUFFER_LEVEL_PRIMARY		: Buffer you submit directly to queue. Can't be called by other buffers.
+																		// VK_COMMAND_BUFFER_LEVEL_SECONDARY	: Buffer can't be called directly. Can be called from other buffers via "vkCmdExecuteCommands" when recording commands in primary buffer.
+		cbAllocInfo.commandBufferCount = 1;
+
+		// Allocate command buffer and place handle in array of buffers
+		result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &commandBuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create Command Buffers!");
+		}
+	}
+
+	// Nothing recorded yet
+	recordedSceneVersion.assign(swapchainFramebuffers.size(), 0);
+	geometryCommandCounts.assign(swapchainFramebuffers.size(), 0);
+
+	// One secondary command buffer per secondary pool, for its thread's share of the geometry subpass
+	geometryCommandBuffers.resize(secondaryCommandPools.size());
+	for (size_t i = 0; i < secondaryCommandPools.size(); i++)
+	{
+		geometryCommandBuffers[i].resize(secondaryCommandPools[i].size());
+		for (size_t j = 0; j < secondaryCommandPools[i].size(); j++)
+		{
+			VkCommandBufferAllocateInfo secondaryAllocInfo = {};
+			secondaryAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			secondaryAllocInfo.commandPool = secondaryCommandPools[i][j];
+			secondaryAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			secondaryAllocInfo.commandBufferCount = 1;
+
+			result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &secondaryAllocInfo, &geometryCommandBuffers[i][j]);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create Secondary Command Buffers!");
+			}
+		}
+	}
+
+	// Early render pass draws of occlusion culling, recorded along with the image's geometry subpass
+	earlyGeometryCommandBuffers.resize(secondaryCommandPools.size());
+	for (size_t i = 0; i < secondaryCommandPools.size(); i++)
+	{
+		VkCommandBufferAllocateInfo secondaryAllocInfo = {};
+		secondaryAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		secondaryAllocInfo.commandPool = secondaryCommandPools[i][0];
+		secondaryAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		secondaryAllocInfo.commandBufferCount = 1;
+
+		result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &secondaryAllocInfo, &earlyGeometryCommandBuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create Secondary Command Buffers!");
+		}
+	}
+}
 
 void VulkanRenderer::createSynchronization()
 {
 	imageAvailable.resize(MAX_FRAME_DRAWS);
 	renderFinished.resize(MAX_FRAME_DRAWS);
 	drawFences.resize(MAX_FRAME_DRAWS);
+	imageFences.assign(swapchainImages.size(), VK_NULL_HANDLE);
 
 	// Semaphore creation information
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
@@ -1061,6 +1696,12 @@ void VulkanRenderer::createTextureSampler()
 		enableAnisotropy = VK_TRUE;
 	}
 
+	// Mip levels are generated with linear blits where the texture format allows it
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+	VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	textureBlitSupported = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+
 	// Sampler Creation Info
 	VkSamplerCreateInfo samplerCreateInfo = {};
 	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1074,7 +1715,7 @@ void VulkanRenderer::createTextureSampler()
 	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;			// Mipmap interpolation mode
 	samplerCreateInfo.mipLodBias = 0.0f;									// Level of detail bias for mip level
 	samplerCreateInfo.minLod = 0.0f;										// Minimum level of detail to pick mip level
-	samplerCreateInfo.maxLod = 0.0f;										// Maximum level of detail to pick mip level
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;							// Maximum level of detail to pick mip level (each texture's view limits it to its own chain)
 	samplerCreateInfo.anisotropyEnable = enableAnisotropy;					// Enable anisotropic filtering
 	samplerCreateInfo.maxAnisotropy = 16;									// Anisotropy sample level
 
@@ -1087,31 +1728,23 @@ void VulkanRenderer::createTextureSampler()
 
 void VulkanRenderer::createUniformBuffers()
 {
-	// ViewProjection buffer size
-	VkDeviceSize vpBufferSize = sizeof(UboViewProjection);
-
 	// LEGACY
 	// Model buffer size
 	//VkDeviceSize modelBufferSize = modelUniformAlignment * MAX_OBJECTS; 
 
-	// One uniform buffer for each image (and by extension, command buffer)
-	vpUniformBuffers.resize(swapchainImages.size());
-	vpUniformBufferMemory.resize(swapchainImages.size());
+	// One region of ViewProjection and model transforms per swapchain image, so each image's command buffer can be reused
+	sceneBuffer.init(&memoryAllocator, mainDevice.physicalDevice, mainDevice.logicalDevice,
+		static_cast<uint32_t>(swapchainImages.size()), sizeof(UboViewProjection));
+	writtenTransformVersion.assign(swapchainImages.size(), 0);
 
 	// LEGACY
 	/*modelUniformBuffersDynamic.resize(swapchainImages.size());
-	modelUniformBufferMemoryDynamic.resize(swapchainImages.size());*/
-
-	// Create uniform buffers
+	modelUniformBufferMemoryDynamic.resize(swapchainImages.size());
 	for (size_t i = 0; i < swapchainImages.size(); i++)
 	{
-		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vpUniformBuffers[i], &vpUniformBufferMemory[i]);
-		
-		// LEGACY
-		/*createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &modelUniformBuffersDynamic[i], &modelUniformBufferMemoryDynamic[i]);*/
-	}
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &modelUniformBuffersDynamic[i], &modelUniformBufferMemoryDynamic[i]);
+	}*/
 }
 
 void VulkanRenderer::createDescriptorPool()
@@ -1121,7 +1754,12 @@ void VulkanRenderer::createDescriptorPool()
 	// ViewProjection Pool
 	VkDescriptorPoolSize vpPoolSize = {};
 	vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffers.size());
+	vpPoolSize.descriptorCount = static_cast<uint32_t>(swapchainImages.size());
+
+	// Model Transforms Pool
+	VkDescriptorPoolSize transformPoolSize = {};
+	transformPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	transformPoolSize.descriptorCount = static_cast<uint32_t>(swapchainImages.size());
 
 	// LEGACY - for reference
 	// Model Pool (DYNAMIC)
@@ -1130,14 +1768,14 @@ void VulkanRenderer::createDescriptorPool()
 	modelPoolSize.descriptorCount = static_cast<uint32_t>(modelUniformBuffersDynamic.size());*/
 
 	// List of Pool Sizes
-	std::vector<VkDescriptorPoolSize> descriptorPoolSizes = {vpPoolSize};
+	std::vector<VkDescriptorPoolSize> descriptorPoolSizes = {vpPoolSize, transformPoolSize};
 	// LEGACY - for reference
 	//std::vector<VkDescriptorPoolSize> descriptorPoolSizes = {vpPoolSize, modelPoolSize};
 
 	// Data to create Descriptor Pool
 	VkDescriptorPoolCreateInfo poolCreateInfo = {};
 	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());		// Maximum number of Descriptor Sets that can be created from pool
+	poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());						// Maximum number of Descriptor Sets that can be created from pool
 	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());											// Amount of Pool Sizes being passed
 	poolCreateInfo.pPoolSizes = descriptorPoolSizes.data();										// Pool Sizes to create Pool with
 
@@ -1195,9 +1833,10 @@ void VulkanRenderer::createDescriptorPool()
 
 void VulkanRenderer::createDescriptorSets()
 {
-	// Resize Descriptor Set list so one for every buffer
+	// One descriptor set per swapchain image
 	descriptorSets.resize(swapchainImages.size());
 
+	// Fill array of layouts ready for set creation
 	std::vector<VkDescriptorSetLayout> setLayouts(swapchainImages.size(), descriptorSetLayout);
 
 	// Description Set Allocation Info
@@ -1205,63 +1844,58 @@ void VulkanRenderer::createDescriptorSets()
 	setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	setAllocateInfo.descriptorPool = descriptorPool;									// Pool to allocate Descriptor Set from
 	setAllocateInfo.descriptorSetCount = static_cast<uint32_t>(swapchainImages.size());	// Number of sets to allocate
-	setAllocateInfo.pSetLayouts = setLayouts.data();									// Layouts to use to allocate set (1:1 relationship)
+	setAllocateInfo.pSetLayouts = setLayouts.data();									// Layouts to use to allocate sets (1:1 relationship)
 
-	// Allocate Descriptor Sets (multiple)
+	// Allocate Descriptor Sets
 	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocateInfo, descriptorSets.data());
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to allocate Descriptor Sets!");
 	}
 
-	// Update all of descriptor set bindings
+	// Update each descriptor set with its image's region of the scene buffer
 	for (size_t i = 0; i < swapchainImages.size(); i++)
 	{
-		// VIEW PROJECTION DESCRIPTOR
-		// Buffer info and data offset info
-		VkDescriptorBufferInfo vpBufferInfo = {};
-		vpBufferInfo.buffer = vpUniformBuffers[i];										// Buffer to get data from
-		vpBufferInfo.offset = 0;														// Position of start of data
-		vpBufferInfo.range = sizeof(UboViewProjection);									// Size of data
-
-		// Data about connection between binding and buffer
-		VkWriteDescriptorSet vpSetWrite = {};
-		vpSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		vpSetWrite.dstSet = descriptorSets[i];											// Descriptor set to update
-		vpSetWrite.dstBinding = 0;														// Binding to update (matches with binding on layout/shader)
-		vpSetWrite.dstArrayElement = 0;													// Index in array to update
-		vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;					// Type of descriptor
-		vpSetWrite.descriptorCount = 1;													// Amount to update
-		vpSetWrite.pBufferInfo = &vpBufferInfo;											// Information about buffer data to bind
-
-		// LEGACY - for reference
-		// MODEL DESCRIPTOR
-		// Model Buffer Binding Info
-		/*VkDescriptorBufferInfo modelBufferinfo = {};
-		modelBufferinfo.buffer = modelUniformBuffersDynamic[i];
-		modelBufferinfo.offset = 0;
-		modelBufferinfo.range = modelUniformAlignment;
-
-		VkWriteDescriptorSet modelSetWrite = {};
-		modelSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		modelSetWrite.dstSet = descriptorSets[i];
-		modelSetWrite.dstBinding = 1;
-		modelSetWrite.dstArrayElement = 0;
-		modelSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-		modelSetWrite.descriptorCount = 1;
-		modelSetWrite.pBufferInfo = &modelBufferinfo;
-*/
-		// List of Descriptor Set Writes
-		std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite};
-		// FOR REFERENCE
-		//std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite, modelSetWrite};
-
-		// Update the descriptor sets with new buffer/binding info
-		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 
-			0, nullptr);
+		writeDescriptorSet(static_cast<uint32_t>(i));
 	}
 }
 
+void VulkanRenderer::writeDescriptorSet(uint32_t image)
+{
+	// VIEW PROJECTION DESCRIPTOR
+	// Buffer info and data offset info
+	VkDescriptorBufferInfo vpBufferInfo = sceneBuffer.getViewProjectionInfo(image);
+
+	// Data about connection between binding and buffer
+	VkWriteDescriptorSet vpSetWrite = {};
+	vpSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	vpSetWrite.dstSet = descriptorSets[image];											// Descriptor set to update
+	vpSetWrite.dstBinding = 0;															// Binding to update (matches with binding on layout/shader)
+	vpSetWrite.dstArrayElement = 0;														// Index in array to update
+	vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;						// Type of descriptor
+	vpSetWrite.descriptorCount = 1;														// Amount to update
+	vpSetWrite.pBufferInfo = &vpBufferInfo;												// Information about buffer data to bind
+
+	// MODEL TRANSFORMS DESCRIPTOR
+	VkDescriptorBufferInfo transformBufferInfo = sceneBuffer.getTransformInfo(image);
+
+	VkWriteDescriptorSet transformSetWrite = {};
+	transformSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	transformSetWrite.dstSet = descriptorSets[image];
+	transformSetWrite.dstBinding = 1;
+	transformSetWrite.dstArrayElement = 0;
+	transformSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	transformSetWrite.descriptorCount = 1;
+	transformSetWrite.pBufferInfo = &transformBufferInfo;
+
+	// List of Descriptor Set Writes
+	std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite, transformSetWrite};
+
+	// Update the descriptor set with new buffer/binding info
+	vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 
+		0, nullptr);
+}
+
 void VulkanRenderer::createInputDescriptorSets()
 {
 	inputDescriptorSets.resize(swapchainImages.size());
@@ -1321,12 +1955,194 @@ void VulkanRenderer::createInputDescriptorSets()
 	}
 }
 
+void VulkanRenderer::updateScene()
+{
+	// Swap in a finished BVH rebuild, or start one if refits have worn the tree down
+	sceneBvh.maintain();
+
+	// Models whose uploads finished since the last frame become drawable
+	if (drawnUploadTicket != transferManager.getLastCompleted())
+	{
+		drawnUploadTicket = transferManager.getLastCompleted();
+		sceneVersion++;
+	}
+
+	// Transforms are only packed and LODs selected again when something moved, and only a different choice needs a new recording
+	if (packedTransformVersion == transformVersion) return;
+	packedTransformVersion = transformVersion;
+
+	packSceneTransforms();
+
+	// Camera position and pixels per unit of error at distance 1, for picking LODs
+	glm::vec3 cameraPosition = glm::vec3(glm::inverse(uboViewProjection.view)[3]);
+	float lodPixelScale = 0.5f * swapchainExtent.height * std::abs(uboViewProjection.projection[1][1]);
+
+	bool lodsChanged = false;
+	for (size_t i = 0; i < modelList.size(); i++)
+	{
+		MeshModel &thisModel = modelList[i];
+		for (size_t j = 0; j < selectedLods[i].size(); j++)
+		{
+			uint32_t lod = selectLod(thisModel.getMesh(j), modelTransforms[i], cameraPosition, lodPixelScale);
+
+			// Instances are drawn with the model's LOD, which has to be fine enough for the nearest of them
+			for (int instanceId : modelInstanceIds[i])
+			{
+				lod = std::min(lod, selectLod(thisModel.getMesh(j), instanceList[instanceId].transform, cameraPosition, lodPixelScale));
+			}
+			if (lod != selectedLods[i][j])
+			{
+				selectedLods[i][j] = lod;
+				lodsChanged = true;
+			}
+		}
+	}
+
+	if (lodsChanged)
+	{
+		sceneVersion++;
+	}
+
+	// Like a different LOD, a different set of visible meshes needs a new recording
+	if (!isGpuCullingActive() && cullScene())
+	{
+		sceneVersion++;
+	}
+}
+
+void VulkanRenderer::packSceneTransforms()
+{
+	// Positions only depend on which instances exist, so moving things keeps every transform where recorded draws expect it
+	sceneTransforms.clear();
+	modelFirstTransforms.resize(modelList.size());
+	instanceSlots.resize(instanceList.size());
+	for (size_t i = 0; i < modelList.size(); i++)
+	{
+		modelFirstTransforms[i] = static_cast<uint32_t>(sceneTransforms.size());
+		sceneTransforms.push_back(modelTransforms[i]);
+		for (size_t j = 0; j < modelInstanceIds[i].size(); j++)
+		{
+			instanceSlots[modelInstanceIds[i][j]] = static_cast<uint32_t>(j + 1);
+			sceneTransforms.push_back(instanceList[modelInstanceIds[i][j]].transform);
+		}
+	}
+}
+
+bool VulkanRenderer::cullScene()
+{
+	CPU_TRACE_SCOPE("cullScene");
+
+	// Visibility of every mesh under every transform it is drawn with, laid out like the transforms (model, then instances)
+	modelFirstCullObjects.resize(modelList.size());
+	uint32_t objectCount = 0;
+	for (size_t j = 0; j < modelList.size(); j++)
+	{
+		modelFirstCullObjects[j] = objectCount;
+		objectCount += static_cast<uint32_t>(modelList[j].getMeshCount() * (modelInstanceIds[j].size() + 1));
+	}
+	std::vector<uint8_t> newVisibility(objectCount, 0);
+
+	auto cullObject = [this](const SceneObject &object)
+	{
+		uint32_t instanceCount = static_cast<uint32_t>(modelInstanceIds[object.modelId].size() + 1);
+		uint32_t slot = object.instanceId < 0 ? 0 : instanceSlots[object.instanceId];
+		return modelFirstCullObjects[object.modelId] + object.mesh * instanceCount + slot;
+	};
+
+	// BVH subtrees completely inside are visible as a whole, only the meshes it can't decide on are tested exactly
+	Frustum frustum = Frustum::fromMatrix(uboViewProjection.projection * uboViewProjection.view);
+	std::vector<uint32_t> inside;
+	std::vector<uint32_t> intersecting;
+	sceneBvh.queryFrustum(frustum, &inside, &intersecting);
+	for (uint32_t proxy : inside)
+	{
+		newVisibility[cullObject(sceneObjects[proxy])] = 1;
+	}
+
+	frustumCuller.clear();
+	for (uint32_t proxy : intersecting)
+	{
+		const SceneObject &object = sceneObjects[proxy];
+		Mesh *thisMesh = modelList[object.modelId].getMesh(object.mesh);
+		frustumCuller.add(getObjectTransform(object), thisMesh->getBoundingBox(), thisMesh->getBounds());
+	}
+	frustumCuller.cull(frustum);
+	for (uint32_t i = 0; i < intersecting.size(); i++)
+	{
+		newVisibility[cullObject(sceneObjects[intersecting[i]])] = frustumCuller.isVisible(i) ? 1 : 0;
+	}
+
+	if (newVisibility == cullVisibility)
+	{
+		return false;
+	}
+	cullVisibility.swap(newVisibility);
+	return true;
+}
+
+void VulkanRenderer::insertSceneObjects(int modelId, int instanceId, std::vector<uint32_t> *proxies)
+{
+	// One BVH leaf per mesh, with its box in world space
+	MeshModel &thisModel = modelList[modelId];
+	glm::mat4 transform = instanceId < 0 ? modelTransforms[modelId] : instanceList[instanceId].transform;
+	for (size_t k = 0; k < thisModel.getMeshCount(); k++)
+	{
+		uint32_t proxy = sceneBvh.insert(transformBoundingBox(transform, thisModel.getMesh(k)->getBoundingBox()));
+		if (proxy >= sceneObjects.size())
+		{
+			sceneObjects.resize(proxy + 1);
+		}
+		sceneObjects[proxy] = { modelId, static_cast<uint32_t>(k), instanceId };
+		proxies->push_back(proxy);
+	}
+}
+
+void VulkanRenderer::updateSceneObjects(const std::vector<uint32_t> &proxies)
+{
+	// Refit, the BVH is only touched for meshes that moved out of their leaf's margin
+	for (uint32_t proxy : proxies)
+	{
+		const SceneObject &object = sceneObjects[proxy];
+		BoundingBox box = modelList[object.modelId].getMesh(object.mesh)->getBoundingBox();
+		sceneBvh.update(proxy, transformBoundingBox(getObjectTransform(object), box));
+	}
+}
+
+void VulkanRenderer::removeSceneObjects(std::vector<uint32_t> *proxies)
+{
+	for (uint32_t proxy : *proxies)
+	{
+		sceneBvh.remove(proxy);
+		sceneObjects[proxy] = SceneObject();
+	}
+	proxies->clear();
+}
+
+glm::mat4 VulkanRenderer::getObjectTransform(const SceneObject &object)
+{
+	return object.instanceId < 0 ? modelTransforms[object.modelId] : instanceList[object.instanceId].transform;
+}
+
 void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
-{	// Copy VP data
-	void *data;
-	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-	memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+{
+	// The image's last submission has finished, so its region of the scene buffer is free to overwrite, or to replace with
+	// a bigger one if the scene outgrew it. A new region starts out empty, and the sets and recordings using the old one are stale.
+	if (sceneBuffer.reserveTransforms(imageIndex, static_cast<uint32_t>(sceneTransforms.size())))
+	{
+		writeDescriptorSet(imageIndex);
+		gpuCuller.updateSceneBuffer(imageIndex);
+		writtenTransformVersion[imageIndex] = 0;
+		recordedSceneVersion[imageIndex] = 0;
+	}
+
+	sceneBuffer.writeViewProjection(imageIndex, &uboViewProjection);
+
+	// Copy Model data, only into regions that haven't seen the latest transforms yet
+	if (writtenTransformVersion[imageIndex] != transformVersion)
+	{
+		sceneBuffer.writeTransforms(imageIndex, sceneTransforms.data(), 0, static_cast<uint32_t>(sceneTransforms.size()));
+		writtenTransformVersion[imageIndex] = transformVersion;
+	}
 
 	// LEGACY - for reference. Replaced by push constants
 	//// Copy Model data
@@ -1344,10 +2160,13 @@ void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
 
 void VulkanRenderer::recordCommands(uint32_t currentImage)
 {
+	// Primary command buffer of this frame in flight, its pool was reset once the frame's fence signaled
+	VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+
 	// Information about how to begin each command buffer
 	VkCommandBufferBeginInfo bufferBeginInfo = {};
 	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;	// Buffer can be resubmitted when it has already been submitted and is awaiting execution
+	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;		// Recorded again every frame, only the secondary command buffers it executes are kept
 
 	// Information about how to begin a render pass (only needed for graphical applications)
 	VkRenderPassBeginInfo renderPassBeginInfo = {};
@@ -1367,73 +2186,452 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 	renderPassBeginInfo.framebuffer = swapchainFramebuffers[currentImage];
 
 	// Start recording commands to command buffer
-	VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to start recording a Command Buffer!");
 	}
 
-		// Begin Render Pass
-		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		// Timestamps for this frame in flight (queries can only be reset outside a render pass)
+		gpuProfiler.resetQueries(commandBuffer, currentFrame);
+		gpuProfiler.writeTimestamp(commandBuffer, currentFrame, GPU_TIMESTAMP_PASS_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+		// Visible draws of the image are generated for this frame's camera before the render pass reads them (dispatches can't be in one)
+		if (isOcclusionCullingActive())
+		{
+			Frustum frustum = Frustum::fromMatrix(uboViewProjection.projection * uboViewProjection.view);
 
-			// Bind Pipeline to be used in render pass
-			vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+			// Early pass: whatever was visible last frame, into the color and depth buffers
+			gpuCuller.recordCull(commandBuffer, currentImage, frustum, GPU_CULL_EARLY);
 
-			for (size_t j = 0; j < modelList.size(); j++)
-			{
-				MeshModel thisModel = modelList[j];
-				// "Push" constants to given shader directly (no buffer)
-				vkCmdPushConstants(
-					commandBuffers[currentImage], 
-					pipelineLayout,
-					VK_SHADER_STAGE_VERTEX_BIT,												// Stage of pipeline to push constants to
-					0,																		// Offset of push constants to update
-					sizeof(Model),															// Size of data being pushed
-					&thisModel.getModel()													// Actual data being pushed (can be array)
-				);	
-
-				for (size_t k = 0; k < thisModel.getMeshCount(); k++)
-				{
-					VkBuffer vertexBuffers[] = {thisModel.getMesh(k)->getVertexBuffer()};	// Buffers to bind
-					VkDeviceSize offsets[] = {0};											// Offsets into buffers being bound
-					vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);	// Command to bind vertex buffer before drawing with them
+			VkRenderPassBeginInfo earlyRenderPassBeginInfo = renderPassBeginInfo;
+			earlyRenderPassBeginInfo.renderPass = earlyRenderPass;
+			earlyRenderPassBeginInfo.framebuffer = earlyFramebuffers[currentImage];
+			earlyRenderPassBeginInfo.clearValueCount = 2;
+			earlyRenderPassBeginInfo.pClearValues = &clearValues[1];		// Color buffer and depth
 
-					// Bind mesh index buffer, with 0 offset and using the uint32 index type
-					vkCmdBindIndexBuffer(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBeginRenderPass(commandBuffer, &earlyRenderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+				vkCmdExecuteCommands(commandBuffer, 1, &earlyGeometryCommandBuffers[currentImage]);
+			vkCmdEndRenderPass(commandBuffer);
 
-					// LEGACY
-					// Dynamic Offset Amount
-					//uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * j;
+			// Late pass: everything else that isn't behind the early pass depth, drawn by the render pass on top of it
+			depthPyramid.recordBuild(commandBuffer, currentImage);
+			gpuCuller.recordCull(commandBuffer, currentImage, frustum, GPU_CULL_LATE);
+			renderPassBeginInfo.renderPass = lateRenderPass;
+		}
+		else if (isGpuCullingActive())
+		{
+			gpuCuller.recordCull(commandBuffer, currentImage, Frustum::fromMatrix(uboViewProjection.projection * uboViewProjection.view), GPU_CULL_FRUSTUM);
+		}
 
-					std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[thisModel.getMesh(k)->getTexId()]};
+		// Begin Render Pass, the geometry subpass only executes secondary command buffers
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-					// Bind Descriptor Sets
-					vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 
-						0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(geometryCommandCounts[currentImage]), geometryCommandBuffers[currentImage].data());
 
-					// Execute pipeline
-					vkCmdDrawIndexed(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
-				}
-			}
 			// Start second subpas
-			vkCmdNextSubpass(commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
 
-			vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
-			vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout, 
+			// Geometry subpass only allows vkCmdExecuteCommands, so its end is taken once everything before the second subpass is done
+			gpuProfiler.writeTimestamp(commandBuffer, currentFrame, GPU_TIMESTAMP_GEOMETRY_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout, 
 				0, 1, &inputDescriptorSets[currentImage], 0, nullptr);
-			vkCmdDraw(commandBuffers[currentImage], 3, 1, 0, 0);
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+			gpuProfiler.writeTimestamp(commandBuffer, currentFrame, GPU_TIMESTAMP_SECOND_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
 		// End Render Pass
-		vkCmdEndRenderPass(commandBuffers[currentImage]);
+		vkCmdEndRenderPass(commandBuffer);
+
+		gpuProfiler.writeTimestamp(commandBuffer, currentFrame, GPU_TIMESTAMP_PASS_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
 	// Stop recording to command buffer
-	result = vkEndCommandBuffer(commandBuffers[currentImage]);
+	result = vkEndCommandBuffer(commandBuffer);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to stop recording a Command Buffer!");
 	}
 }
 
+void VulkanRenderer::recordGeometrySubpass(uint32_t currentImage)
+{
+	if (isGpuCullingActive())
+	{
+		recordGpuGeometrySubpass(currentImage);
+		return;
+	}
+
+	// Visible draws of the drawable models, sorted by the state they need. The sort happens whenever the subpass is recorded,
+	// recordings are reused while things move, so the front to back order is the one from the last recording.
+	buildRenderQueue();
+	size_t drawCount = renderQueue.getCount();
+
+	// As many secondary command buffers as there are threads, unless there are too few draws to be worth it
+	size_t secondaryCount = std::max<size_t>(std::min(drawCount / MIN_DRAWS_PER_SECONDARY, geometryCommandBuffers[currentImage].size()), 1);
+
+	// The image's previous recordings have finished executing, so its secondary pools are freed as a whole
+	for (auto pool : secondaryCommandPools[currentImage])
+	{
+		vkResetCommandPool(mainDevice.logicalDevice, pool, 0);
+	}
+
+	// Record the first share on this thread while the record threads take the others (each thread records into its own pool)
+	std::vector<RenderQueueStats> secondaryStats(secondaryCount);
+	std::vector<std::future<VkResult>> secondaryResults;
+	for (size_t i = 1; i < secondaryCount; i++)
+	{
+		VkCommandBuffer secondary = geometryCommandBuffers[currentImage][i];
+		size_t drawBegin = drawCount * i / secondaryCount;
+		size_t drawEnd = drawCount * (i + 1) / secondaryCount;
+		RenderQueueStats *stats = &secondaryStats[i];
+
+		auto task = std::make_shared<std::packaged_task<VkResult()>>([this, secondary, currentImage, drawBegin, drawEnd, stats]()
+		{
+			return recordGeometryCommands(secondary, currentImage, drawBegin, drawEnd, stats);
+		});
+		secondaryResults.push_back(task->get_future());
+		recordThreads.enqueue([task]() { (*task)(); });
+	}
+
+	VkResult result = recordGeometryCommands(geometryCommandBuffers[currentImage][0], currentImage, 0, drawCount / secondaryCount, &secondaryStats[0]);
+	for (auto &secondaryResult : secondaryResults)
+	{
+		VkResult threadResult = secondaryResult.get();
+		if (threadResult != VK_SUCCESS)
+		{
+			result = threadResult;
+		}
+	}
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record a Secondary Command Buffer!");
+	}
+	geometryCommandCounts[currentImage] = secondaryCount;
+
+	renderQueueStats = RenderQueueStats();
+	for (const auto &stats : secondaryStats)
+	{
+		renderQueueStats.add(stats);
+	}
+}
+
+void VulkanRenderer::buildRenderQueue()
+{
+	renderQueue.clear();
+
+	for (size_t j = 0; j < modelList.size(); j++)
+	{
+		MeshModel &thisModel = modelList[j];
+
+		// Skip models still being uploaded
+		if (thisModel.getMeshCount() == 0 || !transferManager.isComplete(thisModel.getUploadTicket()))
+		{
+			continue;
+		}
+
+		// LEGACY - replaced by the model transforms in the scene buffer, which change without re-recording
+		// "Push" constants to given shader directly (no buffer)
+		//vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Model), &thisModel.getModel());
+
+		uint32_t instanceCount = static_cast<uint32_t>(modelInstanceIds[j].size() + 1);
+		for (size_t k = 0; k < thisModel.getMeshCount(); k++)
+		{
+			Mesh *thisMesh = thisModel.getMesh(k);
+			MeshLod lod = thisMesh->getLod(selectedLods[j][k]);
+
+			// Frustum culling result of the mesh under the model's and each instance's transform
+			const uint8_t *visible = &cullVisibility[modelFirstCullObjects[j] + k * instanceCount];
+
+			// One instance for the model and each of its instances, the vertex shader reads their transforms with gl_InstanceIndex.
+			// Culled instances split the draw, each run of visible ones is a draw of its own
+			for (uint32_t first = 0; first < instanceCount; )
+			{
+				if (!visible[first])
+				{
+					first++;
+					continue;
+				}
+
+				uint32_t last = first;
+				while (last < instanceCount && visible[last])
+				{
+					last++;
+				}
+
+				// Mesh's range of the page buffers given by firstIndex/vertexOffset (LODs are ranges of its indices)
+				RenderDraw draw = {};
+				draw.pipeline = 0;								// Geometry subpass only has the one pipeline so far
+				draw.texId = thisMesh->getTexId();
+				draw.geometryPage = thisMesh->getGeometryPage();
+				draw.indexCount = lod.indexCount;
+				draw.instanceCount = last - first;
+				draw.firstIndex = thisMesh->getFirstIndex() + lod.firstIndex;
+				draw.vertexOffset = thisMesh->getVertexOffset();
+				draw.firstInstance = modelFirstTransforms[j] + first;
+
+				// View depth of the bounding sphere centre of the run's first transform
+				glm::vec3 center = glm::vec3(sceneTransforms[draw.firstInstance] * glm::vec4(thisMesh->getBounds().center, 1.0f));
+				float depth = -(uboViewProjection.view * glm::vec4(center, 1.0f)).z;
+
+				renderQueue.push(draw, depth);
+				first = last;
+			}
+		}
+	}
+
+	renderQueue.sort();
+}
+
+VkResult VulkanRenderer::recordGeometryCommands(VkCommandBuffer commandBuffer, uint32_t currentImage, size_t drawBegin, size_t drawEnd,
+	RenderQueueStats *stats)
+{
+	// Runs on record threads: only reads the scene and reports failure through its result instead of throwing
+	VkResult result = beginGeometryCommands(commandBuffer, currentImage, false);
+	if (result != VK_SUCCESS)
+	{
+		return result;
+	}
+
+	// Nothing is inherited from the primary, so each secondary binds its state once and then only what changes between sorted draws
+	int boundGeometryPage = -1;
+	int boundTexId = -1;
+	bool sceneSetBound = false;
+
+	for (size_t i = drawBegin; i < drawEnd; i++)
+	{
+		const RenderDraw &draw = renderQueue.getDraw(i);
+
+		// Meshes share the buffers of their pool page, only rebind when the page changes
+		if (draw.geometryPage != boundGeometryPage)
+		{
+			boundGeometryPage = draw.geometryPage;
+
+			VkBuffer vertexBuffers[] = {geometryPool.getVertexBuffer(boundGeometryPage)};	// Buffers to bind
+			VkDeviceSize offsets[] = {0};													// Offsets into buffers being bound
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);				// Command to bind vertex buffer before drawing with them
+
+			// Bind page index buffer, with 0 offset and using the uint32 index type
+			vkCmdBindIndexBuffer(commandBuffer, geometryPool.getIndexBuffer(boundGeometryPage), 0, VK_INDEX_TYPE_UINT32);
+			stats->bindCount += 2;
+		}
+
+		// LEGACY - both sets were bound for every mesh
+		//std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[thisMesh->getTexId()]};
+		//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 
+		//	0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+
+		// ViewProjection and model transforms (this image's region of the scene buffer) are the same for every draw,
+		// the texture set is only bound again when the texture changes
+		if (!sceneSetBound)
+		{
+			std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[draw.texId] };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+				0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+			sceneSetBound = true;
+			boundTexId = draw.texId;
+			stats->bindCount++;
+		}
+		else if (draw.texId != boundTexId)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+				1, 1, &samplerDescriptorSets[draw.texId], 0, nullptr);
+			boundTexId = draw.texId;
+			stats->bindCount++;
+		}
+
+		vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+	}
+
+	// Against a descriptor set bind and a vertex and an index buffer bind for every draw
+	stats->drawCount = static_cast<uint32_t>(drawEnd - drawBegin);
+	stats->redundantBinds = stats->drawCount * 3 - stats->bindCount;
+
+	return vkEndCommandBuffer(commandBuffer);
+}
+
+void VulkanRenderer::recordGpuGeometrySubpass(uint32_t currentImage)
+{
+	// Draws sharing a geometry page and texture go in one batch, drawn by a single indirect call
+	std::map<std::pair<int, int>, uint32_t> batchIds;	// (page, texture) -> batch in order of first use
+	std::vector<GpuDrawBatch> batches;
+	std::vector<GpuCullDraw> draws;
+
+	// Visibility slots follow the meshes of every model and instance, drawable or not, so they stay put while other models finish uploading
+	uint32_t visibilitySlot = 0;
+	for (size_t j = 0; j < modelList.size(); j++)
+	{
+		// Instances are culled one by one, each is a draw of its own
+		uint32_t instanceCount = static_cast<uint32_t>(modelInstanceIds[j].size() + 1);
+		uint32_t firstVisibilitySlot = visibilitySlot;
+		visibilitySlot += static_cast<uint32_t>(modelList[j].getMeshCount()) * instanceCount;
+
+		// Skip models still being uploaded
+		if (modelList[j].getMeshCount() == 0 || !transferManager.isComplete(modelList[j].getUploadTicket()))
+		{
+			continue;
+		}
+
+		for (size_t k = 0; k < modelList[j].getMeshCount(); k++)
+		{
+			Mesh *thisMesh = modelList[j].getMesh(k);
+
+			auto batchId = batchIds.emplace(std::make_pair(thisMesh->getGeometryPage(), thisMesh->getTexId()), static_cast<uint32_t>(batches.size()));
+			if (batchId.second)
+			{
+				batches.push_back({ thisMesh->getGeometryPage(), thisMesh->getTexId(), 0, 0 });
+			}
+			batches[batchId.first->second].drawCount += instanceCount;
+
+			// LOD is still picked on the CPU, the GPU only decides whether it is drawn
+			BoundingSphere bounds = thisMesh->getBounds();
+			MeshLod lod = thisMesh->getLod(selectedLods[j][k]);
+
+			for (uint32_t i = 0; i < instanceCount; i++)
+			{
+				uint32_t slot = firstVisibilitySlot + static_cast<uint32_t>(k) * instanceCount + i;
+
+				GpuCullDraw draw = {};
+				draw.bounds = glm::vec4(bounds.center, bounds.radius);
+				draw.indexCount = lod.indexCount;
+				draw.firstIndex = thisMesh->getFirstIndex() + lod.firstIndex;
+				draw.vertexOffset = static_cast<int32_t>(thisMesh->getVertexOffset());
+				draw.transformIndex = modelFirstTransforms[j] + i;
+				draw.batch = batchId.first->second;
+				draw.visibilitySlot = slot < GPU_CULL_VISIBILITY_SLOTS ? slot : GPU_CULL_NO_VISIBILITY;
+				draws.push_back(draw);
+			}
+		}
+	}
+
+	// Number batches in (page, texture) order so each page is bound once, each gets a range of the command buffer big enough for all of its draws
+	std::vector<GpuDrawBatch> orderedBatches;
+	std::vector<uint32_t> orderedIds(batches.size());
+	uint32_t commandCount = 0;
+	for (const auto &batchId : batchIds)
+	{
+		GpuDrawBatch batch = batches[batchId.second];
+		batch.firstCommand = commandCount;
+		commandCount += batch.drawCount;
+
+		orderedIds[batchId.second] = static_cast<uint32_t>(orderedBatches.size());
+		orderedBatches.push_back(batch);
+	}
+	for (auto &draw : draws)
+	{
+		draw.batch = orderedIds[draw.batch];
+		draw.firstCommand = orderedBatches[draw.batch].firstCommand;
+	}
+
+	// The image's last submission has finished, so its draws and secondary pools are free to replace
+	gpuCuller.setDraws(currentImage, draws, static_cast<uint32_t>(orderedBatches.size()));
+	for (auto pool : secondaryCommandPools[currentImage])
+	{
+		vkResetCommandPool(mainDevice.logicalDevice, pool, 0);
+	}
+
+	// A handful of commands per batch, not worth spreading over the record threads
+	if (isOcclusionCullingActive())
+	{
+		recordGpuBatchDraws(earlyGeometryCommandBuffers[currentImage], currentImage, GPU_CULL_EARLY, orderedBatches);
+		recordGpuBatchDraws(geometryCommandBuffers[currentImage][0], currentImage, GPU_CULL_LATE, orderedBatches);
+	}
+	else
+	{
+		recordGpuBatchDraws(geometryCommandBuffers[currentImage][0], currentImage, GPU_CULL_FRUSTUM, orderedBatches);
+	}
+	geometryCommandCounts[currentImage] = 1;
+}
+
+void VulkanRenderer::recordGpuBatchDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, GpuCullPass pass, const std::vector<GpuDrawBatch> &batches)
+{
+	// Early pass draws go in the early render pass, the others in the geometry subpass
+	VkResult result = beginGeometryCommands(commandBuffer, currentImage, pass == GPU_CULL_EARLY);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record a Secondary Command Buffer!");
+	}
+
+		int boundGeometryPage = -1;
+		for (uint32_t i = 0; i < batches.size(); i++)
+		{
+			const GpuDrawBatch &batch = batches[i];
+
+			if (batch.geometryPage != boundGeometryPage)
+			{
+				boundGeometryPage = batch.geometryPage;
+
+				VkBuffer vertexBuffers[] = {geometryPool.getVertexBuffer(boundGeometryPage)};
+				VkDeviceSize offsets[] = {0};
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+				vkCmdBindIndexBuffer(commandBuffer, geometryPool.getIndexBuffer(boundGeometryPage), 0, VK_INDEX_TYPE_UINT32);
+			}
+
+			std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[batch.texId]};
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+				0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+
+			// Draws whichever of the batch's draws the cull shader kept for this pass
+			gpuCuller.recordDraws(commandBuffer, currentImage, pass, i, batch.firstCommand, batch.drawCount);
+		}
+
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record a Secondary Command Buffer!");
+	}
+}
+
+VkResult VulkanRenderer::beginGeometryCommands(VkCommandBuffer commandBuffer, uint32_t currentImage, bool early)
+{
+	// Secondary command buffers continue the geometry subpass of the image's framebuffer (or the early render pass)
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = early ? earlyRenderPass : renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = early ? earlyFramebuffers[currentImage] : swapchainFramebuffers[currentImage];
+
+	VkCommandBufferBeginInfo bufferBeginInfo = {};
+	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;		// Kept until the scene changes, but never pending twice (the image's fence is waited on)
+	bufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		return result;
+	}
+
+	// Bind Pipeline to be used in render pass (no state is inherited from the primary command buffer)
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, early ? earlyGraphicsPipeline : graphicsPipeline);
+	return VK_SUCCESS;
+}
+
+uint32_t VulkanRenderer::selectLod(Mesh *mesh, const glm::mat4 &model, glm::vec3 cameraPosition, float pixelScale)
+{
+	if (mesh->getLodCount() < 2) return 0;
+
+	// Bounding sphere in world space, scaled by the largest axis scale of the model matrix (which scales the error too)
+	BoundingSphere bounds = mesh->getBounds();
+	glm::vec3 center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+	float scale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+		std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+
+	// Nearest point of the sphere, camera inside it gets full detail
+	float distance = glm::length(center - cameraPosition) - bounds.radius * scale;
+	if (distance <= 0.0f) return 0;
+
+	// Coarsest LOD whose error projects to no more than the threshold, each bias step doubles it
+	float threshold = LOD_ERROR_PIXELS * std::exp2(lodBias);
+	uint32_t lod = 0;
+	while (lod + 1 < mesh->getLodCount() && mesh->getLod(lod + 1).error * scale / distance * pixelScale <= threshold)
+	{
+		lod++;
+	}
+	return lod;
+}
+
 void VulkanRenderer::getPhysicalDevice()
 {
 	// Enumerate Physical Devices the vkInstance can access
@@ -1522,13 +2720,13 @@ bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 	if (extensionCount == 0)
 	{
-		return false;
+		return getRequiredDeviceExtensions().empty();
 	}
 	std::vector<VkExtensionProperties> extensions(extensionCount);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
 
 	// Check for extension
-	for (const auto &deviceExtension : deviceExtensions)
+	for (const auto &deviceExtension : getRequiredDeviceExtensions())
 	{
 		bool hasExtension = false;
 		for (const auto &extension : extensions)
@@ -1564,8 +2762,9 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 
 	bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-	bool swapChainValid = false;
-	if (extensionsSupported)
+	// Headless rendering never creates a swapchain
+	bool swapChainValid = headless;
+	if (extensionsSupported && !headless)
 	{
 		SwapChainDetails swapChainDetails = getSwapChainDetails(device);
 		swapChainValid = !swapChainDetails.presentationModes.empty() && !swapChainDetails.formats.empty();
@@ -1607,6 +2806,16 @@ bool VulkanRenderer::checkValidationLayerSupport()
 }
 
 
+std::vector<const char*> VulkanRenderer::getRequiredDeviceExtensions()
+{
+	// Without a surface there is nothing to create a swapchain for
+	if (headless)
+	{
+		return {};
+	}
+	return deviceExtensions;
+}
+
 QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 {
 	QueueFamilyIndices indices;
@@ -1630,7 +2839,15 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 
 		// Check if queue family supports presentation
 		VkBool32 presentationSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		if (headless)
+		{
+			// Offscreen targets are "presented" by the queue that rendered them
+			presentationSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		}
+		else
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		}
 
 		// Check if queue is presentation type (can be both graphics and presentation)
 		if (queueFamily.queueCount > 0 && presentationSupport)
@@ -1646,6 +2863,23 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 		i++;
 	}
 
+	// Uploads go to a transfer-only family if there is one (copy engine, runs alongside rendering),
+	// then to any other non-graphics family, and otherwise share the graphics family
+	indices.transferFamily = indices.graphicsFamily;
+	for (int pass = 0; pass < 2 && indices.transferFamily == indices.graphicsFamily; pass++)
+	{
+		for (uint32_t j = 0; j < queueFamilyCount; j++)
+		{
+			VkQueueFlags flags = queueFamilyList[j].queueFlags;
+			VkQueueFlags excluded = pass == 0 ? (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT) : VK_QUEUE_GRAPHICS_BIT;
+			if (queueFamilyList[j].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & excluded))
+			{
+				indices.transferFamily = static_cast<int>(j);
+				break;
+			}
+		}
+	}
+
 	return indices;
 }
 
@@ -1810,7 +3044,7 @@ VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat>& form
 	throw std::runtime_error("Failed to find a matching format!");
 }
 
-VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propertyFlags, VkDeviceMemory * imageMemory)
+VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propertyFlags, MemoryAllocation * imageMemory)
 {
 	// CREATE IMAGE
 	VkImageCreateInfo imageCreateInfo = {};
@@ -1819,7 +3053,7 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	imageCreateInfo.extent.width = width;
 	imageCreateInfo.extent.height = height;
 	imageCreateInfo.extent.depth = 1;									// 1 for 2D image
-	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.mipLevels = mipLevels;								// Number of mipmap levels
 	imageCreateInfo.arrayLayers = 1;									// Number of levels in image array
 	imageCreateInfo.format = format;
 	imageCreateInfo.tiling = tiling;									// How image data should be tiled (arranged for optimal reading)
@@ -1841,25 +3075,16 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	VkMemoryRequirements memoryRequirements;
 	vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
 
-	// Allocate memory using image requirements and user defined properties
-	VkMemoryAllocateInfo memoryAllocateInfo = {};
-	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocateInfo.allocationSize = memoryRequirements.size;
-	memoryAllocateInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propertyFlags);
-
-	result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocateInfo, nullptr, imageMemory);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate memory for Image!");
-	}
+	// Allocate memory using image requirements and user defined properties (full-screen targets end up as dedicated allocations)
+	*imageMemory = memoryAllocator.allocate(memoryRequirements, propertyFlags, tiling == VK_IMAGE_TILING_LINEAR);
 
 	// Connect memory to image
-	vkBindImageMemory(mainDevice.logicalDevice, image, *imageMemory, 0);
+	vkBindImageMemory(mainDevice.logicalDevice, image, imageMemory->memory, imageMemory->offset);
 
 	return image;
 }
 
-VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
 {
 	VkImageViewCreateInfo viewCreateInfo = {};
 	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1874,7 +3099,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	// Subresources allow the view to view only a part of an image
 	viewCreateInfo.subresourceRange.aspectMask = aspectFlags;					// Which aspect of image to view (e.g. COLOR_BIT for viewing color)
 	viewCreateInfo.subresourceRange.baseMipLevel = 0;							// Start mipmap level to view from
-	viewCreateInfo.subresourceRange.levelCount = 1;								// Number of mipmap levels to view
+	viewCreateInfo.subresourceRange.levelCount = mipLevels;						// Number of mipmap levels to view
 	viewCreateInfo.subresourceRange.baseArrayLayer = 0;							// Start array level to view from
 	viewCreateInfo.subresourceRange.layerCount = 1;								// Number of array layers to view
 
@@ -1906,72 +3131,305 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 	return shaderModule;
 }
 
-int VulkanRenderer::createTextureImage(std::string fileName)
+VkImage VulkanRenderer::createTextureImage(uint32_t width, uint32_t height, uint32_t mipLevels, MemoryAllocation *imageMemory)
 {
-	// Load image file
-	int width, height;
-	VkDeviceSize imageSize;
-	stbi_uc *imageData = loadTextureFile(fileName, &width, &height, &imageSize);
+	// Create image to hold final texture (transfer source for the blits between its own levels)
+	return createImage(width, height, mipLevels, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
+		imageMemory);
+}
 
-	// Create staging buffer to hold loaded data, ready to copy to device
-	VkBuffer imageStagingBuffer;
-	VkDeviceMemory imageStagingBufferMemory;
-	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		&imageStagingBuffer, &imageStagingBufferMemory);
-	// Copy image data to staging buffer
-	void *data;
-	vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, imageData, static_cast<size_t>(imageSize));
-	vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
+void * VulkanRenderer::reserveTextureUpload(const std::string &fileName, const std::vector<char> &fileData, UploadBatch *uploadBatch,
+	VkImage *image, MemoryAllocation *imageMemory, int *width, int *height, uint32_t *mipLevels)
+{
+	// Only the header is read here, the size is all that is needed to create the image and its staging memory
+	TextureLoader::readInfo(fileName, fileData, width, height);
+	*mipLevels = getMipLevelCount(*width, *height);
+	*image = createTextureImage(*width, *height, *mipLevels, imageMemory);
 
-	// Free original image data
-	stbi_image_free(imageData);
+	// COPY DATA TO IMAGE
+	// Decoded straight into the staging memory, copied on the transfer queue with the rest of the batch and left shader readable.
+	// Either level 0 only (the rest is blitted from it on the graphics queue) or, if the format can't be blitted, every level.
+	VkDeviceSize stagingSize = TextureLoader::getDecodeSize(*width, *height, *mipLevels, !textureBlitSupported);
+	return uploadBatch->reserveImage(stagingSize, *image, *width, *height, *mipLevels, textureBlitSupported);
+}
 
-	// Create image to hold final texture
-	VkImage texImage;
-	VkDeviceMemory texImageMemory;
-	texImage = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-		&texImageMemory);
+int VulkanRenderer::createTexture(std::string fileName, UploadBatch *uploadBatch)
+{
+	CPU_TRACE_SCOPE("createTexture");
 
-	// COPY DATA TO IMAGE
-	// Transition image to be DST for copy operation
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, 
-		texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	// Already loaded under this name: share it without reading the file, decoding or uploading anything
+	std::string filePath = TextureCache::resolvePath(fileName);
+	int cachedTexture = textureCache.acquireByPath(filePath);
+	if (cachedTexture >= 0)
+	{
+		return cachedTexture;
+	}
 
-	// Copy image data
-	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, imageStagingBuffer, texImage, width, height);
+	CookedTextureFile cookedTexture;
+	std::vector<char> fileData;
+	uint64_t contentHash;
+	bool cooked = readTextureSource(fileName, filePath, &cookedTexture, &fileData, &contentHash);
 
-	// Transition image to be shader readable for shader usage
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, 
-		texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// Same image under another name: still only hashed, not decoded
+	cachedTexture = textureCache.acquireByContent(filePath, contentHash);
+	if (cachedTexture >= 0)
+	{
+		return cachedTexture;
+	}
 
-	// Add texture data to vector for reference
-	textureImages.push_back(texImage);
-	texturesImageMemory.push_back(texImageMemory);
+	int textureId;
+	if (cooked)
+	{
+		textureId = createCookedTexture(cookedTexture, uploadBatch);
+	}
+	else
+	{
+		VkImage image;
+		MemoryAllocation imageMemory;
+		int width, height;
+		uint32_t mipLevels;
+		void *stagingMemory = reserveTextureUpload(fileName, fileData, uploadBatch, &image, &imageMemory, &width, &height, &mipLevels);
+		TextureLoader::decode(fileName, fileData, stagingMemory, width, height, mipLevels, !textureBlitSupported);
 
-	// Destroy staging buffers
-	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+		textureId = addTexture(image, imageMemory, mipLevels);
+	}
+	textureCache.insert(textureId, filePath, contentHash);
 
-	// Return index of new texture image
-	return textureImages.size() - 1;
+	// Return location of set with texture
+	return textureId;
 }
 
-int VulkanRenderer::createTexture(std::string fileName)
+std::vector<int> VulkanRenderer::createTextures(const std::vector<std::string> &fileNames, std::vector<int> *textureIds)
 {
-	// Create texture image and get its location in array
-	int textureImageLoc = createTextureImage(fileName);
+	CPU_TRACE_SCOPE("createTextures");
 
-	VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-	textureImageViews.push_back(imageView);
+	// Texture of each file name, 0 (default texture) for empty names
+	std::vector<int> textures(fileNames.size(), 0);
 
-	// Create Texture Descriptor
-	int descriptorLoc = createTextureDescriptor(imageView);
+	// Decodes in flight, and the files waiting for each of them
+	struct PendingTexture
+	{
+		uint64_t contentHash;
+		std::vector<std::pair<size_t, std::string>> requests;		// Index into fileNames, resolved path
+		UploadBatch uploadBatch;									// Holds the staging memory the texture is decoded into
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation imageMemory;
+		uint32_t mipLevels;
+	};
+	std::unordered_map<size_t, PendingTexture> pendingTextures;
+	std::unordered_map<std::string, size_t> pendingPaths;
+	std::unordered_map<uint64_t, size_t> pendingHashes;
 
-	// Return location of set with texture
-	return descriptorLoc;
+	// Cooked textures need no decode, they are staged right away and submitted before waiting on any decode
+	UploadBatch cookedBatch = transferManager.beginBatch();
+
+	// First error, thrown once every decode queued here has finished (until then they write into staging memory)
+	std::string error;
+
+	// References taken before this call, on failure every one after them is released again
+	size_t firstTextureId = textureIds->size();
+
+	// Queue every file not loaded yet, each file only once
+	try
+	{
+		for (size_t i = 0; i < fileNames.size(); i++)
+		{
+			if (fileNames[i].empty()) continue;
+
+			std::string filePath = TextureCache::resolvePath(fileNames[i]);
+			int cachedTexture = textureCache.acquireByPath(filePath);
+			if (cachedTexture >= 0)
+			{
+				textures[i] = cachedTexture;
+				textureIds->push_back(cachedTexture);
+				continue;
+			}
+
+			auto pendingPath = pendingPaths.find(filePath);
+			if (pendingPath != pendingPaths.end())
+			{
+				pendingTextures[pendingPath->second].requests.push_back({ i, filePath });
+				continue;
+			}
+
+			CookedTextureFile cookedTexture;
+			std::vector<char> fileData;
+			uint64_t contentHash;
+			bool cooked = readTextureSource(fileNames[i], filePath, &cookedTexture, &fileData, &contentHash);
+			cachedTexture = textureCache.acquireByContent(filePath, contentHash);
+			if (cachedTexture >= 0)
+			{
+				textures[i] = cachedTexture;
+				textureIds->push_back(cachedTexture);
+				continue;
+			}
+
+			auto pendingHash = pendingHashes.find(contentHash);
+			if (pendingHash != pendingHashes.end())
+			{
+				pendingTextures[pendingHash->second].requests.push_back({ i, filePath });
+				pendingPaths[filePath] = pendingHash->second;
+				continue;
+			}
+
+			if (cooked)
+			{
+				// In the cache straight away, so later requests for it are plain cache hits
+				int textureId = createCookedTexture(cookedTexture, &cookedBatch);
+				textureCache.insert(textureId, filePath, contentHash);
+				textures[i] = textureId;
+				textureIds->push_back(textureId);
+				continue;
+			}
+
+			PendingTexture pending;
+			pending.contentHash = contentHash;
+			pending.requests.push_back({ i, filePath });
+			pending.uploadBatch = transferManager.beginBatch();
+
+			size_t job;
+			try
+			{
+				int width, height;
+				void *stagingMemory = reserveTextureUpload(fileNames[i], fileData, &pending.uploadBatch, &pending.image, &pending.imageMemory,
+					&width, &height, &pending.mipLevels);
+
+				job = textureLoader.decodeAsync(fileNames[i], std::move(fileData), stagingMemory, width, height,
+					pending.mipLevels, !textureBlitSupported);
+			}
+			catch (...)
+			{
+				// Not queued, so nothing else owns the image or the staging memory reserved for it
+				if (pending.image != VK_NULL_HANDLE)
+				{
+					vkDestroyImage(mainDevice.logicalDevice, pending.image, nullptr);
+					memoryAllocator.free(pending.imageMemory);
+				}
+				transferManager.discardBatch(pending.uploadBatch);
+				throw;
+			}
+			pendingTextures[job] = pending;
+			pendingPaths[filePath] = job;
+			pendingHashes[contentHash] = job;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		// Stop queueing, the decodes already queued are still waited for and cleaned up below
+		error = e.what();
+	}
+
+	transferManager.submitBatch(cookedBatch);
+
+	// Upload whatever has finished decoding, so the copies of the first textures run while the slower ones still decode
+	while (!pendingTextures.empty())
+	{
+		std::vector<TextureDecode> decoded = textureLoader.waitDecoded();
+
+		UploadBatch uploadBatch = transferManager.beginBatch();
+		for (auto &decode : decoded)
+		{
+			auto pendingTexture = pendingTextures.find(decode.job);
+			if (pendingTexture == pendingTextures.end())
+			{
+				// Not queued by this call
+				continue;
+			}
+
+			PendingTexture &pending = pendingTexture->second;
+			if (!decode.error.empty())
+			{
+				// Nothing gets uploaded into the image, it and its staging memory go right away
+				if (error.empty())
+				{
+					error = decode.error;
+				}
+				vkDestroyImage(mainDevice.logicalDevice, pending.image, nullptr);
+				memoryAllocator.free(pending.imageMemory);
+				transferManager.discardBatch(pending.uploadBatch);
+				pendingTextures.erase(pendingTexture);
+				continue;
+			}
+
+			uploadBatch.append(pending.uploadBatch);
+			int textureId = addTexture(pending.image, pending.imageMemory, pending.mipLevels);
+
+			// First request holds the reference taken on insert, every other one takes its own (and adds its path)
+			textureCache.insert(textureId, pending.requests[0].second, pending.contentHash);
+			for (size_t r = 0; r < pending.requests.size(); r++)
+			{
+				if (r > 0)
+				{
+					textureCache.acquireByContent(pending.requests[r].second, pending.contentHash);
+				}
+				textures[pending.requests[r].first] = textureId;
+				textureIds->push_back(textureId);
+			}
+			pendingTextures.erase(pendingTexture);
+		}
+		transferManager.submitBatch(uploadBatch);
+	}
+
+	// Caller never gets textureIds back, so the textures that did load are released here (destroyed once their
+	// uploads and any frame using them are done, unless another model shares them)
+	if (!error.empty())
+	{
+		for (size_t i = firstTextureId; i < textureIds->size(); i++)
+		{
+			releaseTexture((*textureIds)[i]);
+		}
+		textureIds->resize(firstTextureId);
+		throw std::runtime_error(error);
+	}
+
+	return textures;
+}
+
+int VulkanRenderer::createCookedTexture(CookedTextureFile &cookedTexture, UploadBatch *uploadBatch)
+{
+	CPU_TRACE_SCOPE("createCookedTexture");
+
+	// Every level was built by the cooker, so the data is copied into staging as it is and nothing is blitted
+	MemoryAllocation imageMemory;
+	VkImage image = createTextureImage(cookedTexture.getWidth(), cookedTexture.getHeight(), cookedTexture.getMipLevels(), &imageMemory);
+	uploadBatch->uploadImage(cookedTexture.getData(), cookedTexture.getDataSize(), image,
+		cookedTexture.getWidth(), cookedTexture.getHeight(), cookedTexture.getMipLevels(), false);
+
+	return addTexture(image, imageMemory, cookedTexture.getMipLevels());
+}
+
+int VulkanRenderer::addTexture(VkImage image, MemoryAllocation imageMemory, uint32_t mipLevels)
+{
+	VkImageView imageView = createImageView(image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+
+	// Texture id is the location of its descriptor set, which is also its location in the texture arrays
+	int textureId;
+	if (!freeTextureIds.empty())
+	{
+		// Reuse the slot and descriptor set of a destroyed texture
+		textureId = freeTextureIds.back();
+		freeTextureIds.pop_back();
+
+		textureImages[textureId] = image;
+		texturesImageMemory[textureId] = imageMemory;
+		textureImageViews[textureId] = imageView;
+		writeTextureDescriptor(samplerDescriptorSets[textureId], imageView);
+	}
+	else
+	{
+		textureImages.push_back(image);
+		texturesImageMemory.push_back(imageMemory);
+		textureImageViews.push_back(imageView);
+
+		// Create Texture Descriptor
+		textureId = createTextureDescriptor(imageView);
+	}
+
+	// Recordings that bound the slot's old descriptor set are invalid now
+	sceneVersion++;
+
+	return textureId;
 }
 
 int VulkanRenderer::createTextureDescriptor(VkImageView textureImageView)
@@ -1992,6 +3450,17 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImageView)
 		throw std::runtime_error("Failed to allocate Texture Descriptor Sets!");
 	}
 
+	writeTextureDescriptor(descriptorSet, textureImageView);
+
+	// Add descriptor set to list
+	samplerDescriptorSets.push_back(descriptorSet);
+
+	// Return descriptor set location
+	return samplerDescriptorSets.size() - 1;
+}
+
+void VulkanRenderer::writeTextureDescriptor(VkDescriptorSet descriptorSet, VkImageView textureImageView)
+{
 	// Texture Image Info
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;				// Image layout when in use
@@ -2008,21 +3477,88 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImageView)
 	descriptorWrite.descriptorCount = 1;
 	descriptorWrite.pImageInfo = &imageInfo;
 
-	// Update new descriptor set
+	// Update descriptor set
 	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
+}
 
-	// Add descriptor set to list
-	samplerDescriptorSets.push_back(descriptorSet);
+void VulkanRenderer::releaseTexture(int textureId)
+{
+	// Still used by another material or model
+	if (!textureCache.release(textureId)) return;
 
-	// Return descriptor set location
-	return samplerDescriptorSets.size() - 1;
+	VkImage image = textureImages[textureId];
+	VkImageView imageView = textureImageViews[textureId];
+	MemoryAllocation imageMemory = texturesImageMemory[textureId];
+	textureImages[textureId] = VK_NULL_HANDLE;
+	textureImageViews[textureId] = VK_NULL_HANDLE;
+
+	deferDestroy([this, textureId, image, imageView, imageMemory]()
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, imageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, image, nullptr);
+		memoryAllocator.free(imageMemory);
+
+		// Descriptor set is no longer bound by any frame, so it can be rewritten for a new texture
+		freeTextureIds.push_back(textureId);
+	});
+}
+
+void VulkanRenderer::deferDestroy(std::function<void()> destroy)
+{
+	DeferredDestroy deferred;
+	deferred.frame = frameCount;
+	deferred.ticket = transferManager.getLastSubmitted();
+	deferred.destroy = destroy;
+	deferredDestroys.push_back(deferred);
+}
+
+void VulkanRenderer::runDeferredDestroys(bool waitedIdle)
+{
+	// Released in order, so stop at the first one that may still be in use
+	while (!deferredDestroys.empty())
+	{
+		DeferredDestroy &deferred = deferredDestroys.front();
+
+		// Every frame recorded before the release has finished once MAX_FRAME_DRAWS more have been submitted
+		bool framesDone = frameCount >= deferred.frame + MAX_FRAME_DRAWS;
+		if (!waitedIdle && (!framesDone || !transferManager.isComplete(deferred.ticket)))
+		{
+			break;
+		}
+
+		deferred.destroy();
+		deferredDestroys.pop_front();
+	}
 }
 
 int VulkanRenderer::createMeshModel(std::string modelFile)
 {
-	// Import model "scene"
+	return createMeshModel(modelFile, CookedMeshFile::getCookedPath(modelFile));
+}
+
+int VulkanRenderer::createMeshModel(std::string modelFile, std::string cookedFile)
+{
+	CPU_TRACE_SCOPE("createMeshModel");
+
+	// Cooked version of the model if there is one and it is up to date: mapped and copied into staging as it is
+	CookedMeshFile cookedMesh;
+	if (cookedMesh.open(cookedFile))
+	{
+		if (isCookedMeshCurrent(cookedMesh, modelFile))
+		{
+			return createCookedMeshModel(cookedMesh);
+		}
+		printf("WARNING: %s is out of date (run AssetCooker), importing %s instead\n", cookedFile.c_str(), modelFile.c_str());
+		cookedMesh.close();
+	}
+
+	// Otherwise import model "scene" from the source file
 	Assimp::Importer importer;
-	const aiScene *scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+	const aiScene *scene;
+	{
+		CPU_TRACE_SCOPE("Assimp ReadFile");
+		scene = importer.ReadFile(modelFile, MESH_IMPORT_FLAGS);
+	}
 
 	if(!scene)
 	{
@@ -2032,52 +3568,133 @@ int VulkanRenderer::createMeshModel(std::string modelFile)
 	// Get vector of all materials with 1:1 ID placement
 	std::vector<std::string> textureNames = MeshModel::LoadMaterials(scene);
 
-	// Conversion from the materials list IDs to our Descriptor Array IDs
-	std::vector<int> matToTex(textureNames.size());
+	// Every texture reference the model takes, dropped again when it is destroyed
+	std::vector<int> textureIds;
+
+	// Conversion from the materials list IDs to our Descriptor Array IDs. Materials without a texture get '0',
+	// texture 0 is reserved for a default texture. Textures are decoded in parallel and uploaded as they finish.
+	std::vector<int> matToTex = createTextures(textureNames, &textureIds);
 
-	// Loop over textureNames and create textures form them
-	for (size_t i = 0; i < textureNames.size(); i++)
+	// Geometry of the whole model goes into one batch: one submit and one fence
+	UploadBatch uploadBatch = transferManager.beginBatch();
+
+	// Load in all our meshes
+	MeshOptimizeReport optimizeReport;
+	std::vector<Mesh> modelMeshes = MeshModel::LoadNode(&geometryPool, &uploadBatch, 
+		scene->mRootNode, scene, matToTex, meshOptimizeOptions, &optimizeReport);
+
+	int modelId = addMeshModel(modelMeshes, textureIds, uploadBatch);
+	modelList[modelId].setOptimizeReport(optimizeReport);
+	return modelId;
+}
+
+bool VulkanRenderer::isCookedMeshCurrent(CookedMeshFile &cookedMesh, const std::string &modelFile)
+{
+	CPU_TRACE_SCOPE("isCookedMeshCurrent");
+
+	// Shipped without its source: nothing to compare against, the cooked file is all there is
+	if (!std::ifstream(modelFile).good())
 	{
-		// If material had no texture, set '0' to indicate no texture, texture 0 will be reserved for a default texture
-		if(textureNames[i].empty())
-		{
-			matToTex[i] = 0;
-		}
-		else
-		{
-			// Otherwise, create texture and set value to index of new texture
-			matToTex[i] = createTexture(textureNames[i]);
-		}
+		return true;
 	}
 
-	// Load in all our meshes
-	std::vector<Mesh> modelMeshes = MeshModel::LoadNode(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, 
-		scene->mRootNode, scene, matToTex);
+	// Same check the cooker makes before skipping a model: cooked by this cooker, from the source as it is now,
+	// with the settings this renderer imports with
+	if (cookedMesh.getCookerVersion() != COOKER_VERSION)
+	{
+		return false;
+	}
+	uint64_t sourceHash = CookedMeshFile::hashSource(TextureCache::hashContent(readFile(modelFile)), meshOptimizeOptions);
+	return cookedMesh.getSourceHash() == sourceHash;
+}
+
+int VulkanRenderer::createCookedMeshModel(CookedMeshFile &cookedMesh)
+{
+	CPU_TRACE_SCOPE("createCookedMeshModel");
 
+	std::vector<int> textureIds;
+	std::vector<int> matToTex = createTextures(cookedMesh.getTextureNames(), &textureIds);
+
+	UploadBatch uploadBatch = transferManager.beginBatch();
+
+	// Vertices are already in their final layout, each mesh is one copy from the mapping into staging
+	std::vector<Mesh> modelMeshes;
+	for (uint32_t i = 0; i < cookedMesh.getMeshCount(); i++)
+	{
+		const CookedMeshEntry &mesh = cookedMesh.getMesh(i);
+		modelMeshes.push_back(Mesh(&geometryPool, &uploadBatch,
+			cookedMesh.getVertices() + mesh.firstVertex, mesh.vertexCount,
+			cookedMesh.getIndices() + mesh.firstIndex, mesh.indexCount,
+			matToTex[mesh.materialIndex]));
+		modelMeshes.back().setLods(cookedMesh.getLods(i), cookedMesh.getBounds(i));
+		modelMeshes.back().setBoundingBox(cookedMesh.getBoundingBox(i));
+	}
+
+	return addMeshModel(modelMeshes, textureIds, uploadBatch);
+}
+
+int VulkanRenderer::addMeshModel(std::vector<Mesh> modelMeshes, std::vector<int> textureIds, UploadBatch &uploadBatch)
+{
 	// Create MeshModel and add to list
 	MeshModel meshModel = MeshModel(modelMeshes);
+	meshModel.setTextureIds(textureIds);
+
+	// Returns before the data is resident, model gets drawn once its batch has completed (after the texture batches)
+	meshModel.setUploadTicket(transferManager.submitBatch(uploadBatch));
 	modelList.push_back(meshModel);
 
+	// New slot in the scene buffer, LODs are selected on the next frame
+	modelTransforms.push_back(meshModel.getModel());
+	selectedLods.push_back(std::vector<uint32_t>(meshModel.getMeshCount(), 0));
+	modelInstanceIds.push_back(std::vector<int>());
+	modelProxies.push_back(std::vector<uint32_t>());
+	insertSceneObjects(static_cast<int>(modelList.size() - 1), -1, &modelProxies.back());
+	transformVersion++;
+	sceneVersion++;
+
 	return modelList.size() - 1;
 }
 
-stbi_uc * VulkanRenderer::loadTextureFile(std::string fileName, int * width, int * height, VkDeviceSize * imageSize)
+bool VulkanRenderer::readTextureSource(const std::string &fileName, const std::string &filePath, CookedTextureFile *cookedTexture,
+	std::vector<char> *fileData, uint64_t *contentHash)
 {
-	// Num of channels image uses
-	int channels;
+	// Cooked files store the hash of the image they were cooked from, so cooked and uncooked copies of an image share a cache entry
+	std::string cookedPath = CookedTextureFile::getCookedPath(filePath);
+	if (cookedTexture->open(cookedPath))
+	{
+		// Shipped without its source: nothing to compare against, the cooked file is all there is
+		if (!std::ifstream(filePath).good())
+		{
+			*contentHash = cookedTexture->getSourceHash();
+			return true;
+		}
+
+		// Same check the cooker makes before skipping a texture: cooked by this cooker, from the image as it is now
+		*fileData = readTextureFile(fileName, filePath);
+		*contentHash = TextureCache::hashContent(*fileData);
+		if (cookedTexture->getCookerVersion() == COOKER_VERSION && cookedTexture->getSourceHash() == *contentHash)
+		{
+			return true;
+		}
+		printf("WARNING: %s is out of date (run AssetCooker), decoding %s instead\n", cookedPath.c_str(), filePath.c_str());
+		cookedTexture->close();
+		return false;
+	}
 
-	// Load pixel data for image
-	std::string fileLoc = "Textures/" + fileName;
-	stbi_uc *image = stbi_load(fileLoc.c_str(), width, height, &channels, STBI_rgb_alpha);
+	*fileData = readTextureFile(fileName, filePath);
+	*contentHash = TextureCache::hashContent(*fileData);
+	return false;
+}
 
-	if (!image)
+std::vector<char> VulkanRenderer::readTextureFile(std::string fileName, std::string filePath)
+{
+	try
+	{
+		return readFile(filePath);
+	}
+	catch (const std::runtime_error &)
 	{
 		throw std::runtime_error("Failed to load a Texture file! (" + fileName + ")");
 	}
-
-	// Calculate image size given and known data
-	*imageSize = *width * (*height) * 4;
-
-	return image;
 }
 
@@ -13,13 +13,43 @@
 #include<stdexcept>
 #include <vector>
 #include <set>
+#include <deque>
+#include <functional>
+#include <unordered_map>
 #include "Utilities.h"
 #include "Mesh.h"
 #include <algorithm>
 #include <array>
 
-#include "stb_image.h"
 #include "MeshModel.h"
+#include "GpuProfiler.h"
+#include "SceneBuffer.h"
+#include "GpuCuller.h"
+#include "FrustumCuller.h"
+#include "SceneBvh.h"
+#include "RenderQueue.h"
+#include "TextureCache.h"
+#include "TextureLoader.h"
+#include "CookedMesh.h"
+#include "CookedTexture.h"
+#include "CookerVersion.h"
+#include "MeshImport.h"
+#include "ThreadPool.h"
+
+// Screen-space error (pixels) a LOD may have to be drawn at lod bias 0
+const float LOD_ERROR_PIXELS = 1.0f;
+
+// Draws of the GPU culled geometry subpass sharing a geometry page and texture, drawn by a single indirect call
+struct GpuDrawBatch
+{
+	int geometryPage;
+	int texId;
+	uint32_t firstCommand;
+	uint32_t drawCount;
+};
+
+// Draws each secondary command buffer of the geometry subpass should get at least, so small scenes record on fewer threads
+const size_t MIN_DRAWS_PER_SECONDARY = 128;
 
 class VulkanRenderer
 {
@@ -27,21 +57,91 @@ public:
 	VulkanRenderer();
 
 	int init(GLFWwindow *newWindow);
+	int initHeadless(uint32_t width, uint32_t height);
 	
+	// Loads the cooked version of the model (see CookedMeshFile::getCookedPath) if there is one, otherwise imports modelFile
 	int createMeshModel(std::string modelFile);
+	int createMeshModel(std::string modelFile, std::string cookedFile);
 	void updateModel(int modelId, glm::mat4 newModel);
+	// Draws the model once more with a transform of its own. Instances share the model's geometry, textures and LODs,
+	// and all of a model's meshes are drawn once for the model and its instances together (instanced draws)
+	int createInstance(int modelId, glm::mat4 transform);
+	void updateInstance(int instanceId, glm::mat4 newTransform);
+	void destroyInstance(int instanceId);
+	// Frees the model's geometry and its references to textures once the GPU is done with them, other ids stay valid
+	void destroyMeshModel(int modelId);
+
+	// Scene queries against the bounding boxes of the meshes. pickModel returns the model hit first by the ray (-1 if none),
+	// and which of its instances was hit (-1: the model itself). findModels returns each model with a mesh in reach of the sphere once.
+	int pickModel(glm::vec3 origin, glm::vec3 direction, int *hitInstanceId);
+	std::vector<int> findModels(glm::vec3 center, float radius);
 	void draw();
 	void cleanup();
 
+	// LOD selection: each step of bias doubles the screen-space error allowed (positive: coarser, negative: finer)
+	void setLodBias(float newLodBias);
+
+	// Applies to models imported from then on (cooked models were optimized by the cooker)
+	void setMeshOptimizeOptions(MeshOptimizeOptions newMeshOptimizeOptions);
+	MeshOptimizeReport getMeshOptimizeReport(int modelId);
+
+	// Geometry subpasses recorded so far (the rest of the frames reused the secondary command buffers of an earlier one)
+	uint64_t getRecordCount();
+	// Binds of the last CPU recorded geometry subpass, and the ones its sorted render queue saved
+	RenderQueueStats getRenderQueueStats();
+
+	// Cull and generate the geometry subpass draws on the GPU (default), falls back to CPU recorded draws where unsupported
+	void setGpuCulling(bool enabled);
+	bool isGpuCullingActive();
+	// Two pass occlusion culling against a depth pyramid on top of GPU culling (default), where supported
+	void setOcclusionCulling(bool enabled);
+	bool isOcclusionCullingActive();
+
+	GpuTimingStats getGpuTimings(GpuTimingScope scope);
+	MemoryAllocatorStats getMemoryStats();
+
 	~VulkanRenderer();
 
 private:
 	GLFWwindow * window;
 
 	int currentFrame = 0;
+	uint64_t frameCount = 0;						// Frames submitted so far
+
+	// Render into offscreen targets instead of a window surface + swapchain
+	bool headless = false;
 
 	// Scene Objects
 	std::vector<MeshModel> modelList;
+	std::vector<glm::mat4> modelTransforms;			// Transform of each model (index is the model id)
+	std::vector<std::vector<uint32_t>> selectedLods;	// LOD drawn for each mesh of each model
+	MeshOptimizeOptions meshOptimizeOptions;
+	float lodBias = 0.0f;
+
+	// Scene Instances
+	struct ModelInstance
+	{
+		int modelId = -1;							// -1 once destroyed, the id is reused by the next instance
+		glm::mat4 transform;
+	};
+	std::vector<ModelInstance> instanceList;
+	std::vector<int> freeInstanceIds;
+	std::vector<std::vector<int>> modelInstanceIds;	// Live instances of each model, in the order their transforms follow the model's
+	size_t liveInstanceCount = 0;
+
+	// Transforms copied into the scene buffer: each model's followed by its instances', so a model's draws
+	// cover all of them with firstInstance = the model's first transform and instanceCount = 1 + its instances
+	std::vector<glm::mat4> sceneTransforms;
+	std::vector<uint32_t> modelFirstTransforms;
+
+	// Scene change tracking, command buffers are only recorded again when what they draw changed
+	uint64_t sceneVersion = 1;						// Bumped by structural changes: models, textures, LODs drawn, finished uploads
+	uint64_t transformVersion = 1;					// Bumped when model/instance transforms (or anything else LODs are selected from) change
+	uint64_t packedTransformVersion = 0;			// transformVersion scene transforms were last packed and LODs selected at
+	TransferTicket drawnUploadTicket = 0;			// Last completed upload sceneVersion accounts for
+	uint64_t recordCount = 0;
+	bool gpuCulling = true;
+	bool occlusionCulling = true;
 
 	// Scene Settings
 	struct UboViewProjection
@@ -71,37 +171,71 @@ private:
 		VkDevice logicalDevice;
 		VkPhysicalDeviceFeatures deviceFeatures;
 	} mainDevice;
+	DeviceMemoryAllocator memoryAllocator;
+	TransferManager transferManager;
+	GeometryPool geometryPool;
+	bool drawIndirectCountSupported = false;		// VK_KHR_draw_indirect_count and the multi draw indirect features are enabled
 	VkQueue graphicsQueue;
 	VkQueue presentationQueue;
-	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
+	VkQueue transferQueue;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 	std::vector<SwapchainImage> swapchainImages;
+	std::vector<MemoryAllocation> offscreenImageMemory;		// Only used in headless mode, swapchain owns its own images
 	std::vector<VkFramebuffer> swapchainFramebuffers;
-	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<VkCommandBuffer> commandBuffers;		// Primary command buffer of each frame in flight, recorded every frame
+	std::vector<uint64_t> recordedSceneVersion;		// sceneVersion each image's geometry subpass was recorded at
 
 	std::vector<VkImage> colorBufferImage;
-	std::vector<VkDeviceMemory> colorBufferImageMemory;
+	std::vector<MemoryAllocation> colorBufferImageMemory;
 	std::vector<VkImageView> colorBufferImageView;
 
 	std::vector<VkImage> depthBufferImage;
-	std::vector<VkDeviceMemory> depthBufferImageMemory;
+	std::vector<MemoryAllocation> depthBufferImageMemory;
 	std::vector<VkImageView> depthBufferImageView;
+	bool depthSampleable = false;					// Depth images can be sampled (by the depth pyramid build)
 
 	VkSampler textureSampler;
+	bool textureBlitSupported = false;				// Texture format supports linear blits, so mip chains are generated on the GPU
 
 	// - Descriptors
 	VkDescriptorSetLayout descriptorSetLayout;
-	VkPushConstantRange pushConstantRange;
 
 	VkDescriptorSetLayout inputSetLayout;
 	VkDescriptorPool inputDescriptorPool;
 	std::vector<VkDescriptorSet> inputDescriptorSets;
 
 	VkDescriptorPool descriptorPool;
-	std::vector<VkDescriptorSet> descriptorSets;
-	
-	std::vector<VkBuffer> vpUniformBuffers;
-	std::vector<VkDeviceMemory> vpUniformBufferMemory;
+	std::vector<VkDescriptorSet> descriptorSets;	// One per swapchain image, pointing at its region of the scene buffer
+
+	SceneBuffer sceneBuffer;
+	std::vector<uint64_t> writtenTransformVersion;	// transformVersion of the transforms in each image's region
+
+	// - GPU culling
+	GpuCuller gpuCuller;
+	DepthPyramid depthPyramid;
+
+	// - CPU culling (when the GPU doesn't cull)
+	FrustumCuller frustumCuller;
+	std::vector<uint32_t> modelFirstCullObjects;	// Culler index of each model's first mesh, each mesh has one object per transform (model, then instances)
+	std::vector<uint8_t> cullVisibility;			// Result the geometry subpasses are recorded with
+	std::vector<uint32_t> instanceSlots;			// Position of each instance among its model's transforms (1 for the first instance)
+
+	// - Render queue of the CPU recorded geometry subpass
+	RenderQueue renderQueue;
+	RenderQueueStats renderQueueStats;
+
+	// - Scene BVH over the world bounds of every mesh under every transform it is drawn with
+	struct SceneObject
+	{
+		int modelId = -1;
+		uint32_t mesh = 0;
+		int instanceId = -1;						// -1: the model's own transform
+	};
+	SceneBvh sceneBvh;
+	std::vector<SceneObject> sceneObjects;			// Index is the BVH proxy
+	std::vector<std::vector<uint32_t>> modelProxies;	// Proxy of each mesh of each model
+	std::vector<std::vector<uint32_t>> instanceProxies;	// Proxy of each mesh of each instance
 	
 	std::vector<VkBuffer> modelUniformBuffersDynamic;
 	std::vector<VkDeviceMemory> modelUniformBufferMemoryDynamic;
@@ -113,9 +247,11 @@ private:
 
 	// - Assets
 	std::vector<VkImage> textureImages;
-	// TODO optimal approach would be to have a single image memory and to have textures reference offsets to the memory
-	std::vector<VkDeviceMemory> texturesImageMemory;
+	std::vector<MemoryAllocation> texturesImageMemory;
 	std::vector<VkImageView> textureImageViews;
+	std::vector<int> freeTextureIds;				// Slots of destroyed textures, reused (with their descriptor set) by new ones
+	TextureCache textureCache;
+	TextureLoader textureLoader;
 
 	VkDescriptorSetLayout samplerSetLayout;
 
@@ -131,8 +267,25 @@ private:
 
 	VkRenderPass renderPass;
 
+	// - Occlusion culling
+	// The early render pass draws last frame's visible meshes into the color and depth buffers, the late render pass
+	// (compatible with renderPass, so it shares its framebuffers and pipelines) loads them instead of clearing
+	VkRenderPass earlyRenderPass;
+	VkRenderPass lateRenderPass;
+	VkPipeline earlyGraphicsPipeline;
+	std::vector<VkFramebuffer> earlyFramebuffers;
+	std::vector<VkCommandBuffer> earlyGeometryCommandBuffers;		// Early render pass draws of each image, from its first secondary pool
+
 	// - Pools
-	VkCommandPool graphicsCommandPool;
+	std::vector<VkCommandPool> frameCommandPools;	// Transient pool of each frame in flight, reset once the frame's fence has signaled
+
+	// - Parallel recording
+	// The geometry subpass is split into secondary command buffers, recorded by the calling thread and the record threads.
+	// Each image has a pool per recording thread, so threads never share a pool and need no locking
+	ThreadPool recordThreads;
+	std::vector<std::vector<VkCommandPool>> secondaryCommandPools;		// [image][thread]
+	std::vector<std::vector<VkCommandBuffer>> geometryCommandBuffers;	// [image][thread]
+	std::vector<size_t> geometryCommandCounts;						// Secondary command buffers the image's geometry subpass was recorded into
 
 	// - Utility
 	VkFormat swapchainImageFormat;
@@ -145,6 +298,20 @@ private:
 	std::vector<VkSemaphore> imageAvailable;
 	std::vector<VkSemaphore> renderFinished;
 	std::vector<VkFence> drawFences;
+	std::vector<VkFence> imageFences;				// Fence of the last submission that used each swapchain image
+
+	// - Profiling
+	GpuProfiler gpuProfiler;
+
+	// - Deferred destruction
+	// Resources released while frames or uploads that use them may still be in flight
+	struct DeferredDestroy
+	{
+		uint64_t frame;								// frameCount when it was released
+		TransferTicket ticket;						// Last upload submitted when it was released
+		std::function<void()> destroy;
+	};
+	std::deque<DeferredDestroy> deferredDestroys;
 
 	// Vulkan functions
 	// - Create functions
@@ -152,9 +319,10 @@ private:
 	void createLogicalDevice();
 	void createSurface();
 	void createSwapChain();
+	void createOffscreenTargets(uint32_t width, uint32_t height);
+	void createRendererResources();
 	void createRenderPass();
 	void createDescriptorSetLayout();
-	void createPushConstantRange();
 	void createGraphicsPipeline();
 	void createColorBufferImage();
 	void createDepthBufferImage();
@@ -167,12 +335,28 @@ private:
 	void createUniformBuffers();
 	void createDescriptorPool();
 	void createDescriptorSets();
+	void writeDescriptorSet(uint32_t image);
 	void createInputDescriptorSets();
 
+	void updateScene();
+	void packSceneTransforms();
+	bool cullScene();
+	void insertSceneObjects(int modelId, int instanceId, std::vector<uint32_t> *proxies);
+	void updateSceneObjects(const std::vector<uint32_t> &proxies);
+	void removeSceneObjects(std::vector<uint32_t> *proxies);
+	glm::mat4 getObjectTransform(const SceneObject &object);
 	void updateUniformBuffers(uint32_t imageIndex);
 
 	// - Record Functions
 	void recordCommands(uint32_t currentImage);
+	void recordGeometrySubpass(uint32_t currentImage);
+	void recordGpuGeometrySubpass(uint32_t currentImage);
+	void recordGpuBatchDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, GpuCullPass pass, const std::vector<GpuDrawBatch> &batches);
+	VkResult beginGeometryCommands(VkCommandBuffer commandBuffer, uint32_t currentImage, bool early);
+	void buildRenderQueue();
+	VkResult recordGeometryCommands(VkCommandBuffer commandBuffer, uint32_t currentImage, size_t drawBegin, size_t drawEnd,
+		RenderQueueStats *stats);
+	uint32_t selectLod(Mesh *mesh, const glm::mat4 &model, glm::vec3 cameraPosition, float pixelScale);
 
 	// - Get Functions
 	void getPhysicalDevice();
@@ -189,6 +373,7 @@ private:
 	bool checkDeviceSuitable(VkPhysicalDevice device);
 
 	// -- Getter functions
+	std::vector<const char*> getRequiredDeviceExtensions();
 	QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
 	SwapChainDetails getSwapChainDetails(VkPhysicalDevice device);
 
@@ -209,16 +394,33 @@ private:
 	VkFormat chooseSupportedFormat(const std::vector<VkFormat> &formats, VkImageTiling tiling, VkFormatFeatureFlags featureFlags);
 
 	// -- Create Functions
-	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, 
-		VkMemoryPropertyFlags propertyFlags, VkDeviceMemory *imageMemory);
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+	VkImage createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, 
+		VkMemoryPropertyFlags propertyFlags, MemoryAllocation *imageMemory);
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 	VkShaderModule createShaderModule(const std::vector<char> &code);
 
-	int createTextureImage(std::string fileName);
-	int createTexture(std::string fileName);
+	VkImage createTextureImage(uint32_t width, uint32_t height, uint32_t mipLevels, MemoryAllocation *imageMemory);
+	int createTexture(std::string fileName, UploadBatch *uploadBatch);
+	std::vector<int> createTextures(const std::vector<std::string> &fileNames, std::vector<int> *textureIds);
+	int createCookedTexture(CookedTextureFile &cookedTexture, UploadBatch *uploadBatch);
+	int addTexture(VkImage image, MemoryAllocation imageMemory, uint32_t mipLevels);
 	int createTextureDescriptor(VkImageView textureImageView);
+	void writeTextureDescriptor(VkDescriptorSet descriptorSet, VkImageView textureImageView);
+
+	int createCookedMeshModel(CookedMeshFile &cookedMesh);
+	bool isCookedMeshCurrent(CookedMeshFile &cookedMesh, const std::string &modelFile);
+	int addMeshModel(std::vector<Mesh> modelMeshes, std::vector<int> textureIds, UploadBatch &uploadBatch);
+
+	// -- Release Functions
+	void releaseTexture(int textureId);
+	void deferDestroy(std::function<void()> destroy);
+	void runDeferredDestroys(bool waitedIdle);
 
 	// -- Loader Functions
-	stbi_uc *loadTextureFile(std::string fileName, int *width, int *height, VkDeviceSize *imageSize);
+	void *reserveTextureUpload(const std::string &fileName, const std::vector<char> &fileData, UploadBatch *uploadBatch,
+		VkImage *image, MemoryAllocation *imageMemory, int *width, int *height, uint32_t *mipLevels);
+	bool readTextureSource(const std::string &fileName, const std::string &filePath, CookedTextureFile *cookedTexture,
+		std::vector<char> *fileData, uint64_t *contentHash);
+	std::vector<char> readTextureFile(std::string fileName, std::string filePath);
 };
 
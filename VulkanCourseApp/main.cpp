@@ -1,4 +1,3 @@
-#define STB_IMAGE_IMPLEMENTATION
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
 #define GLFW_INCLUDE_VULKAN
@@ -7,8 +6,10 @@
 #include<stdexcept>
 #include <vector>
 #include <iostream>
+#include <chrono>
 
 #include "VulkanRenderer.h"
+#include "CpuTracer.h"
 
 GLFWwindow *window;
 VulkanRenderer vulkanRenderer;
@@ -28,8 +29,105 @@ void initWindow(std::string wName = "Test Window", const int width = 800, const
 
 
 
-int main()
+glm::mat4 skullTransform(float angle)
 {
+	glm::mat4 testMat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -10.0f, 0.0f));
+	testMat = glm::rotate(testMat, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	testMat = glm::rotate(testMat, glm::radians(angle), glm::vec3(0.0f, 0.0f, 1.0f));
+	return testMat;
+}
+
+int runHeadless(int frameCount)
+{
+	// No window: render into offscreen targets so this can run on machines without a display
+	if (vulkanRenderer.initHeadless(1366, 768) == EXIT_FAILURE)
+	{
+		return EXIT_FAILURE;
+	}
+
+	int skull = vulkanRenderer.createMeshModel("Models/12140_Skull_v3_L2.obj");
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < frameCount; i++)
+	{
+		// Fixed step so every run renders the same frames
+		vulkanRenderer.updateModel(skull, skullTransform(static_cast<float>(i % 360)));
+		vulkanRenderer.draw();
+	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+
+	double totalMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	printf("Rendered %d frames in %.2f ms (%.3f ms/frame)\n", frameCount, totalMs, totalMs / frameCount);
+	printf("  Geometry subpasses recorded: %llu\n", static_cast<unsigned long long>(vulkanRenderer.getRecordCount()));
+	printf("  Culling: GPU %s, occlusion %s\n", vulkanRenderer.isGpuCullingActive() ? "on" : "off",
+		vulkanRenderer.isOcclusionCullingActive() ? "on" : "off");
+	if (!vulkanRenderer.isGpuCullingActive())
+	{
+		RenderQueueStats queueStats = vulkanRenderer.getRenderQueueStats();
+		printf("  Render queue: %u draws, %u binds, %u redundant binds eliminated\n", queueStats.drawCount, queueStats.bindCount,
+			queueStats.redundantBinds);
+	}
+
+	// GPU side of the same frames
+	const char *scopeNames[GPU_SCOPE_COUNT] = { "Render pass", "Geometry subpass", "Second subpass" };
+	for (int i = 0; i < GPU_SCOPE_COUNT; i++)
+	{
+		GpuTimingStats stats = vulkanRenderer.getGpuTimings(static_cast<GpuTimingScope>(i));
+		printf("  GPU %-16s min %.3f ms, avg %.3f ms, p99 %.3f ms\n", scopeNames[i], stats.min, stats.avg, stats.p99);
+	}
+
+	// Only filled in if the model was imported rather than loaded cooked
+	MeshOptimizeReport optimizeReport = vulkanRenderer.getMeshOptimizeReport(skull);
+	if (optimizeReport.before.triangleCount > 0)
+	{
+		printf("  Vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", optimizeReport.before.getAcmr(), optimizeReport.after.getAcmr(),
+			optimizeReport.before.getAtvr(), optimizeReport.after.getAtvr());
+	}
+
+	MemoryAllocatorStats memoryStats = vulkanRenderer.getMemoryStats();
+	printf("  Device memory: %u blocks (%.1f MB), %u dedicated, %u sub-allocations (%.1f MB used)\n",
+		memoryStats.blockCount, memoryStats.blockBytes / (1024.0 * 1024.0), memoryStats.dedicatedCount,
+		memoryStats.allocationCount, memoryStats.usedBytes / (1024.0 * 1024.0));
+
+	vulkanRenderer.cleanup();
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	// --headless [frames]	: render offscreen without creating a window
+	// --trace <file>		: write a Chrome trace of the CPU frame timeline on exit
+	bool headlessMode = false;
+	int frameCount = 1000;
+	std::string traceFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--headless")
+		{
+			headlessMode = true;
+			if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+			{
+				frameCount = std::max(1, atoi(argv[++i]));
+			}
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			traceFile = argv[++i];
+		}
+	}
+
+	if (headlessMode)
+	{
+		int result = runHeadless(frameCount);
+		if (!traceFile.empty())
+		{
+			CpuTracer::dumpChromeTrace(traceFile);
+		}
+		return result;
+	}
+
 	// Create window
 	initWindow("Test Window", 1366, 768);
 
@@ -62,14 +160,16 @@ int main()
 			angle -= 360.0f;
 		}
 
-		glm::mat4 testMat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -10.0f, 0.0f));
-		testMat = glm::rotate(testMat, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-		testMat = glm::rotate(testMat, glm::radians(angle), glm::vec3(0.0f, 0.0f, 1.0f));
-		vulkanRenderer.updateModel(skull, testMat);
+		vulkanRenderer.updateModel(skull, skullTransform(angle));
 
 		vulkanRenderer.draw();
 	} 
 
+	if (!traceFile.empty())
+	{
+		CpuTracer::dumpChromeTrace(traceFile);
+	}
+
 	vulkanRenderer.cleanup();
 
 	// Destroy GLFW window and stop GLFW